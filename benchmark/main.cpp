@@ -0,0 +1,265 @@
+#include <modbus-register.h>
+#include <modbus-multi-server.h>
+#include <modbus-recorder.h>
+#include "test-layouts.h"
+#include "fronius-meter-sunspec-layout.h"
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <print>
+
+// Microbenchmarks of the protocol hot paths, all in memory without any io.
+// Results are written as json to stdout or to the file given with --out, eg.
+// libmodbus-static-benchmark --min-time-ms 200 --filter crc16 --out bench_output.txt
+
+using namespace libmodbus_static;
+using clock_type = std::chrono::steady_clock;
+
+template<typename T>
+inline void do_not_optimize(const T &v) { asm volatile("" : : "g"(&v) : "memory"); }
+
+struct bench_result {
+	std::string name{};
+	std::string layout{};
+	int param{};
+	uint64_t iterations{};
+	double ns_per_op{};
+	double mb_per_s{};
+};
+
+std::vector<bench_result> results{};
+std::chrono::nanoseconds min_time{std::chrono::milliseconds(100)};
+std::string_view filter{};
+
+// runs f until min_time is reached, bytes is the amount of data processed per call
+template<typename F>
+void run(std::string_view name, std::string_view layout, int param, size_t bytes, F &&f) {
+	std::string full_name = std::string(name) + "/" + std::string(layout) + "/" + std::to_string(param);
+	if (!filter.empty() && full_name.find(filter) == std::string::npos)
+		return;
+	for (int i = 0; i < 100; ++i)
+		f();
+	uint64_t n{1};
+	std::chrono::nanoseconds elapsed{};
+	while (true) {
+		auto start = clock_type::now();
+		for (uint64_t i = 0; i < n; ++i)
+			f();
+		elapsed = clock_type::now() - start;
+		if (elapsed >= min_time)
+			break;
+		// aim a bit above min_time to not need another round
+		n = elapsed < min_time / 100 ? n * 100: uint64_t(n * 1.2 * min_time.count() / elapsed.count()) + 1;
+	}
+	double ns = double(elapsed.count()) / n;
+	results.push_back({std::string(name), std::string(layout), param, n, ns, bytes ? bytes * 1e3 / ns: 0.});
+	std::println(stderr, "{:<40} {:>10.2f} ns/op", full_name, ns);
+}
+
+void check(bool ok, std::string_view what) {
+	if (ok)
+		return;
+	std::println(stderr, "Benchmark setup failed: {}", what);
+	std::exit(1);
+}
+
+// ---------------------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------------------
+void bench_crc16() {
+	std::array<uint8_t, 256> data{};
+	for (int i: std::ranges::iota_view{0, 256})
+		data[i] = uint8_t(i * 7);
+	for (int size: {8, 64, 256}) {
+		std::span<uint8_t> s{data.data(), size_t(size)};
+		run("crc16", "none", size, size, [&] { do_not_optimize(checksum::calculate_crc16(s)); });
+	}
+}
+
+struct request_case {
+	function_code fc{};
+	libmodbus_static::register_t type{};
+	uint16_t offset{};
+	uint16_t count{};
+};
+
+// request frame of a case, created by a client register
+template<typename Layout>
+std::vector<uint8_t> make_request(transport_t transport, const request_case &c) {
+	static modbus_register<Layout> client{.role = role_t::CLIENT};
+	check((transport == transport_t::TCP ? client.start_tcp_frame(1, 1): client.start_rtu_frame(1)) == OK, "start frame");
+	bool read = c.fc <= function_code::READ_INPUT_REGISTERS;
+	auto [res, err] = read ? client.get_frame_read(c.type, c.offset, c.count): client.get_frame_write(c.type, c.offset, c.count);
+	check(err == OK && client.lc.fc == c.fc, "request frame");
+	return {res.begin(), res.end()};
+}
+
+// per byte parsing (process_tcp/process_rtu), span parsing (process_tcp_adu) and the response
+// creation. get_frame_response needs a freshly parsed request, so it includes the byte parsing,
+// which is reported on its own by parse_tcp_bytes
+template<typename Layout>
+void bench_frames(std::string_view layout, std::span<const request_case> cases) {
+	static modbus_register<Layout> server{.addr = 1};
+	for (const request_case &c: cases) {
+		int param = int(c.fc) * 10000 + c.count;
+		std::vector<uint8_t> tcp = make_request<Layout>(transport_t::TCP, c);
+		std::vector<uint8_t> rtu = make_request<Layout>(transport_t::RTU, c);
+		auto [res, err] = server.process_tcp_adu(tcp);
+		check(err == OK && res.size() > 7 && res[7] == uint8_t(c.fc), "server response");
+
+		run("parse_tcp_bytes", layout, param, tcp.size(), [&] {
+			server.switch_to_request();
+			for (uint8_t b: tcp)
+				do_not_optimize(server.process_tcp(b));
+		});
+		run("parse_rtu_bytes", layout, param, rtu.size(), [&] {
+			server.switch_to_request();
+			for (uint8_t b: rtu)
+				do_not_optimize(server.process_rtu(b));
+		});
+		run("get_frame_response", layout, param, tcp.size(), [&] {
+			server.switch_to_request();
+			for (uint8_t b: tcp)
+				server.process_tcp(b);
+			do_not_optimize(server.get_frame_response());
+		});
+		run("process_tcp_adu", layout, param, tcp.size(), [&] { do_not_optimize(server.process_tcp_adu(tcp)); });
+		run("process_tcp_adu_iov", layout, param, tcp.size(), [&] { do_not_optimize(server.process_tcp_adu_iov(tcp)); });
+	}
+}
+
+// dispatch of the multi unit server, param is the number of units
+void bench_multi_server() {
+	static modbus_multi_server<> server{};
+	static std::array<unit_register<test_layout>, 247> units{};
+	for (int i: std::ranges::iota_view{0, 247})
+		check(server.add_unit(i + 1, units[i]) == OK, "add unit");
+	request_case c{function_code::READ_HOLDING_REGISTERS, libmodbus_static::register_t::HALFS, 0, 4};
+	std::vector<uint8_t> tcp = make_request<test_layout>(transport_t::TCP, c);
+	tcp[6] = 200;
+	auto [res, err] = server.process_tcp_adu(tcp);
+	check(err == OK && res.size() > 7 && res[6] == 200, "multi server response");
+	run("multi_server_tcp_adu", "test_layout", 247, tcp.size(), [&] { do_not_optimize(server.process_tcp_adu(tcp)); });
+}
+
+// records into /dev/null, so the flushes are included without disk io
+void bench_recorder() {
+	static poll_recorder recorder{};
+	check(recorder.open<test_layout>("/dev/null") == OK, "recorder open");
+	static std::array<uint8_t, 246> block{};
+	for (int size: {2, 32, 246}) {
+		run("recorder_record", "none", size, size, [&] {
+			do_not_optimize(recorder.record(1, function_code::READ_HOLDING_REGISTERS, 0, size / 2, std::span{block}.first(size)));
+		});
+	}
+	recorder.close();
+}
+
+struct bench_bits_layout {
+	constexpr static int OFFSET{0};
+	std::array<uint8_t, 256> data{};
+};
+
+void bench_bits() {
+	static bench_bits_layout storage{};
+	static std::array<uint8_t, 256> packed{};
+	for (int count: {8, 26, 256, 2000}) {
+		// offset 3 is the unaligned worst case
+		run("read_bits", "none", count, (count + 7) / 8, [&] {
+			read_bits_from_storage(storage, 3, count, packed.data());
+			do_not_optimize(packed);
+		});
+		run("write_bits", "none", count, (count + 7) / 8, [&] {
+			write_bits_to_storage(storage, 3, count, packed.data());
+			do_not_optimize(storage);
+		});
+	}
+}
+
+template<typename Layout, typename Mem>
+void bench_swap(std::string_view name, Mem mem) {
+	static modbus_register<Layout> reg{};
+	using T = MemberType<Layout, Mem>;
+	T value{};
+	run(std::string("read_") + std::string(name), "swap", sizeof(T), sizeof(T), [&] {
+		value = reg.read(mem);
+		do_not_optimize(value);
+	});
+	run(std::string("write_") + std::string(name), "swap", sizeof(T), sizeof(T), [&] {
+		reg.write(value, mem);
+		do_not_optimize(reg.storage);
+	});
+}
+
+void write_json(FILE *out) {
+	std::println(out, "{{");
+	std::println(out, "  \"library\": \"libmodbus-static\",");
+	std::println(out, "  \"compiler\": \"{}\",", __VERSION__);
+	std::println(out, "  \"min_time_ns\": {},", min_time.count());
+	std::println(out, "  \"benchmarks\": [");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const bench_result &r = results[i];
+		std::println(out, "    {{\"name\": \"{}\", \"layout\": \"{}\", \"param\": {}, \"iterations\": {}, \"ns_per_op\": {:.3f}, \"mb_per_s\": {:.3f}}}{}",
+			r.name, r.layout, r.param, r.iterations, r.ns_per_op, r.mb_per_s, i + 1 < results.size() ? ",": "");
+	}
+	std::println(out, "  ]");
+	std::println(out, "}}");
+}
+
+int main(int argc, char **argv) {
+	const char *out_path{};
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string_view arg{argv[i]};
+		if (arg == "--min-time-ms")
+			min_time = std::chrono::milliseconds(std::atoi(argv[i + 1]));
+		else if (arg == "--filter")
+			filter = argv[i + 1];
+		else if (arg == "--out")
+			out_path = argv[i + 1];
+	}
+
+	bench_crc16();
+
+	// param of the frame benchmarks is function_code * 10000 + register/bit count
+	constexpr std::array test_cases{
+		request_case{function_code::READ_COILS, libmodbus_static::register_t::BITS, 20, 1},
+		request_case{function_code::READ_COILS, libmodbus_static::register_t::BITS, 20, 26},
+		request_case{function_code::READ_DISCRETE_INPUTS, libmodbus_static::register_t::BITS_WRITE, 10, 26},
+		request_case{function_code::READ_HOLDING_REGISTERS, libmodbus_static::register_t::HALFS, 0, 1},
+		request_case{function_code::READ_HOLDING_REGISTERS, libmodbus_static::register_t::HALFS, 0, 4},
+		request_case{function_code::READ_INPUT_REGISTERS, libmodbus_static::register_t::HALFS_WRITE, 0, 4},
+		request_case{function_code::WRITE_SINGLE_COIL, libmodbus_static::register_t::BITS_WRITE, 12, 1},
+		request_case{function_code::WRITE_SINGLE_REGISTER, libmodbus_static::register_t::HALFS_WRITE, 1, 1},
+		request_case{function_code::WRITE_MULTIPLE_COILS, libmodbus_static::register_t::BITS_WRITE, 10, 26},
+		request_case{function_code::WRITE_MULTIPLE_REGISTERS, libmodbus_static::register_t::HALFS_WRITE, 0, 4},
+	};
+	bench_frames<test_layout>("test_layout", test_cases);
+	constexpr std::array fronius_cases{
+		request_case{function_code::READ_HOLDING_REGISTERS, libmodbus_static::register_t::HALFS, 40001, 1},
+		request_case{function_code::READ_HOLDING_REGISTERS, libmodbus_static::register_t::HALFS, 40001, 16},
+		// largest read, its 259 byte tcp response fits the default frame of the register
+		request_case{function_code::READ_HOLDING_REGISTERS, libmodbus_static::register_t::HALFS, 40001, 125},
+	};
+	bench_frames<fronius_meter::layout>("fronius", fronius_cases);
+	bench_multi_server();
+	bench_recorder();
+
+	bench_bits();
+
+	bench_swap<test_layout>("uint16", &test_layout::halfs_layout::r1);
+	bench_swap<example_layout>("float", &example_layout::halfs_layout::a);
+	bench_swap<example_layout>("uint32", &example_layout::halfs_layout::events);
+	bench_swap<example_layout>("string", &example_layout::halfs_layout::string_field);
+	bench_swap<fronius_meter::layout>("fronius_float", &fronius_meter::halfs_layout::w);
+	bench_swap<fronius_meter::layout>("fronius_string", &fronius_meter::halfs_layout::manufacturer);
+
+	FILE *out = out_path ? std::fopen(out_path, "w"): stdout;
+	check(out, "open output file");
+	write_json(out);
+	if (out != stdout)
+		std::fclose(out);
+	return 0;
+}
+
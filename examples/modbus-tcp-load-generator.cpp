@@ -0,0 +1,336 @@
+#include <modbus-register.h>
+#include <modbus-latency.h>
+#include <ranges>
+#include <print>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+using namespace libmodbus_static;
+using clock_type = std::chrono::steady_clock;
+
+void print_usage() {
+	std::println(R"(
+Modbus tcp load generator, measures the throughput and latency percentiles of a modbus tcp server
+
+modbus-tcp-load-generator [--host,-H IP=127.0.0.1] [--port,-p PORT=502] [--unit,-u UNIT=1]
+	[--connections,-c N=1] [--pipeline,-d DEPTH=1] [--rate,-r REQUESTS_PER_SECOND=0 (full throttle)]
+	[--duration,-t SECONDS=10] [--mix,-m FC03,FC16,FC01=100,0,0 (weights)]
+	[--read ADDR,COUNT=40001,10] [--write ADDR,COUNT=40001,2] [--coils ADDR,COUNT=0,16] [--help]
+
+Eg. against raw-modbus-tcp-linux-server on port 1502 with 16 connections, 4 requests in flight each:
+modbus-tcp-load-generator -p 1502 -c 16 -d 4 -t 5
+)");
+}
+
+static std::atomic<bool>& RunningSingleton() { static std::atomic<bool> is_running{true}; return is_running; }
+
+void sig_handler(int) {
+	RunningSingleton() = false;
+}
+
+// the frame builder only needs a layout to be instantiated, all requests use the raw register addresses
+struct load_layout {
+	struct halfs_layout {
+		constexpr static int OFFSET{0};
+		uint16_t unused{};
+	} halfs_registers;
+};
+
+struct range {
+	uint16_t addr{};
+	uint16_t count{};
+};
+
+struct load_config {
+	const char *host{"127.0.0.1"};
+	int port{502};
+	uint8_t unit{1};
+	int connections{1};
+	int pipeline{1};
+	double rate{};
+	int duration{10};
+	std::array<int, 3> mix{100, 0, 0};
+	range read{40001, 10};
+	range write{40001, 2};
+	range coils{0, 16};
+};
+
+constexpr std::array<function_code, 3> MIX_FCS{function_code::READ_HOLDING_REGISTERS,
+	function_code::WRITE_MULTIPLE_REGISTERS, function_code::READ_COILS};
+constexpr int MAX_PIPELINE{64};
+constexpr std::chrono::seconds REQUEST_TIMEOUT{1};
+
+struct pending {
+	uint16_t tid{};
+	function_code fc{};
+	clock_type::time_point sent{};
+};
+
+struct connection {
+	int fd{-1};
+	tcp_adu_collector<> rx{};
+	std::array<pending, MAX_PIPELINE> in_flight{};
+	int in_flight_count{};
+	uint16_t next_tid{1};
+};
+
+struct load_stats {
+	uint64_t sent{};
+	uint64_t responses{};
+	std::array<uint64_t, 3> exceptions{};
+	uint64_t timeouts{};
+	uint64_t errors{};	// invalid responses, unknown transaction ids and closed connections
+};
+
+bool parse_range(const char *s, range &r) {
+	char *end{};
+	r.addr = std::strtol(s, &end, 0);
+	if (*end != ',')
+		return false;
+	r.count = std::strtol(end + 1, nullptr, 0);
+	return r.count > 0;
+}
+
+int connect_to(const load_config &config) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(config.port);
+	addr.sin_addr.s_addr = inet_addr(config.host);
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	int one{1};
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+int mix_index(const load_config &config, uint32_t &rng) {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	int total = config.mix[0] + config.mix[1] + config.mix[2];
+	int pick = rng % total;
+	for (int i: std::ranges::iota_view{0, 3}) {
+		if (pick < config.mix[i])
+			return i;
+		pick -= config.mix[i];
+	}
+	return 0;
+}
+
+// builds the next request with the library frame builder and sends it, false if the connection died
+bool send_request(const load_config &config, connection &c, int fc_index, load_stats &stats) {
+	static modbus_register<load_layout> builder{.role = role_t::CLIENT};
+	static std::array<uint8_t, 246> write_data{};
+	uint16_t tid = c.next_tid++;
+	if (builder.start_tcp_frame(tid, config.unit) != OK)
+		return false;
+	result_err frame{};
+	switch (MIX_FCS[fc_index]) {
+	case function_code::READ_HOLDING_REGISTERS:
+		frame = builder.get_frame_read(libmodbus_static::register_t::HALFS, config.read.addr, config.read.count);
+		break;
+	case function_code::WRITE_MULTIPLE_REGISTERS:
+		frame = builder.get_frame_write(libmodbus_static::register_t::HALFS_WRITE, config.write.addr,
+			std::span<uint8_t>{write_data.data(), size_t(config.write.count) * 2});
+		break;
+	default:
+		frame = builder.get_frame_read(libmodbus_static::register_t::BITS, config.coils.addr, config.coils.count);
+		break;
+	}
+	if (frame.err != OK)
+		return false;
+	c.in_flight[c.in_flight_count++] = pending{tid, MIX_FCS[fc_index], clock_type::now()};
+	++stats.sent;
+	// requests are small, a blocking send only waits if the server does not read at all
+	return send(c.fd, frame.res.data(), frame.res.size(), MSG_NOSIGNAL) == ssize_t(frame.res.size());
+}
+
+void receive(connection &c, latency_stats &latency, load_stats &stats, const load_config &config) {
+	std::array<uint8_t, 4096> buffer;
+	ssize_t n = recv(c.fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		close(c.fd);
+		c.fd = -1;
+		stats.errors += c.in_flight_count + 1;
+		c.in_flight_count = 0;
+		return;
+	}
+	auto now = clock_type::now();
+	for (uint8_t b: buffer | std::views::take(std::max<ssize_t>(n, 0))) {
+		if (c.rx.push(b) != OK) {
+			++stats.errors;
+			c.rx.clear();
+			continue;
+		}
+		if (!c.rx.complete())
+			continue;
+		uint16_t tid = c.rx.transaction_id();
+		auto p = std::ranges::find_if(c.in_flight | std::views::take(c.in_flight_count), [tid](const pending &p){ return p.tid == tid; });
+		if (p == c.in_flight.begin() + c.in_flight_count || c.rx.adu.size() < 8) {
+			++stats.errors;
+		} else {
+			++stats.responses;
+			if (c.rx.adu[7] & 0x80)
+				++stats.exceptions[std::ranges::find(MIX_FCS, p->fc) - MIX_FCS.begin()];
+			latency.record(config.unit, p->fc, now - p->sent);
+			*p = c.in_flight[--c.in_flight_count];
+		}
+		c.rx.clear();
+	}
+}
+
+void print_histogram(std::string_view name, const latency_histogram &h, double seconds) {
+	auto us = [](std::chrono::nanoseconds t) { return t.count() / 1000.; };
+	std::println("{:<12} {:>10} {:>10.1f}/s  p50 {:>9.1f}us  p90 {:>9.1f}us  p99 {:>9.1f}us  p99.9 {:>9.1f}us  max {:>9.1f}us",
+		name, h.count(), h.count() / seconds, us(h.percentile(50)), us(h.percentile(90)), us(h.percentile(99)),
+		us(h.percentile(99.9)), us(h.max()));
+}
+
+int main(int argc, char **argv) {
+	signal(SIGINT, sig_handler);
+
+	load_config config{};
+	for (int i: std::ranges::iota_view{1, argc}) {
+		std::string_view arg{argv[i]};
+		const char *value = i + 1 < argc ? argv[i + 1]: nullptr;
+		if (arg == "--help" || arg == "-h") {
+			print_usage();
+			return EXIT_SUCCESS;
+		}
+		if (!value)
+			continue;
+		if (arg == "--host" || arg == "-H")
+			config.host = value;
+		else if (arg == "--port" || arg == "-p")
+			config.port = std::strtol(value, nullptr, 0);
+		else if (arg == "--unit" || arg == "-u")
+			config.unit = std::strtol(value, nullptr, 0);
+		else if (arg == "--connections" || arg == "-c")
+			config.connections = std::max(1l, std::strtol(value, nullptr, 0));
+		else if (arg == "--pipeline" || arg == "-d")
+			config.pipeline = std::clamp<int>(std::strtol(value, nullptr, 0), 1, MAX_PIPELINE);
+		else if (arg == "--rate" || arg == "-r")
+			config.rate = std::strtod(value, nullptr);
+		else if (arg == "--duration" || arg == "-t")
+			config.duration = std::strtol(value, nullptr, 0);
+		else if ((arg == "--mix" || arg == "-m") && std::sscanf(value, "%d,%d,%d", &config.mix[0], &config.mix[1], &config.mix[2]) != 3)
+			config.mix = {-1, 0, 0};
+		else if (arg == "--read" && !parse_range(value, config.read))
+			config.read.count = 0;
+		else if (arg == "--write" && !parse_range(value, config.write))
+			config.write.count = 0;
+		else if (arg == "--coils" && !parse_range(value, config.coils))
+			config.coils.count = 0;
+	}
+	if (std::ranges::any_of(config.mix, [](int w){ return w < 0; }) || config.mix[0] + config.mix[1] + config.mix[2] == 0 ||
+		!config.read.count || !config.write.count || !config.coils.count) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	std::vector<connection> connections(config.connections);
+	std::vector<pollfd> fds(config.connections);
+	for (connection &c: connections) {
+		c.fd = connect_to(config);
+		if (c.fd < 0) {
+			std::println("Connecting to {}:{} failed", config.host, config.port);
+			return EXIT_FAILURE;
+		}
+	}
+	std::println("Running {} connections with pipeline depth {} against {}:{} for {}s ({})", config.connections,
+		config.pipeline, config.host, config.port, config.duration, config.rate > 0 ? "fixed rate": "full throttle");
+
+	static latency_stats latency{};
+	load_stats stats{};
+	uint32_t rng{1};
+	auto start = clock_type::now();
+	auto end = start + std::chrono::seconds(config.duration);
+	auto interval = config.rate > 0 ? std::chrono::nanoseconds(int64_t(1e9 / config.rate)): std::chrono::nanoseconds(0);
+	auto next_send = start;
+	int next_connection{};
+	while (RunningSingleton() && clock_type::now() < end) {
+		auto now = clock_type::now();
+		// fixed rate: requests are due at fixed times and go to the next connection with a free slot,
+		// full throttle: every connection is kept filled up to the pipeline depth
+		for (int tries = 0; tries < config.connections && (interval.count() == 0 || next_send <= now); ++tries) {
+			connection &c = connections[next_connection];
+			next_connection = (next_connection + 1) % config.connections;
+			while (c.fd >= 0 && c.in_flight_count < config.pipeline && (interval.count() == 0 || next_send <= now)) {
+				if (!send_request(config, c, mix_index(config, rng), stats)) {
+					close(c.fd);
+					c.fd = -1;
+					stats.errors += c.in_flight_count;
+					c.in_flight_count = 0;
+				}
+				next_send += interval;
+			}
+		}
+		// all connections are busy, the due requests are sent when slots are free again but a
+		// backlog of more than a second is dropped to not burst after a server stall
+		if (interval.count() && now - next_send > std::chrono::seconds(1))
+			next_send = now;
+
+		for (int i: std::ranges::iota_view{0, config.connections})
+			fds[i] = pollfd{.fd = connections[i].fd, .events = POLLIN, .revents = 0};
+		auto wait = std::chrono::nanoseconds(std::chrono::milliseconds(10));
+		if (interval.count())
+			wait = std::clamp<std::chrono::nanoseconds>(next_send - now, std::chrono::nanoseconds(0), wait);
+		timespec wait_ts{.tv_sec = 0, .tv_nsec = wait.count()};
+		if (ppoll(fds.data(), fds.size(), &wait_ts, nullptr) < 0 && errno != EINTR)
+			break;
+		for (int i: std::ranges::iota_view{0, config.connections}) {
+			if (fds[i].fd >= 0 && fds[i].revents)
+				receive(connections[i], latency, stats, config);
+		}
+
+		now = clock_type::now();
+		for (connection &c: connections) {
+			for (int i = 0; i < c.in_flight_count;) {
+				if (now - c.in_flight[i].sent < REQUEST_TIMEOUT) {
+					++i;
+					continue;
+				}
+				++stats.timeouts;
+				c.in_flight[i] = c.in_flight[--c.in_flight_count];
+			}
+		}
+		if (std::ranges::all_of(connections, [](const connection &c){ return c.fd < 0; })) {
+			std::println("All connections were closed by the server");
+			break;
+		}
+	}
+	double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+	for (connection &c: connections) {
+		if (c.fd >= 0)
+			close(c.fd);
+	}
+
+	std::println("");
+	std::println("sent {} responses {} in {:.2f}s: {:.1f} requests/s", stats.sent, stats.responses, seconds, stats.responses / seconds);
+	std::println("timeouts {} errors {} exceptions fc03 {} fc16 {} fc01 {}", stats.timeouts, stats.errors,
+		stats.exceptions[0], stats.exceptions[1], stats.exceptions[2]);
+	std::println("");
+	for (int i: std::ranges::iota_view{0, 3}) {
+		if (const latency_histogram *h = latency.find(config.unit, MIX_FCS[i]))
+			print_histogram(std::array{"fc03", "fc16", "fc01"}[i], *h, seconds);
+	}
+	print_histogram("all", latency.total(), seconds);
+
+	return stats.errors || stats.timeouts ? EXIT_FAILURE: EXIT_SUCCESS;
+}
+
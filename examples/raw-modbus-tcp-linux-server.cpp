@@ -1,12 +1,10 @@
 #include "fronius-meter-sunspec-layout.h"
-#include <modbus-register.h>
+#include <modbus-tcp-linux-server.h>
 #include <ranges>
 #include <print>
 #include <atomic>
 
 #include <signal.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
 
 using namespace libmodbus_static;
 
@@ -19,42 +17,9 @@ modbus-tcp-linux-server [--port,-p PORT=502] [--address,-t ADDRESS=1] [--help]
 }
 
 static std::atomic<bool>& RunningSingleton() { static std::atomic<bool> is_running{true}; return is_running; }
-static int& TcpSocketSingleton() { static int socket{}; return socket; }
 
 void sig_handler(int) {
 	RunningSingleton() = false;
-	close(TcpSocketSingleton());
-}
-
-int create_tcp_socket(int port) {
-	struct sockaddr_in addr;
-	int &fd = TcpSocketSingleton();
-
-	fd = socket(AF_INET, SOCK_STREAM, 0);
-	if(fd == -1)
-	{
-		std::println("Error opening socket");
-		return -1;
-	}
-
-	addr.sin_port = htons(port);
-	addr.sin_addr.s_addr = 0;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_family = AF_INET;
-
-	if(bind(fd, (struct sockaddr *)&addr,sizeof(struct sockaddr_in) ) == -1)
-	{
-		std::println("Error binding socket on port {}", port);
-		return -1;
-	}
-
-	if (0 > listen(fd, 10)) {
-		std::println("Listen on the socket failed");
-		return -1;
-	}
-
-	std::println("Successfully bound tcp socket to port {}", port);
-	return fd;
 }
 
 int main(int argc, char **argv) {
@@ -75,69 +40,29 @@ int main(int argc, char **argv) {
 			return EXIT_SUCCESS;
 		}
 	}
-	
-	int tcp_socket = create_tcp_socket(port);
-	if (tcp_socket == -1)
-		return EXIT_FAILURE;
-
-	auto modbus_server = modbus_register<fronius_meter::layout>::Default(addr);
-	std::println("Created modbus server on port {} with addr {}", port, modbus_server.addr);
 
+	auto &modbus_server = modbus_register<fronius_meter::layout>::Default(addr);
 	modbus_server.write(1.0f, &fronius_meter::halfs_layout::pf);
 	modbus_server.write(1.0f, &fronius_meter::halfs_layout::pfpha);
 	modbus_server.write(1.0f, &fronius_meter::halfs_layout::pfphb);
 	modbus_server.write(1.0f, &fronius_meter::halfs_layout::pfphc);
 
+	// connections are kept open, requests of all clients are served from a single thread
+	static tcp_linux_server<modbus_register<fronius_meter::layout>> tcp_server{.handler = modbus_server};
+	if (result r = tcp_server.init(port); r != OK) {
+		std::println("Starting the tcp server on port {} failed with {}", port, r);
+		return EXIT_FAILURE;
+	}
+	std::println("Created modbus server on port {} with addr {}", tcp_server.port(), modbus_server.addr);
+
 	while (RunningSingleton()) {
-		// get buffer data
-		struct sockaddr_in s_addr;
-		struct sockaddr_in c_addr;
-		socklen_t s = sizeof(s_addr);
-		int c = accept(tcp_socket, reinterpret_cast<struct sockaddr*>(&c_addr), &s);
-		if (c <= 0) {
-			std::println("Accept error");
-			close(c);
-			continue;
-		}
-		std::array<uint8_t, 1024> buf{};
-		int len{};
-		if (0 > (len = recv(c, buf.data(), buf.size() -1, 0))) {
-			close(c);
-		}
-		std::println("Got frame: {}", std::span(buf.data(), len));
-		// execute modbus response
-		for(int i: std::ranges::iota_view{0, len}) {
-			std::string_view r = modbus_server.process_tcp(buf[i]).err;
-			if (r == IN_PROGRESS)
-				continue;
-			if (r != OK) {
-				std::println("Modbus parsing failed with {}", r);
-				continue;
-			}
-			auto [res, err] = modbus_server.get_frame_response();
-			if (err != OK) {
-				std::println("Modbus generating response failed with {}", err);
-				r_tie{res, err} = modbus_server.get_frame_error_response(err);
-				if (err != OK) {
-					std::println("Modbus generating error response failed with {}", err);
-					continue;
-				}
-			}
-			std::println("Sending response: {}", res);
-			ssize_t sent_bytes = write(c, res.data(), res.size());
-			if (sent_bytes != res.size())
-				std::println("Only {} bytes of {} bytes written", sent_bytes, res.size());
-			modbus_server.switch_to_request();
-		}
-		// close connection for next request
-		modbus_server.switch_to_request();
-		close(c);
+		if (result r = tcp_server.poll(std::chrono::milliseconds(100)); r != OK)
+			std::println("Polling the tcp server failed with {}", r);
 	}
 
 	std::println("Modbus server done, shutting down");
 
-	close(tcp_socket);
+	tcp_server.deinit();
 
 	return EXIT_SUCCESS;
 }
-
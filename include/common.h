@@ -134,10 +134,11 @@ uint16_t calculate_crc16(std::span<uint8_t> buffer);
 
 template<int N>
 struct static_byte_vector {
+	using size_type = std::conditional_t<(N < 256), uint8_t, uint16_t>;
 	std::array<uint8_t, N> storage{};
-	int cur_size{};
-	constexpr uint8_t& operator[](int i) { return storage[std::min(i, cur_size)]; }
-	constexpr const uint8_t& operator[](int i) const { return storage[std::min(i, cur_size)]; }
+	size_type cur_size{};
+	constexpr uint8_t& operator[](int i) { return storage[std::min(i, int(cur_size))]; }
+	constexpr const uint8_t& operator[](int i) const { return storage[std::min(i, int(cur_size))]; }
 	constexpr uint8_t* begin() { return storage.begin(); }
 	constexpr uint8_t* end() { return storage.begin() + cur_size; }
 	constexpr const uint8_t* begin() const { return storage.begin(); }
@@ -151,9 +152,20 @@ struct static_byte_vector {
 	constexpr std::span<const uint8_t> span() const { return {begin(), end()}; }
 };
 
+// maximum frame sizes, a tcp adu is the 253 byte pdu with mbap header and unit id, an rtu frame
+// the pdu with address and crc
+constexpr int TCP_ADU_SIZE{260};
+constexpr int RTU_FRAME_SIZE{256};
+constexpr int max_frame_size(transport_t t) { return t == transport_t::TCP ? TCP_ADU_SIZE: RTU_FRAME_SIZE; }
+
+/**
+ * Frame buffer with the parse/write state. The fields are stored as 8 bit offsets into
+ * frame_data instead of pointers (they are all within the first bytes of a frame), so a frame
+ * is small and trivially copyable, eg. into queues and pools.
+ */
 template<int MAX_SIZE = 256>
 struct modbus_frame {
-	enum struct state {
+	enum struct state: uint8_t {
 		WRITE_ADDR_START_MBAP = 0,
 		WRITE_ADDR = 1,
 		WRITE_FC = 2,
@@ -169,45 +181,55 @@ struct modbus_frame {
 		uint16_t protocol_id{};    ///< Protocol identifier (always 0 for Modbus)
 		uint16_t length{};        ///< Number of following bytes (PDU length + 1)
 	};
+	using offset_t = uint8_t;
+	constexpr static offset_t NO_OFFSET{0xff};
 
 	state cur_state{state::WRITE_ADDR_START_MBAP};
 	transport_t transport{transport_t::NONE};
-	static_byte_vector<MAX_SIZE> frame_data{};
-	mbap_header *tcp_header{};
-	uint8_t *addr{};
-	uint8_t *fc{};
-	uint8_t *byte_count{};
-	uint8_t *ec{};
-	uint8_t *data{};
 	type t{.REQUEST = true};
-	constexpr bool empty() {return cur_state == state::WRITE_ADDR_START_MBAP || frame_data.empty() || !fc;}
+	offset_t _addr{NO_OFFSET};
+	offset_t _fc{NO_OFFSET};
+	offset_t _byte_count{NO_OFFSET};
+	offset_t _ec{NO_OFFSET};
+	offset_t _data{NO_OFFSET};
+	static_byte_vector<MAX_SIZE> frame_data{};
+
+	// fields of the frame, nullptr if they are not (yet) part of it. The mbap header is
+	// complete once the transport is tcp
+	constexpr mbap_header* tcp_header() { return transport == transport_t::TCP ? reinterpret_cast<mbap_header*>(frame_data.begin()): nullptr; }
+	constexpr const mbap_header* tcp_header() const { return transport == transport_t::TCP ? reinterpret_cast<const mbap_header*>(frame_data.begin()): nullptr; }
+	constexpr uint8_t* addr() { return _field(_addr); }
+	constexpr uint8_t* fc() { return _field(_fc); }
+	constexpr uint8_t* byte_count() { return _field(_byte_count); }
+	constexpr uint8_t* ec() { return _field(_ec); }
+	constexpr uint8_t* data() { return _field(_data); }
+	constexpr uint8_t* _field(offset_t o) { return o == NO_OFFSET ? nullptr: frame_data.begin() + o; }
+	constexpr int _end_offset() const { return frame_data.size(); }
+
+	constexpr bool empty() {return cur_state == state::WRITE_ADDR_START_MBAP || frame_data.empty() || !fc();}
 	constexpr void clear() {
 		cur_state = state::WRITE_ADDR_START_MBAP;
 		transport = transport_t::NONE;
 		frame_data.clear();
-		tcp_header = {};
-		addr = {};
-		fc = {};
-		byte_count = {};
-		data = {};
+		_addr = _fc = _byte_count = _ec = _data = NO_OFFSET;
 		t = {.REQUEST = true};
 	}
-	constexpr bool is_ascii() const { return frame_data[0] == ':'; }
-	constexpr bool is_tcp() const { return tcp_header; }
-	constexpr bool is_rtu() const { return addr && !is_ascii() && !is_tcp(); }
+	constexpr bool is_ascii() const { return transport == transport_t::ASCII; }
+	constexpr bool is_tcp() const { return transport == transport_t::TCP; }
+	constexpr bool is_rtu() const { return transport == transport_t::RTU; }
 	constexpr void set_type(type t) { this->t = t; }
 	// ---------------------------------------------------------------------------------------
 	// Write functions
 	// ---------------------------------------------------------------------------------------
 	constexpr int missing_data_bytes() {
-		if (!fc)
+		if (!fc())
 			return -1;
-		bool requires_length = fc_requires_length(function_code(*fc), t);
-		if (requires_length && !byte_count)
+		bool requires_length = fc_requires_length(function_code(*fc()), t);
+		if (requires_length && !byte_count())
 			return -1;
 		if (requires_length)
-			return (*byte_count - (frame_data.end() - byte_count) + 1);
-		return 5 - (frame_data.end() - fc);
+			return (*byte_count() - (_end_offset() - _byte_count) + 1);
+		return 5 - (_end_offset() - _fc);
 	}
 	constexpr result write_ascii_start() {
 		RESULT_ASSERT(cur_state == state::WRITE_ADDR_START_MBAP, "STATE_NOT_WRITE_START");
@@ -218,7 +240,7 @@ struct modbus_frame {
 	}
 	constexpr result write_mbap(const mbap_header &header) {
 		RESULT_ASSERT(cur_state == state::WRITE_ADDR_START_MBAP, "STATE_NOT_WRITE_MBAP");
-		this->tcp_header = reinterpret_cast<mbap_header*>(frame_data.end());
+		RESULT_ASSERT(frame_data.empty(), "MBAP_NOT_AT_FRAME_START");
 		RESULT_ASSERT(frame_data.push(h_byte(header.transaction_id)), "WRITE_TRANS_ID_FAILED");
 		RESULT_ASSERT(frame_data.push(l_byte(header.transaction_id)), "WRITE_TRANS_ID_FAILED");
 		RESULT_ASSERT(frame_data.push(h_byte(header.protocol_id)), "WRITE_PROTOCOL_ID_FAILED");
@@ -232,7 +254,7 @@ struct modbus_frame {
 	constexpr result write_addr(uint8_t addr) {
 		RESULT_ASSERT(cur_state == state::WRITE_ADDR_START_MBAP || cur_state == state::WRITE_ADDR, 
 				"STATE_NOT_WRITE_ADDR");
-		this->addr = frame_data.end();
+		_addr = offset_t(_end_offset());
 		RESULT_ASSERT(frame_data.push(addr), "WRITE_ADDR_FAILED");
 		if (transport == transport_t::NONE)
 			transport = transport_t::RTU;
@@ -241,11 +263,16 @@ struct modbus_frame {
 	}
 	constexpr result write_fc(function_code fc) {
 		RESULT_ASSERT(cur_state == state::WRITE_FC, "STATE_NOT_WRITE_FC");
+		// a received exception response carries the function code of the request with bit 7 set
+		if (t.RESPONSE && (uint8_t(fc) & 0x80)) {
+			t.EXCEPTION = true;
+			fc = function_code(uint8_t(fc) & 0x7f);
+		}
 		RESULT_ASSERT(fc >= function_code::NONE && fc <= function_code::WRITE_MULTIPLE_REGISTERS,
 				"INVALID_FUNCTION_CODE");
 		if (t.EXCEPTION)
 			reinterpret_cast<uint8_t&>(fc) |= 0x80;
-		this->fc = frame_data.end();
+		_fc = offset_t(_end_offset());
 		RESULT_ASSERT(frame_data.push(uint8_t(fc)), "WRITE_FC_FAILED");
 		if (fc_requires_length(fc, t) && fc >= function_code::READ_COILS && fc <= function_code::READ_INPUT_REGISTERS)
 			cur_state = state::WRITE_LENGTH;
@@ -255,7 +282,7 @@ struct modbus_frame {
 	}
 	constexpr result write_length(uint8_t l) {
 		RESULT_ASSERT(cur_state == state::WRITE_LENGTH, "STATE_NOT_WRITE_LENGTH");
-		byte_count = frame_data.end();
+		_byte_count = offset_t(_end_offset());
 		RESULT_ASSERT(frame_data.push(l), "WRITE_LENGTH_FAILED");
 		cur_state = state::WRITE_DATA;
 		return OK;
@@ -263,11 +290,14 @@ struct modbus_frame {
 	constexpr result write_data(uint8_t data) {
 		RESULT_ASSERT(cur_state == state::WRITE_DATA_EC || cur_state == state::WRITE_DATA, 
 				"STATE_NOT_WRITE_DATA");
-		if (!this->data)
-			this->data = frame_data.end();
+		if (_data == NO_OFFSET)
+			_data = offset_t(_end_offset());
 		RESULT_ASSERT(frame_data.push(data), "WRITE_DATA_FAILED");
+		// write multiple requests: start address, count, then the byte count of the values
+		if (fc_requires_length(function_code(*fc()), t) && _byte_count == NO_OFFSET && _end_offset() - _data == 5)
+			_byte_count = offset_t(_end_offset() - 1);
 		int missing_bytes = missing_data_bytes();
-		if (missing_bytes == 0 && tcp_header)
+		if (missing_bytes == 0 && is_tcp())
 			cur_state = state::FINAL;
 		else if (missing_bytes == 0)
 			cur_state = state::WRITE_CRC_0;
@@ -288,9 +318,9 @@ struct modbus_frame {
 	}
 	constexpr result write_ec(exception_code ec) {
 		RESULT_ASSERT(cur_state == state::WRITE_DATA_EC, "STATE_NOT_WRITE_EC");
-		this->ec = frame_data.end();
+		_ec = offset_t(_end_offset());
 		RESULT_ASSERT(frame_data.push(uint8_t(ec)), "WRITE_EC_FAILED");
-		if (tcp_header)
+		if (is_tcp())
 			cur_state = state::FINAL;
 		else
 		cur_state = state::WRITE_CRC_0;
@@ -329,8 +359,9 @@ struct modbus_frame {
 		case modbus_frame<MAX_SIZE>::state::WRITE_LENGTH:
 			return write_length(b);
 		case modbus_frame<MAX_SIZE>::state::WRITE_DATA:
-		case modbus_frame<MAX_SIZE>::state::WRITE_DATA_EC:
 			return write_data(b);
+		case modbus_frame<MAX_SIZE>::state::WRITE_DATA_EC:
+			return t.EXCEPTION ? write_ec(exception_code(b)): write_data(b);
 		case modbus_frame<MAX_SIZE>::state::WRITE_CRC_0:
 		case modbus_frame<MAX_SIZE>::state::WRITE_CRC_1:
 			return write_checksum(b);
@@ -341,6 +372,59 @@ struct modbus_frame {
 	}
 };
 
+/**
+ * Frame storage policies of modbus_register. owned_frame keeps the frame in the register,
+ * shared_frame points to a frame which is shared by registers that never parse at the same
+ * time (eg. the units of a modbus_multi_server), so each of them only adds its layout.
+ */
+template<typename S, int MAX_SIZE>
+concept IsFrameStorage = requires(S s, const S cs) {
+	{ s.get() } -> std::same_as<modbus_frame<MAX_SIZE>&>;
+	{ cs.get() } -> std::convertible_to<const modbus_frame<MAX_SIZE>&>;
+};
+
+template<int MAX_SIZE = 256>
+struct owned_frame {
+	modbus_frame<MAX_SIZE> frame{};
+	constexpr modbus_frame<MAX_SIZE>& get() { return frame; }
+	constexpr const modbus_frame<MAX_SIZE>& get() const { return frame; }
+};
+
+template<int MAX_SIZE = 256>
+struct shared_frame {
+	modbus_frame<MAX_SIZE> *frame{};
+	constexpr modbus_frame<MAX_SIZE>& get() const { return *frame; }
+};
+
+/**
+ * @brief Collects the bytes of a modbus tcp stream until one full adu is available
+ *
+ * The mbap length field tells where a frame ends, so stream transports can split the
+ * byte stream into complete adus before handing them to a modbus_register. A partially
+ * received frame then never occupies the frame buffer of the register.
+ */
+template<int MAX_SIZE = TCP_ADU_SIZE>
+struct tcp_adu_collector {
+	constexpr static int MBAP_SIZE{6};
+
+	static_byte_vector<MAX_SIZE> adu{};
+	constexpr int expected_size() const {
+		if (adu.size() < MBAP_SIZE)
+			return -1;
+		return MBAP_SIZE + ((adu[4] << 8) | adu[5]);
+	}
+	constexpr bool complete() const { return adu.size() == expected_size(); }
+	constexpr uint16_t transaction_id() const { return (adu[0] << 8) | adu[1]; }
+	constexpr result push(uint8_t b) {
+		RESULT_ASSERT(!complete(), "ADU_ALREADY_COMPLETE");
+		RESULT_ASSERT(adu.push(b), "ADU_TOO_LARGE");
+		RESULT_ASSERT(expected_size() <= MAX_SIZE, "ADU_TOO_LARGE");
+		RESULT_ASSERT(expected_size() != MBAP_SIZE, "ADU_EMPTY");
+		return OK;
+	}
+	constexpr void clear() { adu.clear(); }
+};
+
 }
 
 #undef RESULT_ASSERT
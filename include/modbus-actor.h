@@ -1,7 +1,15 @@
 #pragma once
 
 #include "modbus-register.h"
+#include "modbus-poll-plan.h"
+#include "modbus-latency.h"
+#include "modbus-frame-pool.h"
+#include "modbus-recorder.h"
+#include "modbus-history.h"
 #include <chrono>
+#include <utility>
+#include <thread>
+#include <variant>
 
 namespace libmodbus_static {
 
@@ -10,6 +18,138 @@ using ms = std::chrono::milliseconds;
 constexpr std::string_view TIMEOUT = "TIMEOUT";
 constexpr std::string_view CLIENT_CANT_QUERY = "CLIENT_CANT_QUERY";
 constexpr std::string_view SERVER_CANT_RESPOND = "SERVER_CANT_RESPOND";
+constexpr std::string_view IN_FLIGHT_FULL = "IN_FLIGHT_FULL";
+constexpr std::string_view UNKNOWN_REQUEST = "UNKNOWN_REQUEST";
+constexpr std::string_view CIRCUIT_OPEN = "CIRCUIT_OPEN";
+constexpr std::string_view TRANSPORT_FAILED = "TRANSPORT_FAILED";
+// timeout derived from the round trip times of the unit, see unit_health
+constexpr ms ADAPTIVE_TIMEOUT{-1};
+
+/**
+ * Handle of a submitted request, returned by submit_read/submit_write.
+ * If the submission failed slot is negative and err holds the reason.
+ */
+struct request_handle {
+	int slot{-1};
+	uint16_t tid{};
+	result err{OK};
+	constexpr bool valid() const { return slot >= 0; }
+};
+
+/**
+ * Transport which can tell if read_bytes would return data without waiting.
+ * poll(ms(0)) then only reads if there is something to read, which allows to drive
+ * many actors from a single thread (see modbus-coroutine.h). With a wait time read_bytes
+ * is always called, so it has to block until data arrives or the time is over
+ */
+template<typename IO>
+concept IsNonBlockingIO = requires(IO io) {
+	{ io.readable() } -> std::convertible_to<bool>;
+};
+
+/**
+ * Non blocking transport with a file descriptor which polls readable (POLLIN) once
+ * readable() is true, eg. a serial port or a socket. An executor then blocks in poll(2) on
+ * the transports of all its actors until a response arrives or a request times out.
+ */
+template<typename IO>
+concept IsPollableIO = IsNonBlockingIO<IO> && requires(IO io) {
+	{ io.poll_fd() } -> std::convertible_to<int>;
+};
+
+/**
+ * Rtu transport which knows if at least 3.5 characters of silence were before the bytes
+ * returned by the last read_bytes (see rtu_linux_io). The actor then drops a partially
+ * received frame before parsing the new bytes, so it recovers from lost bytes and noise.
+ */
+template<typename IO>
+concept IsRtuGapIO = requires(IO io) {
+	{ io.frame_gap() } -> std::convertible_to<bool>;
+};
+
+/**
+ * Timeout and circuit breaker settings of an actor. Adaptive timeouts are
+ * srtt + 4 * rttvar (RFC 6298) clamped to [min, max], doubled after every timeout.
+ * After breaker_threshold consecutive timeouts a unit is not queried for breaker_cooldown,
+ * afterwards a single probe request decides if it is queried again.
+ */
+struct timeout_config {
+	ms initial{1000};
+	ms min{50};
+	ms max{20000};
+	int breaker_threshold{3};
+	ms breaker_cooldown{5000};
+};
+
+/** Round trip time estimation and circuit breaker state of a single unit */
+struct unit_health {
+	// 32 bit microseconds hold round trip times of more than half an hour
+	using us = std::chrono::duration<int32_t, std::micro>;
+	enum struct state: uint8_t { CLOSED, OPEN, HALF_OPEN };
+	us srtt{};
+	us rttvar{};
+	bool has_rtt{};
+	uint8_t backoff{};
+	uint16_t failures{};	// consecutive timeouts
+	state breaker{state::CLOSED};
+	std::chrono::steady_clock::time_point open_until{};
+
+	constexpr ms timeout(const timeout_config &c) const {
+		ms t = has_rtt ? std::chrono::ceil<ms>(srtt + std::max(us(1000), 4 * rttvar)): c.initial;
+		return std::clamp(t * (1 << backoff), c.min, c.max);
+	}
+	constexpr void sample(us rtt) {
+		if (!has_rtt) {
+			srtt = rtt;
+			rttvar = rtt / 2;
+			has_rtt = true;
+			return;
+		}
+		rttvar = (3 * rttvar + (srtt > rtt ? srtt - rtt: rtt - srtt)) / 4;
+		srtt = (7 * srtt + rtt) / 8;
+	}
+};
+
+/**
+ * Health of all unit ids, for actors which talk to more units than they keep inline (eg. a
+ * client of a whole rtu bus or a gateway), see modbus_actor::health_table
+ */
+struct unit_health_table {
+	std::array<unit_health, 256> units{};
+};
+// number of units whose health an actor keeps without health_table
+constexpr int INLINE_UNIT_HEALTH{4};
+constexpr unit_health NO_UNIT_HEALTH{};
+
+/**
+ * Position of a tcp client in the response stream. Only the mbap header is kept, the rest of
+ * a response is parsed directly in the frame of the actor
+ */
+struct tcp_stream_position {
+	constexpr static int MBAP_SIZE{6};
+	std::array<uint8_t, MBAP_SIZE> mbap{};
+	uint16_t received{};	// bytes of the current adu
+	int16_t slot{-1};	// in flight request answered by the current adu, -1 if it is dropped
+	constexpr int size() const { return received < MBAP_SIZE ? -1: MBAP_SIZE + ((mbap[4] << 8) | mbap[5]); }
+	constexpr uint16_t transaction_id() const { return (mbap[0] << 8) | mbap[1]; }
+	// true while a response is parsed in the frame
+	constexpr bool parsing() const { return slot >= 0; }
+	constexpr void clear() { received = 0; slot = -1; }
+};
+
+/**
+ * Awaitable of a submitted request, returned by read_remote_async/write_remote_async.
+ * The coroutine handle is only stored type erased, so this header does not depend on <coroutine>
+ */
+template<typename Actor>
+struct request_awaitable {
+	Actor &actor;
+	request_handle h{};
+	constexpr bool await_ready() const { return actor.done(h); }
+	template<typename Handle>
+	constexpr void await_suspend(Handle waiter) { actor._in_flight[h.slot].waiter = waiter.address(); }
+	constexpr result await_resume() { return actor.take(h); }
+};
 
 /**
 * Modbus actor to be used as a simple full modbus actor based on the modbus-register
@@ -21,23 +161,106 @@ constexpr std::string_view SERVER_CANT_RESPOND = "SERVER_CANT_RESPOND";
 *	std::span<uint8_t> read_bytes(std::chrono::milliseconds max_timeout);
 *	void write_bytes(std::span<uint8_t> data);
 * };
+* A serial rtu transport for linux is rtu_linux_io (modbus-rtu-linux.h).
+*
+* As client the actor can either be used blocking via read_remote/write_remote, or non blocking
+* via submit_read/submit_write + poll + take. For tcp up to MAX_IN_FLIGHT requests can be
+* outstanding at once, responses are matched by their mbap transaction id in any order.
+* Rtu has no transaction id, so there only a single request can be in flight.
+*
+* Requests without explicit timeout (ADAPTIVE_TIMEOUT) use a timeout derived from the measured
+* round trip times of the unit. Units which keep timing out are skipped (CIRCUIT_OPEN) and
+* probed again after a cool down, so a dead device does not stall the requests to the others.
+* The health of INLINE_UNIT_HEALTH units is kept in the actor, set health_table for more.
+*
+* Trace is the trace policy (see modbus-trace.h), the default no_trace costs nothing.
+*
+* FrameStorage is the frame storage policy of the register. With pooled_frame the frame is
+* borrowed from a modbus_frame_pool only for the time of a transaction: for tcp while a
+* request is written and from the end of the mbap header of a response until it is parsed,
+* for rtu from sending a request until its response (a server from the first byte of a
+* request until its response is sent). If the pool is empty submissions fail with
+* FRAME_POOL_EMPTY. While a tcp response is parsed in the frame submissions fail with
+* IN_FLIGHT_FULL.
+*
+* StorageSync is the storage sync policy of the register, eg. shm_seqlock to share the
+* register image with other processes (see modbus-shm-linux.h).
 */
-template<typename Layout, typename DATA_IO>
-struct modbus_actor: public modbus_register<Layout> {
-	modbus_actor(uint8_t address, const Layout &storage_init, const DATA_IO &io = {}): modbus_register<Layout>(address, storage_init), io{io} { this->io.init(); }
+template<typename Layout, typename DATA_IO, int MAX_IN_FLIGHT = 16, typename Trace = no_trace,
+	typename FrameStorage = owned_frame<max_frame_size(DATA_IO::TRANSPORT_TYPE)>, typename StorageSync = no_storage_sync>
+struct modbus_actor: public modbus_register<Layout, max_frame_size(DATA_IO::TRANSPORT_TYPE), Trace, FrameStorage, StorageSync> {
+	// the frame is sized for the transport (260 byte tcp adus, 256 byte rtu frames)
+	using base = modbus_register<Layout, max_frame_size(DATA_IO::TRANSPORT_TYPE), Trace, FrameStorage, StorageSync>;
+	using last_completed = typename base::last_completed;
+	struct in_flight {
+		last_completed request{};
+		std::chrono::steady_clock::time_point deadline{};
+		std::chrono::steady_clock::time_point sent{};
+		result state{};
+		uint16_t tid{};
+		bool used{};
+		void *waiter{};
+	};
+
+	// server with the given unit address, the broadcast address is no server address and gives a client
+	modbus_actor(uint8_t address, const Layout &storage_init, const DATA_IO &io = {}):
+		base(address, address == BROADCAST_ADDR ? role_t::CLIENT: role_t::SERVER, storage_init), io{io} { this->io.init(); }
+	modbus_actor(role_t role, const Layout &storage_init, const DATA_IO &io = {}): base(0, role, storage_init), io{io} { this->io.init(); }
 	~modbus_actor() { io.deinit(); }
 
 	DATA_IO io{};
 	uint16_t _tcp_trans{1};
+	std::array<in_flight, MAX_IN_FLIGHT> _in_flight{};
+	// only tcp streams are split into adus, rtu actors need no stream position
+	[[no_unique_address]] std::conditional_t<DATA_IO::TRANSPORT_TYPE == transport_t::TCP, tcp_stream_position, std::monostate> _rx{};
+	// TRANSPORT_FAILED once a tcp stream lost the adu boundaries (invalid mbap length), the
+	// caller reconnects the transport and calls reset_transport()
+	result transport_state{OK};
+	// called when a request with a registered waiter is done (see request_awaitable)
+	void (*on_complete)(void *ctx, void *waiter){};
+	void *on_complete_ctx{};
+	timeout_config timeouts{};
+	// health of the last units, an actor which talks to more units points this to a table of all
+	unit_health_table *health_table{};
+	std::array<unit_health, INLINE_UNIT_HEALTH> _health{};
+	std::array<uint8_t, INLINE_UNIT_HEALTH> _health_units{};
+	uint8_t _health_count{};
+	uint8_t _health_next{};
+	// time the servers on an rtu bus get to process a broadcast before the next request is sent
+	ms turnaround_delay{100};
+	// end of the turnaround after the last rtu broadcast, requests fail with IN_FLIGHT_FULL until then
+	std::chrono::steady_clock::time_point _turnaround_until{};
+	// optional request -> response times per unit and function code, timeouts are not recorded
+	latency_stats *latency{};
+	// optional binary recording of the register data of every read response
+	poll_recorder *recorder{};
+	// called after the storage was updated by a read response (see field_history)
+	void (*on_read)(void *ctx, const last_completed &request){};
+	void *on_read_ctx{};
 
 	result poll_update_state(ms max_timeout) {
-		if (this->addr == 0)
+		if (this->role == role_t::CLIENT)
 			return SERVER_CANT_RESPOND;
-		std::string_view state{IN_PROGRESS};
 		std::span<uint8_t> data = io.read_bytes(max_timeout);
+		if (data.empty())
+			return IN_PROGRESS;
+		if (result r = _acquire_frame(); r != OK)
+			return r;
+		result state = _serve(data);
+		// a partially received request keeps its frame until the rest arrives
+		if (this->buffer().frame_data.empty())
+			_release_frame();
+		return state;
+	};
+	result _serve(std::span<uint8_t> data) {
+		std::string_view state{IN_PROGRESS};
+		if constexpr (IsRtuGapIO<DATA_IO>) {
+			if (data.size() && io.frame_gap())
+				this->switch_to_request();
+		}
 		for (uint8_t b: data) {
 			if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU) {
-				state  = this->process_tcp(b).err;
+				state  = this->process_rtu(b).err;
 			} else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP) {
 				state  = this->process_tcp(b).err;
 			}
@@ -59,137 +282,542 @@ struct modbus_actor: public modbus_register<Layout> {
 					return state;
 				}
 			}
-			this->write_bytes(frame);
+			if (frame.size())
+				io.write_bytes(frame);
 			this->switch_to_request();
 		}
 		return state;
-	};
-	
+	}
+
+	// ---------------------------------------------------------------------------------------
+	// Blocking client functions
+	// ---------------------------------------------------------------------------------------
+	// ranges larger than a single request are split into the minimal number of maximum size
+	// requests, which are pipelined for tcp. All requests are done on return, the first error
+	// is returned
 	template<typename MemA, typename MemB>
 	requires IsValidRegister<Layout, MemA> && IsValidRegister<Layout, MemB>
-	constexpr result read_remote(uint8_t addr, MemA member_a, MemB member_b, ms timeout = ms(20000)) {
-		if (this->addr != 0)
-			return CLIENT_CANT_QUERY;
-		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU) {
-			if (result r = start_modbus_frame(this->addr); r != OK) return r;
-		} else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP) {
-			if (result r = this->start_tcp_frame(_tcp_trans++, addr); r != OK) return r;
-		}
-		auto [res, err] = this->get_frame_read(member_a, member_b);
-		if (err != OK)
-			return err;
-		io.write_bytes(res);
-		auto start = std::chrono::steady_clock::now();
-		result state = IN_PROGRESS;
-		std::span<uint8_t> data{};
-		while (state == IN_PROGRESS && (std::chrono::steady_clock::now() - start) < timeout) {
-			if (data.empty())
-				data = io.read_bytes(timeout - std::chrono::duration_cast<ms>(std::chrono::steady_clock::now() - start));
-			if (data.empty()) {
-				state = TIMEOUT;
-				continue;
-			}
-			if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU)
-				state = this->process_rtu(data[0]).err;
-			else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP)
-				state = this->process_tcp(data[0]).err;
-		}
-		return state;
+	result read_remote(uint8_t addr, MemA member_a, MemB member_b, ms timeout = ADAPTIVE_TIMEOUT) {
+		return _transfer(addr, this->member_range(member_a, member_b), false, timeout);
 	}
 	template<typename Mem>
 	requires IsValidRegister<Layout, Mem>
-	constexpr result read_remote(uint8_t addr, Mem mem, ms timeout = ms(20e3)) { return read_remote<Mem, Mem>(addr, mem, mem, timeout); }
+	result read_remote(uint8_t addr, Mem mem, ms timeout = ADAPTIVE_TIMEOUT) { return read_remote<Mem, Mem>(addr, mem, mem, timeout); }
 	template<typename Reg>
 	requires IsBitsRegisters<Layout, Reg>
-	constexpr result read_remote(uint8_t addr, const Reg &mask, ms timeout = ms(20e3)) {
-		if (this->addr != 0)
-			return CLIENT_CANT_QUERY;
-		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU) {
-			if (result r = this->start_modbus_frame(addr); r != OK) return r;
-		} else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP) {
-			if (result r = this->start_tcp_frame(_tcp_trans++, addr); r != OK) return r;
-		}
-		auto [res, err] = this->get_frame_read(mask);
-		if (err != OK)
-			return err;
-		io.write_bytes(res);
-		auto start = std::chrono::steady_clock::now();
-		result state = IN_PROGRESS;
-		std::span<uint8_t> data{};
-		while (state == IN_PROGRESS && std::chrono::steady_clock::now() - start < timeout) {
-			if (data.empty())
-				data = io.read_bytes(timeout - (std::chrono::steady_clock::now() - start));
-			if (data.empty())
-				state = TIMEOUT;
-			if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU)
-				state = this->process_rtu(data[0]).err;
-			else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP)
-				state = this->process_tcp(data[0]).err;
-		}
-		return state;
+	result read_remote(uint8_t addr, const Reg &mask, ms timeout = ADAPTIVE_TIMEOUT) {
+		register_range r{};
+		if (result e = this->mask_range(mask, r); e != OK)
+			return e;
+		return _transfer(addr, r, false, timeout);
+	}
+	// reads all requests of the plan (see make_poll_plan), for tcp they are pipelined up to
+	// MAX_IN_FLIGHT at once. All requests are done on return, the first error is returned
+	template<int N>
+	result read_remote(uint8_t addr, const poll_plan<N> &plan, ms timeout = ADAPTIVE_TIMEOUT) {
+		return _pipelined(plan.size(), [&](int i) {
+			return submit_read(addr, plan[i].type, plan[i].offset, plan[i].count, timeout);
+		});
+	}
+	template<typename MemA, typename MemB>
+	requires IsValidRegister<Layout, MemA> && IsValidRegister<Layout, MemB>
+	result write_remote(uint8_t addr, MemA member_a, MemB member_b, ms timeout = ADAPTIVE_TIMEOUT) {
+		return _transfer(addr, this->member_range(member_a, member_b), true, timeout);
+	}
+	template<typename Mem>
+	requires IsValidRegister<Layout, Mem>
+	result write_remote(uint8_t addr, Mem mem, ms timeout = ADAPTIVE_TIMEOUT) { return write_remote<Mem, Mem>(addr, mem, mem, timeout); }
+	template<typename Reg>
+	requires IsBitsRegisters<Layout, Reg>
+	result write_remote(uint8_t addr, const Reg &mask, ms timeout = ADAPTIVE_TIMEOUT) {
+		register_range r{};
+		if (result e = this->mask_range(mask, r); e != OK)
+			return e;
+		return _transfer(addr, r, true, timeout);
 	}
 
+	// writes to all units at once (unit address 0) with FC05/06/15/16. Broadcasts are not
+	// answered, on rtu the call returns after turnaround_delay so the servers are ready again
 	template<typename MemA, typename MemB>
 	requires IsValidRegister<Layout, MemA> && IsValidRegister<Layout, MemB>
-	constexpr result write_remote(uint8_t addr, MemA member_a, MemB member_b, ms timeout = ms(20e3)) {
-		if (this->addr != 0)
-			return CLIENT_CANT_QUERY;
-		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU) {
-			if (result r = this->start_modbus_frame(addr); r != OK) return r;
-		} else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP) {
-			if (result r = this->start_tcp_frame(_tcp_trans++, addr); r != OK) return r;
-		}
-		auto [res, err] = this->get_frame_write(member_a, member_b);
-		if (err != OK)
-			return err;
-		io.write_bytes(res);
-		auto start = std::chrono::steady_clock::now();
-		result state = IN_PROGRESS;
-		std::span<uint8_t> data{};
-		while (state == IN_PROGRESS && std::chrono::steady_clock::now() - start < timeout) {
-			if (data.empty())
-				data = io.read_bytes(timeout - (std::chrono::steady_clock::now() - start));
-			if (data.empty())
-				state = TIMEOUT;
-			if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU)
-				state = this->process_rtu(data[0]).err;
-			else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP)
-				state = this->process_tcp(data[0]).err;
-		}
-		return state;
+	result broadcast_write(MemA member_a, MemB member_b) {
+		request_handle h = _start_request(BROADCAST_ADDR);
+		if (!h.valid())
+			return h.err;
+		return _await_turnaround(_send_broadcast(this->get_frame_write(member_a, member_b)));
 	}
 	template<typename Mem>
 	requires IsValidRegister<Layout, Mem>
-	constexpr result write_remote(uint8_t addr, Mem mem, ms timeout = ms(20e3)) { return write_remote<Mem, Mem>(addr, mem, mem, timeout); }
+	result broadcast_write(Mem mem) { return broadcast_write<Mem, Mem>(mem, mem); }
 	template<typename Reg>
 	requires IsBitsRegisters<Layout, Reg>
-	constexpr result write_remote(uint8_t addr, const Reg &mask, ms timeout = ms(20e3)) {
-		if (this->addr != 0)
-			return CLIENT_CANT_QUERY;
-		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU) {
-			if (result r = this->start_modbus_frame(addr); r != OK) return r;
-		} else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP) {
-			if (result r = this->start_tcp_frame(_tcp_trans++, addr); r != OK) return r;
-		}
-		auto [res, err] = this->get_frame_write(mask);
-		if (err != OK)
-			return err;
-		io.write_bytes(res);
-		auto start = std::chrono::steady_clock::now();
-		result state = IN_PROGRESS;
+	result broadcast_write(const Reg &mask) {
+		request_handle h = _start_request(BROADCAST_ADDR);
+		if (!h.valid())
+			return h.err;
+		return _await_turnaround(_send_broadcast(this->get_frame_write(mask)));
+	}
+	// raw variant, writes the current storage content of the given register/bit range
+	result broadcast_write(register_t reg_type, uint16_t reg_offset, uint16_t reg_count) {
+		return _await_turnaround(submit_broadcast(reg_type, reg_offset, reg_count));
+	}
+
+	// ---------------------------------------------------------------------------------------
+	// Non blocking client functions
+	// ---------------------------------------------------------------------------------------
+	template<typename MemA, typename MemB>
+	requires IsValidRegister<Layout, MemA> && IsValidRegister<Layout, MemB>
+	constexpr request_handle submit_read(uint8_t addr, MemA member_a, MemB member_b, ms timeout = ADAPTIVE_TIMEOUT) {
+		request_handle h = _start_request(addr);
+		if (!h.valid())
+			return h;
+		return _send_request(h, this->get_frame_read(member_a, member_b), timeout);
+	}
+	template<typename Mem>
+	requires IsValidRegister<Layout, Mem>
+	constexpr request_handle submit_read(uint8_t addr, Mem mem, ms timeout = ADAPTIVE_TIMEOUT) { return submit_read<Mem, Mem>(addr, mem, mem, timeout); }
+	template<typename Reg>
+	requires IsBitsRegisters<Layout, Reg>
+	constexpr request_handle submit_read(uint8_t addr, const Reg &mask, ms timeout = ADAPTIVE_TIMEOUT) {
+		request_handle h = _start_request(addr);
+		if (!h.valid())
+			return h;
+		return _send_request(h, this->get_frame_read(mask), timeout);
+	}
+	// raw variant, reg_offset and reg_count are the modbus register/bit addresses
+	constexpr request_handle submit_read(uint8_t addr, register_t reg_type, uint16_t reg_offset, uint16_t reg_count, ms timeout = ADAPTIVE_TIMEOUT) {
+		request_handle h = _start_request(addr);
+		if (!h.valid())
+			return h;
+		return _send_request(h, this->get_frame_read(reg_type, reg_offset, reg_count), timeout);
+	}
+
+	template<typename MemA, typename MemB>
+	requires IsValidRegister<Layout, MemA> && IsValidRegister<Layout, MemB>
+	constexpr request_handle submit_write(uint8_t addr, MemA member_a, MemB member_b, ms timeout = ADAPTIVE_TIMEOUT) {
+		request_handle h = _start_request(addr);
+		if (!h.valid())
+			return h;
+		return _send_request(h, this->get_frame_write(member_a, member_b), timeout);
+	}
+	template<typename Mem>
+	requires IsValidRegister<Layout, Mem>
+	constexpr request_handle submit_write(uint8_t addr, Mem mem, ms timeout = ADAPTIVE_TIMEOUT) { return submit_write<Mem, Mem>(addr, mem, mem, timeout); }
+	template<typename Reg>
+	requires IsBitsRegisters<Layout, Reg>
+	constexpr request_handle submit_write(uint8_t addr, const Reg &mask, ms timeout = ADAPTIVE_TIMEOUT) {
+		request_handle h = _start_request(addr);
+		if (!h.valid())
+			return h;
+		return _send_request(h, this->get_frame_write(mask), timeout);
+	}
+	// raw variant, writes the current storage content of the given register/bit range
+	constexpr request_handle submit_write(uint8_t addr, register_t reg_type, uint16_t reg_offset, uint16_t reg_count, ms timeout = ADAPTIVE_TIMEOUT) {
+		request_handle h = _start_request(addr);
+		if (!h.valid())
+			return h;
+		return _send_request(h, this->get_frame_write(reg_type, reg_offset, reg_count), timeout);
+	}
+
+	// sends a broadcast without waiting for the turnaround, until it is over all submissions
+	// fail with IN_FLIGHT_FULL (only on rtu, see _turnaround_until)
+	result submit_broadcast(register_t reg_type, uint16_t reg_offset, uint16_t reg_count) {
+		request_handle h = _start_request(BROADCAST_ADDR);
+		if (!h.valid())
+			return h.err;
+		return _send_broadcast(this->get_frame_write(reg_type, reg_offset, reg_count));
+	}
+
+	// awaitable variants of read_remote/write_remote, the request is submitted on the call,
+	// the awaiting coroutine is resumed via on_complete once the response is there
+	template<typename... Args>
+	constexpr request_awaitable<modbus_actor> read_remote_async(uint8_t addr, Args&&... args) {
+		return {*this, submit_read(addr, std::forward<Args>(args)...)};
+	}
+	template<typename... Args>
+	constexpr request_awaitable<modbus_actor> write_remote_async(uint8_t addr, Args&&... args) {
+		return {*this, submit_write(addr, std::forward<Args>(args)...)};
+	}
+
+	// reads all available bytes (waits at most max_wait for them), matches complete
+	// responses to the in flight requests and times out expired requests
+	result poll(ms max_wait = ms(0)) {
+		if (transport_state != OK)
+			return transport_state;
 		std::span<uint8_t> data{};
-		while (state == IN_PROGRESS && std::chrono::steady_clock::now() - start < timeout) {
-			if (data.empty())
-				data = io.read_bytes(timeout - (std::chrono::steady_clock::now() - start));
-			if (data.empty())
-				state = TIMEOUT;
+		if constexpr (IsNonBlockingIO<DATA_IO>) {
+			// a caller which wants to wait (eg. wait()) lets the transport block
+			if (max_wait > ms(0) || io.readable())
+				data = io.read_bytes(max_wait);
+		} else {
+			data = io.read_bytes(max_wait);
+		}
+		if constexpr (IsRtuGapIO<DATA_IO>) {
+			if (data.size() && io.frame_gap() && _awaiting_response())
+				this->switch_to_response();
+		}
+		for (uint8_t b: data) {
 			if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU)
-				state = this->process_rtu(data[0]).err;
+				_receive_rtu(b);
 			else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP)
-				state = this->process_tcp(data[0]).err;
+				_receive_tcp(b);
+			// the rest of the stream can not be split into adus anymore
+			if (transport_state != OK)
+				return transport_state;
+		}
+		auto now = std::chrono::steady_clock::now();
+		for (in_flight &e: _in_flight) {
+			if (e.used && e.state == IN_PROGRESS && now >= e.deadline) {
+				this->trace.timeout(e.request.addr, e.request.fc);
+				_complete(e, TIMEOUT);
+			}
+		}
+		return OK;
+	}
+	// clears a failed transport after the caller reconnected it
+	constexpr void reset_transport() {
+		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP) {
+			if (_rx.parsing())
+				_release_frame();
+			_rx.clear();
+		}
+		transport_state = OK;
+	}
+	// true if take() would return a final result
+	constexpr bool done(request_handle h) const {
+		return !h.valid() || !_in_flight[h.slot].used || _in_flight[h.slot].tid != h.tid ||
+			_in_flight[h.slot].state != IN_PROGRESS;
+	}
+	// returns IN_PROGRESS while the request is outstanding, else its final result.
+	// A final result is returned only once, afterwards the slot is reused
+	constexpr result take(request_handle h) {
+		if (!h.valid())
+			return h.err;
+		in_flight &e = _in_flight[h.slot];
+		if (!e.used || e.tid != h.tid)
+			return UNKNOWN_REQUEST;
+		if (e.state == IN_PROGRESS)
+			return IN_PROGRESS;
+		e.used = false;
+		return e.state;
+	}
+	// polls until the request is done
+	result wait(request_handle h) {
+		result state = take(h);
+		while (state == IN_PROGRESS) {
+			auto now = std::chrono::steady_clock::now();
+			auto remaining = std::chrono::duration_cast<ms>(_in_flight[h.slot].deadline - now);
+			poll(std::max(remaining, ms(0)));
+			state = take(h);
 		}
 		return state;
 	}
+	// earliest deadline of the requests in flight, time_point::max() if there is none
+	constexpr std::chrono::steady_clock::time_point next_deadline() const {
+		auto deadline = std::chrono::steady_clock::time_point::max();
+		for (const in_flight &e: _in_flight)
+			if (e.used && e.state == IN_PROGRESS)
+				deadline = std::min(deadline, e.deadline);
+		return deadline;
+	}
+	constexpr int in_flight_count() const {
+		return std::ranges::count_if(_in_flight, [](const in_flight &e){ return e.used; });
+	}
+	constexpr const unit_health& health(uint8_t unit) const {
+		const unit_health *u = _find_health(unit);
+		return u ? *u: NO_UNIT_HEALTH;
+	}
+	constexpr ms timeout_for(uint8_t unit) const { return health(unit).timeout(timeouts); }
+
+	// ---------------------------------------------------------------------------------------
+	// Internal request functions
+	// ---------------------------------------------------------------------------------------
+	constexpr request_handle _start_request(uint8_t addr) {
+		if (this->role != role_t::CLIENT)
+			return {.err = CLIENT_CANT_QUERY};
+		if (transport_state != OK)
+			return {.err = transport_state};
+		if (result r = _admit(addr); r != OK)
+			return {.err = r};
+		// rtu responses carry no transaction id, only one request can be matched, and the bus
+		// stays quiet while the servers process a broadcast
+		if (DATA_IO::TRANSPORT_TYPE == transport_t::RTU &&
+			(in_flight_count() || std::chrono::steady_clock::now() < _turnaround_until))
+			return {.err = IN_FLIGHT_FULL};
+		// the frame holds a partially received tcp response
+		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP) {
+			if (_rx.parsing())
+				return {.err = IN_FLIGHT_FULL};
+		}
+		auto free = std::ranges::find_if(_in_flight, [](const in_flight &e){ return !e.used; });
+		if (free == _in_flight.end())
+			return {.err = IN_FLIGHT_FULL};
+		// skip transaction ids which are still in use after a wrap around
+		while (std::ranges::any_of(_in_flight, [this](const in_flight &e){ return e.used && e.tid == _tcp_trans; }))
+			++_tcp_trans;
+		if (result r = _acquire_frame(); r != OK)
+			return {.err = r};
+		request_handle h{.slot = int(free - _in_flight.begin()), .tid = _tcp_trans++};
+		result r{OK};
+		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU)
+			r = this->start_rtu_frame(addr);
+		else if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::TCP)
+			r = this->start_tcp_frame(h.tid, addr);
+		if (r != OK) {
+			_release_frame();
+			return {.err = r};
+		}
+		return h;
+	}
+	constexpr request_handle _send_request(request_handle h, const result_err &frame, ms timeout) {
+		if (frame.err != OK) {
+			_release_frame();
+			return {.err = frame.err};
+		}
+		if (timeout == ADAPTIVE_TIMEOUT)
+			timeout = timeout_for(this->lc.addr);
+		auto now = std::chrono::steady_clock::now();
+		_in_flight[h.slot] = in_flight{
+			.request = this->lc,
+			.deadline = now + timeout,
+			.sent = now,
+			.state = IN_PROGRESS,
+			.tid = h.tid,
+			.used = true,
+		};
+		io.write_bytes(frame.res);
+		// the rtu response is parsed directly in the frame buffer, tcp responses only need a
+		// frame once their mbap header was received
+		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU)
+			this->switch_to_response();
+		else
+			_release_frame();
+		return h;
+	}
+	result _send_broadcast(const result_err &frame) {
+		if (frame.err != OK) {
+			_release_frame();
+			return frame.err;
+		}
+		io.write_bytes(frame.res);
+		this->switch_to_request();
+		_release_frame();
+		// only the servers on a shared serial bus need time to process the broadcast
+		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU)
+			_turnaround_until = std::chrono::steady_clock::now() + turnaround_delay;
+		return OK;
+	}
+	result _await_turnaround(result r) {
+		if (r == OK)
+			std::this_thread::sleep_until(_turnaround_until);
+		return r;
+	}
+	// circuit breaker, open units are rejected, half open units get a single probe request
+	constexpr result _admit(uint8_t addr) {
+		const unit_health *h = _find_health(addr);
+		if (addr == BROADCAST_ADDR || !h || h->breaker == unit_health::state::CLOSED)
+			return OK;
+		unit_health &u = _unit_health(addr);
+		if (u.breaker == unit_health::state::OPEN) {
+			if (std::chrono::steady_clock::now() < u.open_until)
+				return CIRCUIT_OPEN;
+			u.breaker = unit_health::state::HALF_OPEN;
+		}
+		bool probing = std::ranges::any_of(_in_flight, [addr](const in_flight &e){
+			return e.used && e.state == IN_PROGRESS && e.request.addr == addr; });
+		return probing ? CIRCUIT_OPEN: OK;
+	}
+	constexpr void _update_health(const in_flight &e, result state) {
+		uint8_t addr = e.request.addr;
+		if (addr == BROADCAST_ADDR)
+			return;
+		unit_health &u = _unit_health(addr);
+		auto now = std::chrono::steady_clock::now();
+		if (state != TIMEOUT) {
+			// any response shows the unit is alive
+			u.sample(std::chrono::duration_cast<unit_health::us>(now - e.sent));
+			u.backoff = 0;
+			u.failures = 0;
+			u.breaker = unit_health::state::CLOSED;
+			return;
+		}
+		u.backoff = std::min(u.backoff + 1, 6);
+		++u.failures;
+		if (u.breaker == unit_health::state::HALF_OPEN || u.failures >= timeouts.breaker_threshold) {
+			u.breaker = unit_health::state::OPEN;
+			u.open_until = now + timeouts.breaker_cooldown;
+		}
+	}
+	constexpr const unit_health* _find_health(uint8_t addr) const {
+		if (health_table)
+			return &health_table->units[addr];
+		for (int i: std::ranges::iota_view{0, int(_health_count)})
+			if (_health_units[i] == addr)
+				return &_health[i];
+		return nullptr;
+	}
+	// health of the unit, once all inline slots are used the next slot of a unit with a closed
+	// breaker is reused, so dead units stay skipped
+	constexpr unit_health& _unit_health(uint8_t addr) {
+		if (const unit_health *u = _find_health(addr))
+			return const_cast<unit_health&>(*u);
+		int slot = _health_count;
+		if (slot < INLINE_UNIT_HEALTH) {
+			++_health_count;
+		} else {
+			slot = _health_next;
+			for (int i: std::ranges::iota_view{0, INLINE_UNIT_HEALTH}) {
+				int s = (_health_next + i) % INLINE_UNIT_HEALTH;
+				if (_health[s].breaker == unit_health::state::CLOSED) {
+					slot = s;
+					break;
+				}
+			}
+			_health_next = (slot + 1) % INLINE_UNIT_HEALTH;
+		}
+		_health_units[slot] = addr;
+		_health[slot] = unit_health{};
+		return _health[slot];
+	}
+	constexpr void _complete(in_flight &e, result state) {
+		// only a single rtu request is in flight, its frame is not needed anymore. A tcp request
+		// gives the frame back if its response was parsed, the rest of the adu is skipped
+		if constexpr (DATA_IO::TRANSPORT_TYPE == transport_t::RTU) {
+			_release_frame();
+		} else if (_rx.slot == &e - _in_flight.data()) {
+			_rx.slot = -1;
+			_release_frame();
+		}
+		// a failed transport says nothing about the units
+		if (state != TRANSPORT_FAILED) {
+			_update_health(e, state);
+			if (latency && state != TIMEOUT)
+				latency->record(e.request.addr, e.request.fc, std::chrono::steady_clock::now() - e.sent);
+		}
+		e.state = state;
+		if (e.waiter && on_complete)
+			on_complete(on_complete_ctx, std::exchange(e.waiter, nullptr));
+	}
+	// largest register/bit count of a single request
+	static constexpr uint32_t _max_count(register_t type, bool write) {
+		if (type == register_t::BITS || type == register_t::BITS_WRITE)
+			return write ? MAX_WRITE_BITS: MAX_READ_BITS;
+		return write ? MAX_WRITE_REGISTERS: MAX_READ_REGISTERS;
+	}
+	result _transfer(uint8_t addr, register_range r, bool write, ms timeout) {
+		uint32_t max = _max_count(r.type, write);
+		int chunks = std::max<uint32_t>(1, (r.count + max - 1) / max);
+		return _pipelined(chunks, [&](int i) {
+			uint32_t offset = r.offset + i * max;
+			uint32_t count = std::min(max, r.count - i * max);
+			return write ? submit_write(addr, r.type, offset, count, timeout): submit_read(addr, r.type, offset, count, timeout);
+		});
+	}
+	// submits the requests submit(0..n-1), up to MAX_IN_FLIGHT at once, and waits for all
+	template<typename Submit>
+	result _pipelined(int n, Submit &&submit) {
+		std::array<request_handle, MAX_IN_FLIGHT> handles{};
+		result res{OK};
+		int next{};
+		for (int i: std::ranges::iota_view{0, n}) {
+			for (; next < n && next - i < MAX_IN_FLIGHT; ++next) {
+				handles[next % MAX_IN_FLIGHT] = submit(next);
+				if (handles[next % MAX_IN_FLIGHT].err == IN_FLIGHT_FULL && next > i)
+					break;
+			}
+			if (result r = wait(handles[i % MAX_IN_FLIGHT]); r != OK && res == OK)
+				res = r;
+		}
+		return res;
+	}
+	// frames of a pooled_frame storage are only held during a transaction
+	constexpr result _acquire_frame() {
+		if constexpr (IsPooledFrame<FrameStorage>)
+			return this->frame_storage.acquire() ? OK: FRAME_POOL_EMPTY;
+		return OK;
+	}
+	constexpr void _release_frame() {
+		if constexpr (IsPooledFrame<FrameStorage>)
+			this->frame_storage.release();
+	}
+	constexpr bool _awaiting_response() const {
+		return std::ranges::any_of(_in_flight, [](const in_flight &e){ return e.used && e.state == IN_PROGRESS; });
+	}
+	// records the response data of a read, which is still in the frame
+	void _record(const in_flight &e) {
+		function_code fc = e.request.fc;
+		if (fc < function_code::READ_COILS || fc > function_code::READ_INPUT_REGISTERS)
+			return;
+		if (on_read)
+			on_read(on_read_ctx, e.request);
+		if (!recorder)
+			return;
+		const uint8_t *data = this->buffer().data();
+		if (!data)
+			return;
+		recorder->record(e.request.addr, fc, to_hb_first(e.request.i1), to_hb_first(e.request.i2),
+			{data, *this->buffer().byte_count()});
+	}
+	constexpr void _receive_rtu(uint8_t b) {
+		auto e = std::ranges::find_if(_in_flight, [](const in_flight &e){ return e.used && e.state == IN_PROGRESS; });
+		if (e == _in_flight.end())
+			return;
+		result state = this->process_rtu(b).err;
+		if (state == OK)
+			_record(*e);
+		if (state != IN_PROGRESS)
+			_complete(*e, state);
+	}
+	// the mbap length splits the stream into adus, the adu of an in flight request is parsed in
+	// the frame as its bytes arrive, all others are skipped
+	constexpr void _receive_tcp(uint8_t b) {
+		if (_rx.received < _rx.MBAP_SIZE) {
+			_rx.mbap[_rx.received++] = b;
+			if (_rx.received == _rx.MBAP_SIZE)
+				_start_tcp_response();
+			return;
+		}
+		++_rx.received;
+		if (_rx.parsing()) {
+			in_flight &e = _in_flight[_rx.slot];
+			result state = this->process_tcp(b).err;
+			if (state == OK)
+				_record(e);
+			// the parser ends the response at the last byte of the pdu
+			if (state == IN_PROGRESS && _rx.received == _rx.size())
+				state = INVALID_RESPONSE;
+			if (state != IN_PROGRESS)
+				_complete(e, state);
+		}
+		if (_rx.received == _rx.size())
+			_rx.clear();
+	}
+	constexpr void _start_tcp_response() {
+		// the rest of the stream can not be split into adus anymore
+		if (_rx.size() == _rx.MBAP_SIZE || _rx.size() > TCP_ADU_SIZE) {
+			_rx.clear();
+			transport_state = TRANSPORT_FAILED;
+			for (in_flight &e: _in_flight)
+				if (e.used && e.state == IN_PROGRESS)
+					_complete(e, TRANSPORT_FAILED);
+			return;
+		}
+		uint16_t tid = _rx.transaction_id();
+		auto e = std::ranges::find_if(_in_flight, [tid](const in_flight &e){
+			return e.used && e.state == IN_PROGRESS && e.tid == tid; });
+		if (e == _in_flight.end())
+			return;
+		if (_acquire_frame() != OK) {
+			_complete(*e, FRAME_POOL_EMPTY);
+			return;
+		}
+		// validation in the register is done against lc, which has to be the matching request
+		this->lc = e->request;
+		this->switch_to_response();
+		for (uint8_t m: _rx.mbap)
+			this->process_tcp(m);
+		_rx.slot = int16_t(e - _in_flight.begin());
+	}
 };
 
 }
@@ -0,0 +1,263 @@
+#pragma once
+
+#include "modbus-actor.h"
+#include <coroutine>
+#include <exception>
+#include <thread>
+#include <limits>
+#include <poll.h>
+
+// size and number of the coroutine frames which can be alive at the same time,
+// the frames of all task<> coroutines are taken from this pool
+#ifndef LIBMODBUS_STATIC_CORO_FRAME_SIZE
+#define LIBMODBUS_STATIC_CORO_FRAME_SIZE 1024
+#endif
+#ifndef LIBMODBUS_STATIC_CORO_FRAME_COUNT
+#define LIBMODBUS_STATIC_CORO_FRAME_COUNT 128
+#endif
+
+namespace libmodbus_static {
+
+constexpr std::string_view FRAME_POOL_EXHAUSTED{"FRAME_POOL_EXHAUSTED"};
+constexpr std::string_view EXECUTOR_FULL{"EXECUTOR_FULL"};
+
+/**
+ * Fixed size block allocator for coroutine frames, not thread safe.
+ * Frames larger than BLOCK_SIZE can not be allocated (allocate returns nullptr)
+ */
+template<int BLOCK_SIZE, int BLOCK_COUNT>
+struct frame_pool {
+	union block {
+		block *next;
+		alignas(std::max_align_t) std::array<uint8_t, BLOCK_SIZE> mem;
+	};
+	std::array<block, BLOCK_COUNT> blocks{};
+	block *free_list{};
+	int used{};
+
+	frame_pool() {
+		for (block &b: blocks | std::views::reverse) {
+			b.next = free_list;
+			free_list = &b;
+		}
+	}
+	void *allocate(size_t size) {
+		if (size > BLOCK_SIZE || !free_list)
+			return nullptr;
+		++used;
+		return std::exchange(free_list, free_list->next);
+	}
+	void deallocate(void *p) {
+		if (!p)
+			return;
+		block *b = static_cast<block*>(p);
+		b->next = std::exchange(free_list, b);
+		--used;
+	}
+};
+
+using coroutine_frame_pool_t = frame_pool<LIBMODBUS_STATIC_CORO_FRAME_SIZE, LIBMODBUS_STATIC_CORO_FRAME_COUNT>;
+inline coroutine_frame_pool_t& coroutine_frame_pool() { static coroutine_frame_pool_t pool{}; return pool; }
+
+/**
+ * Lazily started coroutine which can be awaited by another task or spawned on an executor.
+ * The coroutine frame is allocated from coroutine_frame_pool(), if the pool is exhausted
+ * the returned task is invalid (valid() == false) and has to be dropped.
+ */
+template<typename T = void>
+struct task {
+	struct promise_type;
+	using handle_t = std::coroutine_handle<promise_type>;
+
+	struct final_awaiter {
+		constexpr bool await_ready() const noexcept { return false; }
+		std::coroutine_handle<> await_suspend(handle_t h) noexcept {
+			promise_type &p = h.promise();
+			if (p.continuation)
+				return p.continuation;
+			// spawned tasks are owned by the executor and clean up after themselves
+			if (p.running) {
+				--*p.running;
+				h.destroy();
+			}
+			return std::noop_coroutine();
+		}
+		constexpr void await_resume() const noexcept {}
+	};
+	struct promise_base {
+		std::coroutine_handle<> continuation{};
+		int *running{};
+
+		static void *operator new(size_t size) noexcept { return coroutine_frame_pool().allocate(size); }
+		static void operator delete(void *p) noexcept { coroutine_frame_pool().deallocate(p); }
+		static task get_return_object_on_allocation_failure() noexcept { return task{}; }
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		final_awaiter final_suspend() const noexcept { return {}; }
+		void unhandled_exception() const noexcept { std::terminate(); }
+	};
+	template<typename V>
+	struct promise_value: promise_base {
+		V value{};
+		void return_value(V v) { value = std::move(v); }
+	};
+	struct promise_void: promise_base {
+		void return_void() const noexcept {}
+	};
+	struct promise_type: std::conditional_t<std::is_void_v<T>, promise_void, promise_value<T>> {
+		task get_return_object() noexcept { return task{handle_t::from_promise(*this)}; }
+	};
+
+	handle_t h{};
+
+	task() = default;
+	explicit task(handle_t h): h{h} {}
+	task(task &&o) noexcept: h{std::exchange(o.h, {})} {}
+	task& operator=(task &&o) noexcept { std::swap(h, o.h); return *this; }
+	~task() { if (h) h.destroy(); }
+
+	constexpr bool valid() const { return bool(h); }
+	handle_t release() { return std::exchange(h, {}); }
+
+	constexpr bool await_ready() const noexcept { return !h || h.done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+		h.promise().continuation = c;
+		return h;
+	}
+	T await_resume() {
+		if constexpr (!std::is_void_v<T>) {
+			if (!h) {
+				if constexpr (std::is_same_v<T, result>)
+					return FRAME_POOL_EXHAUSTED;
+				return T{};
+			}
+			return std::move(h.promise().value);
+		}
+	}
+};
+
+/**
+ * Single threaded executor driving spawned tasks and the actors they talk to.
+ *
+ * Attached actors are polled without blocking whenever they have requests in flight, and
+ * a completed request directly schedules the waiting coroutine. No memory is allocated
+ * besides the coroutine frames, which come from the frame pool.
+ * If nothing is ready the executor blocks in a single poll(2) on the transports of the actors
+ * with requests in flight (see IsPollableIO) until one is readable or the earliest request
+ * deadline passed. If one of them has no file descriptor it only yields the thread. An idle
+ * hook replaces this wait, eg. to drive a simulated network.
+ * At most MAX_READY tasks run at once. A task is at most once in the ready queue, so
+ * completed requests can never overflow it.
+ */
+template<int MAX_ACTORS = 64, int MAX_READY = 256>
+struct executor {
+	using clock = std::chrono::steady_clock;
+	struct source {
+		void *actor{};
+		void (*poll)(void *actor){};
+		// -1 if the transport can not be polled
+		int (*fd)(void *actor){};
+		clock::time_point (*deadline)(void *actor){};
+	};
+	std::array<source, MAX_ACTORS> sources{};
+	int source_count{};
+	std::array<std::coroutine_handle<>, MAX_READY> ready{};
+	int ready_begin{};
+	int ready_count{};
+	int running{};
+	void (*idle)(void *ctx){};
+	void *idle_ctx{};
+
+	template<typename Actor>
+	requires IsNonBlockingIO<decltype(Actor::io)>
+	result attach(Actor &actor) {
+		if (source_count == MAX_ACTORS)
+			return EXECUTOR_FULL;
+		actor.on_complete = [](void *self, void *waiter) {
+			// can not fail, see spawn
+			static_cast<executor*>(self)->schedule(std::coroutine_handle<>::from_address(waiter));
+		};
+		actor.on_complete_ctx = this;
+		sources[source_count++] = source{&actor, [](void *a) {
+			Actor &actor = *static_cast<Actor*>(a);
+			if (actor.in_flight_count())
+				actor.poll(ms(0));
+		}, [](void *a) {
+			if constexpr (IsPollableIO<decltype(Actor::io)>)
+				return int(static_cast<Actor*>(a)->io.poll_fd());
+			return -1;
+		}, [](void *a) {
+			return static_cast<Actor*>(a)->next_deadline();
+		}};
+		return OK;
+	}
+	result spawn(task<void> t) {
+		if (!t.valid())
+			return FRAME_POOL_EXHAUSTED;
+		// t still owns its frame and destroys it
+		if (running == MAX_READY)
+			return EXECUTOR_FULL;
+		auto h = t.release();
+		h.promise().running = &running;
+		++running;
+		return schedule(h);
+	}
+	result schedule(std::coroutine_handle<> h) {
+		if (ready_count == MAX_READY)
+			return EXECUTOR_FULL;
+		ready[(ready_begin + ready_count++) % MAX_READY] = h;
+		return OK;
+	}
+	// resumes all ready coroutines and polls the actors once, returns the number of resumed coroutines
+	int run_once() {
+		int resumed{};
+		for (; ready_count; ++resumed) {
+			std::coroutine_handle<> h = ready[ready_begin];
+			ready_begin = (ready_begin + 1) % MAX_READY;
+			--ready_count;
+			h.resume();
+		}
+		for (const source &s: sources | std::views::take(source_count))
+			s.poll(s.actor);
+		return resumed;
+	}
+	// runs until all spawned tasks are done
+	void run() {
+		while (running) {
+			if (run_once() || ready_count)
+				continue;
+			if (idle)
+				idle(idle_ctx);
+			else
+				wait();
+		}
+	}
+	// blocks until a transport with requests in flight is readable or the earliest deadline passed
+	void wait() {
+		std::array<pollfd, MAX_ACTORS> fds{};
+		int n{};
+		auto deadline = clock::time_point::max();
+		for (const source &s: sources | std::views::take(source_count)) {
+			auto d = s.deadline(s.actor);
+			if (d == clock::time_point::max())
+				continue;
+			int fd = s.fd(s.actor);
+			// without a file descriptor the actor has to be polled again
+			if (fd < 0) {
+				std::this_thread::yield();
+				return;
+			}
+			deadline = std::min(deadline, d);
+			fds[n++] = pollfd{.fd = fd, .events = POLLIN, .revents = 0};
+		}
+		// the tasks wait for something else than a request
+		if (n == 0) {
+			std::this_thread::yield();
+			return;
+		}
+		auto timeout = std::chrono::ceil<ms>(deadline - clock::now());
+		::poll(fds.data(), n, int(std::clamp<ms::rep>(timeout.count(), 0, std::numeric_limits<int>::max())));
+	}
+};
+
+}
+
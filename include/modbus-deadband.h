@@ -0,0 +1,214 @@
+#pragma once
+
+#include "modbus-register.h"
+#include <cmath>
+#include <cstring>
+
+namespace libmodbus_static {
+
+constexpr std::string_view DEADBAND_RULES_FULL{"DEADBAND_RULES_FULL"};
+
+/** Threshold a numeric field has to change by before the change is published */
+struct deadband {
+	enum struct type_t: uint8_t { EXACT, ABSOLUTE, PERCENT };
+	type_t type{type_t::EXACT};
+	double value{};
+
+	static constexpr deadband exact() { return {}; }
+	static constexpr deadband absolute(double v) { return {.type = type_t::ABSOLUTE, .value = v}; }
+	// relative to the last published value
+	static constexpr deadband percent(double v) { return {.type = type_t::PERCENT, .value = v}; }
+};
+
+/** A published change: the register/bit range of a field of a unit */
+struct field_change {
+	uint8_t unit{};
+	register_t block{};
+	uint16_t addr{};
+	uint16_t count{};
+	int16_t rule{};	// index of the field rule, -1 for bits
+};
+
+/**
+ * Change detection on the register data of a unit, so only changed values are pushed to
+ * consumers instead of every polled value.
+ *
+ * Fields are watched with a deadband (numbers) or exactly (strings and other byte
+ * sequences), bits are watched exactly via a mask of a bits block. update() compares a
+ * read response in the storage with the last published image: the fields of a response whose
+ * register range is unchanged are skipped after a single memcmp, bits are compared a byte at
+ * a time. A field split over two chunks of an oversized read is compared after the second.
+ * Changed fields which exceed their deadband are copied to the published image and
+ * appended to the change set, values within their deadband are not published, so slow
+ * drifts are still reported once they add up.
+ *
+ * update() is called from the on_read callback of an actor, the change set is consumed and
+ * cleared by the application. Usage:
+ *
+ * static change_detector<meter_layout> changes{.unit = 1};
+ * changes.add(&meter_layout::halfs_layout::power, deadband::percent(1));
+ * changes.add(&meter_layout::halfs_layout::name);
+ * changes.add_bits(meter_layout::bits_layout{.alarm = true});
+ * actor.on_read = [](void *ctx, const meter_actor::last_completed &request) {
+ *	changes.update(request, static_cast<meter_actor*>(ctx)->storage);
+ * };
+ * actor.on_read_ctx = &actor;
+ * for (const field_change &c: changes.change_set())
+ *	publish(c, changes.published);
+ * changes.clear();
+ */
+template<typename Layout, int MAX_RULES = 64, int MAX_CHANGES = 256>
+struct change_detector {
+	struct rule {
+		register_t block{};
+		uint16_t addr{};
+		uint16_t count{};
+		deadband db{};
+		bool (*exceeds)(const uint8_t *published, const uint8_t *current, const deadband &db){};
+		field_coverage coverage{};
+	};
+	constexpr static size_t BITS_SIZE{[]{ if constexpr (HasBits<Layout>) return sizeof(Layout::bits_registers); else return 0; }()};
+	constexpr static size_t BITS_WRITE_SIZE{[]{ if constexpr (HasWriteBits<Layout>) return sizeof(Layout::bits_write_registers); else return 0; }()};
+
+	uint8_t unit{};
+	// values as last published, the consumers read the changed fields from here
+	Layout published{};
+	std::array<rule, MAX_RULES> rules{};
+	int rule_count{};
+	std::array<uint8_t, BITS_SIZE> _watch_bits{};
+	std::array<uint8_t, BITS_WRITE_SIZE> _watch_bits_write{};
+	std::array<field_change, MAX_CHANGES> changes{};
+	int change_count{};
+	// changes which did not fit into the change set, they are published with the next change
+	uint32_t overflows{};
+
+	template<typename Mem, typename MemT = MemberType<Layout, Mem>>
+	requires IsValidRegister<Layout, Mem>
+	result add(Mem mem, deadband db = deadband::exact()) {
+		if (rule_count == MAX_RULES)
+			return DEADBAND_RULES_FULL;
+		RegisterType<Layout, Mem> reg{};
+		uint32_t addr = (reinterpret_cast<uint8_t*>(&(reg.*mem)) - reinterpret_cast<uint8_t*>(&reg)) / sizeof(uint16_t) + OFFSET<Layout, Mem>();
+		rules[rule_count++] = rule{
+			.block = type_to_register<Layout, Mem>(),
+			.addr = uint16_t(addr),
+			.count = uint16_t(sizeof(reg.*mem) / sizeof(uint16_t)),
+			.db = db,
+			.exceeds = _exceeds<MemT>,
+		};
+		return OK;
+	}
+	// watches all bits set in mask
+	template<typename Reg>
+	requires IsBitsRegisters<Layout, Reg>
+	result add_bits(const Reg &mask) {
+		const uint8_t *m = reinterpret_cast<const uint8_t*>(&mask);
+		for (size_t i: std::ranges::iota_view{size_t(0), sizeof(Reg)}) {
+			if constexpr (IsBitsRegister<Layout, Reg>)
+				_watch_bits[i] |= m[i];
+			else
+				_watch_bits_write[i] |= m[i];
+		}
+		return OK;
+	}
+
+	// appends the changes of a read response of the unit, returns the number of new changes
+	template<typename Request>
+	int update(const Request &request, const Layout &storage) {
+		if (request.addr != unit)
+			return 0;
+		int before = change_count;
+		uint16_t offset = to_hb_first(request.i1);
+		uint16_t count = to_hb_first(request.i2);
+		switch (request.fc) {
+		case function_code::READ_COILS:
+			if constexpr (HasBits<Layout>)
+				_update_bits(register_t::BITS, offset, count, storage.bits_registers, published.bits_registers, _watch_bits);
+			break;
+		case function_code::READ_DISCRETE_INPUTS:
+			if constexpr (HasWriteBits<Layout>)
+				_update_bits(register_t::BITS_WRITE, offset, count, storage.bits_write_registers, published.bits_write_registers, _watch_bits_write);
+			break;
+		case function_code::READ_HOLDING_REGISTERS:
+			if constexpr (HasHalfs<Layout>)
+				_update_halfs(register_t::HALFS, offset, count, storage.halfs_registers, published.halfs_registers);
+			break;
+		case function_code::READ_INPUT_REGISTERS:
+			if constexpr (HasWriteHalfs<Layout>)
+				_update_halfs(register_t::HALFS_WRITE, offset, count, storage.halfs_write_registers, published.halfs_write_registers);
+			break;
+		default: break;
+		}
+		return change_count - before;
+	}
+	std::span<const field_change> change_set() const { return {changes.data(), size_t(change_count)}; }
+	void clear() { change_count = 0; }
+
+	template<typename Block>
+	void _update_halfs(register_t type, uint16_t offset, uint16_t count, const Block &current, Block &pub) {
+		bool unchanged = std::memcmp(get_start_addr(const_cast<Block&>(current), offset), get_start_addr(pub, offset), count * sizeof(uint16_t)) == 0;
+		for (int i: std::ranges::iota_view{0, rule_count}) {
+			rule &r = rules[i];
+			if (r.block != type || !r.coverage.complete(r.addr, r.count, offset, count))
+				continue;
+			// a split field also changed if its first part (before this response) changed
+			if (unchanged && r.addr >= offset)
+				continue;
+			const uint8_t *cur = get_start_addr(const_cast<Block&>(current), r.addr);
+			uint8_t *old = get_start_addr(pub, r.addr);
+			size_t size = r.count * sizeof(uint16_t);
+			if (std::memcmp(cur, old, size) == 0 || !r.exceeds(old, cur, r.db))
+				continue;
+			if (!_push({.unit = unit, .block = type, .addr = r.addr, .count = r.count, .rule = int16_t(i)}))
+				continue;
+			std::memcpy(old, cur, size);
+		}
+	}
+	template<typename Block, size_t N>
+	void _update_bits(register_t type, uint16_t offset, uint16_t count, const Block &current, Block &pub, const std::array<uint8_t, N> &watch) {
+		const uint8_t *cur = reinterpret_cast<const uint8_t*>(&current);
+		uint8_t *old = reinterpret_cast<uint8_t*>(&pub);
+		int first = offset - Block::OFFSET;
+		int last = first + count;
+		for (int byte = first / 8; byte <= (last - 1) / 8; ++byte) {
+			uint8_t diff = (cur[byte] ^ old[byte]) & watch[byte];
+			for (int bit = 0; diff; ++bit, diff >>= 1) {
+				int n = byte * 8 + bit;
+				if (!(diff & 1) || n < first || n >= last)
+					continue;
+				if (!_push({.unit = unit, .block = type, .addr = uint16_t(n + Block::OFFSET), .count = 1, .rule = -1}))
+					continue;
+				old[byte] ^= uint8_t(1 << bit);
+			}
+		}
+	}
+	constexpr bool _push(const field_change &c) {
+		if (change_count == MAX_CHANGES) {
+			++overflows;
+			return false;
+		}
+		changes[change_count++] = c;
+		return true;
+	}
+	template<typename T>
+	static bool _exceeds(const uint8_t *published, const uint8_t *current, const deadband &db) {
+		// the bytes differ, byte sequences have no deadband
+		if constexpr (!std::is_arithmetic_v<T>) {
+			return true;
+		} else {
+			T raw_old{}, raw_cur{}, old{}, cur{};
+			std::memcpy(&raw_old, published, sizeof(T));
+			std::memcpy(&raw_cur, current, sizeof(T));
+			swap_byte_order<T>{}(raw_old, old);
+			swap_byte_order<T>{}(raw_cur, cur);
+			double delta = std::abs(double(cur) - double(old));
+			switch (db.type) {
+			case deadband::type_t::ABSOLUTE: return delta > db.value;
+			case deadband::type_t::PERCENT: return delta > std::abs(double(old)) * db.value / 100;
+			default: return true;
+			}
+		}
+	}
+};
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <utility>
+
+namespace libmodbus_static {
+
+constexpr std::string_view FRAME_POOL_EMPTY{"FRAME_POOL_EMPTY"};
+
+/**
+ * Fixed size pool of frames which are borrowed by registers only while a transaction is in
+ * flight (see pooled_frame). With many client actors (eg. 2000 meters behind one gateway)
+ * the frame memory then scales with the number of concurrent transactions instead of the
+ * number of devices.
+ *
+ * The free frames are a lock free stack (the head index is tagged against aba), so actors
+ * in different threads can share a pool. The frame released last is borrowed first, which
+ * keeps the used frames in cache. peak is the highest number of frames borrowed at once,
+ * useful to size the pool.
+ */
+template<int MAX_SIZE, int N>
+struct modbus_frame_pool {
+	static_assert(N > 0, "A frame pool needs at least one frame");
+	constexpr static int FRAME_SIZE{MAX_SIZE};
+	constexpr static uint32_t NO_FRAME{0xffffffff};
+
+	std::array<modbus_frame<MAX_SIZE>, N> frames{};
+	// next free frame of each free frame
+	std::array<std::atomic<uint32_t>, N> _next{};
+	// index of the first free frame in the low, aba tag in the high 32 bits
+	std::atomic<uint64_t> _head{};
+	std::atomic<int> borrowed{};
+	std::atomic<int> peak{};
+
+	modbus_frame_pool() {
+		for (int i: std::ranges::iota_view{0, N})
+			_next[i].store(i + 1 < N ? i + 1: NO_FRAME, std::memory_order_relaxed);
+		_head.store(0, std::memory_order_release);
+	}
+	modbus_frame_pool(const modbus_frame_pool&) = delete;
+	modbus_frame_pool& operator=(const modbus_frame_pool&) = delete;
+
+	// returns nullptr if all frames are borrowed
+	modbus_frame<MAX_SIZE>* acquire() {
+		uint64_t head = _head.load(std::memory_order_acquire);
+		uint32_t i{};
+		do {
+			i = uint32_t(head);
+			if (i == NO_FRAME)
+				return nullptr;
+			uint64_t next = ((head >> 32) + 1) << 32 | _next[i].load(std::memory_order_relaxed);
+			if (_head.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+				break;
+		} while (true);
+		int b = borrowed.fetch_add(1, std::memory_order_relaxed) + 1;
+		for (int p = peak.load(std::memory_order_relaxed); b > p && !peak.compare_exchange_weak(p, b, std::memory_order_relaxed);)
+			;
+		return &frames[i];
+	}
+	void release(modbus_frame<MAX_SIZE> *frame) {
+		uint32_t i = frame - frames.data();
+		uint64_t head = _head.load(std::memory_order_relaxed);
+		uint64_t next{};
+		do {
+			_next[i].store(uint32_t(head), std::memory_order_relaxed);
+			next = ((head >> 32) + 1) << 32 | i;
+		} while (!_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+		borrowed.fetch_sub(1, std::memory_order_relaxed);
+	}
+	int available() const { return N - borrowed.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Frame storage policy of modbus_register which borrows its frame from a modbus_frame_pool.
+ * The frame may only be used between acquire and release, a modbus_actor does this on its
+ * own around every transaction (see IsPooledFrame). A freshly acquired frame is cleared.
+ * Usage:
+ *
+ * static modbus_frame_pool<TCP_ADU_SIZE, 32> pool{};
+ * using meter_t = modbus_actor<meter_layout, tcp_io, 1, no_trace, pooled_frame<decltype(pool)>>;
+ * meter_t meter{role_t::CLIENT, meter_layout{}, tcp_io{...}};
+ * meter.frame_storage.pool = &pool;
+ */
+template<typename Pool>
+struct pooled_frame {
+	Pool *pool{};
+	modbus_frame<Pool::FRAME_SIZE> *frame{};
+
+	constexpr modbus_frame<Pool::FRAME_SIZE>& get() const { return *frame; }
+	// true if a frame is held afterwards, acquiring a held frame keeps it
+	bool acquire() {
+		if (frame)
+			return true;
+		frame = pool ? pool->acquire(): nullptr;
+		if (frame)
+			frame->clear();
+		return frame;
+	}
+	void release() {
+		if (frame)
+			pool->release(std::exchange(frame, nullptr));
+	}
+	constexpr bool held() const { return frame; }
+};
+
+/** Frame storage which is only held during a transaction, see pooled_frame */
+template<typename S>
+concept IsPooledFrame = requires(S s) {
+	{ s.acquire() } -> std::convertible_to<bool>;
+	{ s.release() };
+};
+
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include "common.h"
+#include <chrono>
+#include <algorithm>
+
+namespace libmodbus_static {
+
+constexpr std::string_view INVALID_ADU{"INVALID_ADU"};
+constexpr std::string_view GATEWAY_BUSY{"GATEWAY_BUSY"};
+constexpr std::string_view NO_ROUTE{"NO_ROUTE"};
+
+/**
+ * Size of a complete rtu response frame given its first bytes, -1 if not yet known
+ * or if the function code has no fixed response layout
+ */
+constexpr int rtu_response_size(std::span<const uint8_t> head) {
+	if (head.size() < 2)
+		return -1;
+	if (head[1] & 0x80)
+		return 5;
+	switch (function_code(head[1])) {
+	case function_code::READ_COILS:
+	case function_code::READ_DISCRETE_INPUTS:
+	case function_code::READ_HOLDING_REGISTERS:
+	case function_code::READ_INPUT_REGISTERS:
+		return head.size() < 3 ? -1: 5 + head[2];
+	case function_code::WRITE_SINGLE_COIL:
+	case function_code::WRITE_SINGLE_REGISTER:
+	case function_code::WRITE_MULTIPLE_COILS:
+	case function_code::WRITE_MULTIPLE_REGISTERS:
+		return 8;
+	default: return -1;
+	}
+}
+
+/**
+ * Modbus tcp to rtu gateway.
+ *
+ * Mbap requests are queued and sent one after the other on the rtu transport, the pdu is
+ * copied between the frames as is, only the mbap header and the rtu address/crc are exchanged.
+ * The queue is bounded (QUEUE_SIZE in total, max_per_unit per unit id), requests which do not
+ * fit are answered with SLAVE_DEVICE_BUSY, requests for unit ids without route with
+ * GATEWAY_PATH_UNAVAILABLE and requests without valid response within timeout with
+ * GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND. Requests for unit id 0 are broadcasts, they are
+ * sent and not answered.
+ *
+ * The gateway is a handler for tcp_linux_server, queued responses are delivered via on_response:
+ *
+ * static modbus_gateway<rtu_linux_io> gateway{.io = rtu_linux_io{"/dev/ttyUSB0"}};
+ * static tcp_linux_server<decltype(gateway)> server{.handler = gateway};
+ * gateway.route(1, 247);
+ * gateway.on_response = [](void *s, connection_id c, std::span<const uint8_t> adu) {
+ *	static_cast<decltype(server)*>(s)->send(c, adu); };
+ * gateway.on_response_ctx = &server;
+ * server.init(502);
+ * while (true) {
+ *	server.poll(ms(1));
+ *	gateway.poll();
+ * }
+ */
+template<typename RTU_IO, int QUEUE_SIZE = 32>
+struct modbus_gateway {
+	using clock = std::chrono::steady_clock;
+	constexpr static int MAX_PDU_SIZE{253};
+	struct queued_request {
+		uint64_t connection{};
+		uint16_t tid{};
+		uint8_t unit{};
+		uint8_t pdu_size{};
+		std::array<uint8_t, MAX_PDU_SIZE> pdu{};
+	};
+
+	RTU_IO io{};
+	std::chrono::milliseconds timeout{1000};
+	std::chrono::milliseconds broadcast_delay{100};	// turnaround delay after a broadcast
+	int max_per_unit{4};
+	// called for every response adu which was not returned by process_tcp_adu
+	void (*on_response)(void *ctx, uint64_t connection, std::span<const uint8_t> adu){};
+	void *on_response_ctx{};
+
+	std::array<uint64_t, 4> _routes{};
+	std::array<queued_request, QUEUE_SIZE> _queue{};
+	int _queue_begin{};
+	int _queue_count{};
+	std::array<uint8_t, 256> _unit_count{};
+	bool _active{};
+	clock::time_point _deadline{};
+	std::array<uint8_t, RTU_FRAME_SIZE> _rtu{};
+	int _rtu_size{};
+	std::array<uint8_t, TCP_ADU_SIZE> _reply{};
+
+	// unit ids in [first, last] are forwarded to the rtu transport
+	constexpr void route(uint8_t first, uint8_t last) {
+		for (int unit: std::ranges::iota_view{int(first), int(last) + 1})
+			_routes[unit / 64] |= uint64_t(1) << (unit % 64);
+	}
+	constexpr bool routed(uint8_t unit) const { return unit == 0 || _routes[unit / 64] & (uint64_t(1) << (unit % 64)); }
+	constexpr int queued() const { return _queue_count; }
+
+	// queues a mbap request, errors are returned as exception response in res
+	result_err process_tcp_adu(std::span<const uint8_t> adu, uint64_t connection = 0) {
+		if (adu.size() < 8 || adu.size() - 7 > MAX_PDU_SIZE || adu[2] || adu[3] || ((adu[4] << 8) | adu[5]) != int(adu.size()) - 6)
+			return {.err = INVALID_ADU};
+		queued_request r{.connection = connection, .tid = uint16_t((adu[0] << 8) | adu[1]), .unit = adu[6],
+			.pdu_size = uint8_t(adu.size() - 7)};
+		if (!routed(r.unit))
+			return {_exception(r, adu[7], exception_code::GATEWAY_PATH_UNAVAILABLE), NO_ROUTE};
+		if (_queue_count == QUEUE_SIZE || _unit_count[r.unit] >= max_per_unit)
+			return {_exception(r, adu[7], exception_code::SLAVE_DEVICE_BUSY), GATEWAY_BUSY};
+		std::ranges::copy(adu.subspan(7), r.pdu.begin());
+		_queue[(_queue_begin + _queue_count++) % QUEUE_SIZE] = r;
+		++_unit_count[r.unit];
+		return {};
+	}
+
+	// sends the next queued request and receives its response, waits at most max_wait for
+	// response bytes. Should be called regularly
+	result poll(std::chrono::milliseconds max_wait = std::chrono::milliseconds(0)) {
+		if (!_active)
+			_send_next();
+		if (!_active)
+			return OK;
+		queued_request &r = _queue[_queue_begin];
+		if (r.unit == 0) {
+			if (clock::now() >= _deadline)
+				_pop();
+			return OK;
+		}
+		std::span<uint8_t> data = io.read_bytes(max_wait);
+		for (uint8_t b: data) {
+			if (_rtu_size == int(_rtu.size()))
+				break;
+			_rtu[_rtu_size++] = b;
+		}
+		std::span<uint8_t> frame{_rtu.data(), size_t(_rtu_size)};
+		int size = rtu_response_size(frame);
+		bool complete = size > 0 ? _rtu_size >= size: _rtu_size >= 4 && checksum::calculate_crc16(frame) == 0;
+		if (complete) {
+			frame = frame.first(size > 0 ? size: _rtu_size);
+			if (frame[0] != r.unit || (frame[1] & 0x7f) != r.pdu[0] || checksum::calculate_crc16(frame) != 0) {
+				_respond(_exception(r, r.pdu[0], exception_code::GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND));
+			} else {
+				// mbap header in front of the rtu pdu, the rtu address is the unit id
+				std::span<const uint8_t> pdu = frame.subspan(1, frame.size() - 3);
+				_respond(_mbap(r, pdu.size() + 1, pdu));
+			}
+			_pop();
+		} else if (clock::now() >= _deadline) {
+			_respond(_exception(r, r.pdu[0], exception_code::GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND));
+			_pop();
+		}
+		return OK;
+	}
+
+	// ---------------------------------------------------------------------------------------
+	// Internal functions
+	// ---------------------------------------------------------------------------------------
+	void _send_next() {
+		if (!_queue_count)
+			return;
+		// bytes of responses which arrived after their timeout
+		io.read_bytes(std::chrono::milliseconds(0));
+		const queued_request &r = _queue[_queue_begin];
+		_rtu[0] = r.unit;
+		std::ranges::copy(r.pdu | std::views::take(r.pdu_size), _rtu.begin() + 1);
+		uint16_t crc = checksum::calculate_crc16({_rtu.data(), size_t(r.pdu_size + 1)});
+		_rtu[r.pdu_size + 1] = l_byte(crc);
+		_rtu[r.pdu_size + 2] = h_byte(crc);
+		io.write_bytes({_rtu.data(), size_t(r.pdu_size + 3)});
+		_rtu_size = 0;
+		_active = true;
+		_deadline = clock::now() + (r.unit == 0 ? broadcast_delay: timeout);
+	}
+	void _pop() {
+		--_unit_count[_queue[_queue_begin].unit];
+		_queue_begin = (_queue_begin + 1) % QUEUE_SIZE;
+		--_queue_count;
+		_active = false;
+	}
+	void _respond(std::span<const uint8_t> adu) {
+		if (on_response)
+			on_response(on_response_ctx, _queue[_queue_begin].connection, adu);
+	}
+	std::span<uint8_t> _mbap(const queued_request &r, size_t length, std::span<const uint8_t> pdu) {
+		_reply[0] = h_byte(r.tid);
+		_reply[1] = l_byte(r.tid);
+		_reply[2] = 0;
+		_reply[3] = 0;
+		_reply[4] = h_byte(length);
+		_reply[5] = l_byte(length);
+		_reply[6] = r.unit;
+		std::ranges::copy(pdu, _reply.begin() + 7);
+		return {_reply.data(), 7 + pdu.size()};
+	}
+	std::span<uint8_t> _exception(const queued_request &r, uint8_t fc, exception_code ec) {
+		std::array<uint8_t, 2> pdu{uint8_t(fc | 0x80), uint8_t(ec)};
+		return _mbap(r, 3, pdu);
+	}
+};
+
+}
+
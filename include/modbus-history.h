@@ -0,0 +1,137 @@
+#pragma once
+
+#include "modbus-register.h"
+#include <chrono>
+
+namespace libmodbus_static {
+
+/**
+ * Fixed memory history of a single register member of a unit, eg. the power of a meter for
+ * trend displays. Every read response of an actor which covers the member appends
+ * (time, value) to a ring of the last N samples, stored as separate time and value arrays.
+ * A member split over two chunks of an oversized read is appended after the second chunk.
+ *
+ * Appending is O(1). The ring is split into blocks of BLOCK samples with incrementally
+ * updated min/max/sum, so window() only scans the partial blocks at the window start and
+ * end and combines the full blocks in between. Nothing is allocated and queries never
+ * touch the bus.
+ *
+ * The actor calls update() via its on_read callback, which can feed several histories.
+ * Usage:
+ *
+ * static field_history<meter_layout, &meter_layout::halfs_layout::power, 3600> power{.unit = 1};
+ * actor.on_read = [](void *ctx, const meter_actor::last_completed &request) {
+ *	power.update(request, static_cast<meter_actor*>(ctx)->storage);
+ * };
+ * actor.on_read_ctx = &actor;
+ * auto last_minute = power.window(std::chrono::minutes(1));
+ */
+template<typename Layout, auto Mem, int N = 4096, int BLOCK = 64>
+requires IsValidRegister<Layout, decltype(Mem)> && std::is_arithmetic_v<MemberType<Layout, decltype(Mem)>> && (N % BLOCK == 0)
+struct field_history {
+	using clock = std::chrono::steady_clock;
+	using value_t = MemberType<Layout, decltype(Mem)>;
+	struct block {
+		value_t min{};
+		value_t max{};
+		double sum{};
+	};
+	struct stats {
+		value_t min{};
+		value_t max{};
+		double avg{};
+		uint32_t count{};
+	};
+
+	uint8_t unit{};
+	std::array<clock::time_point, N> times{};
+	std::array<value_t, N> values{};
+	std::array<block, N / BLOCK> blocks{};
+	// number of samples ever appended, the newest sample is at (appended - 1) % N
+	uint64_t appended{};
+	field_coverage _coverage{};
+
+	constexpr uint32_t size() const { return std::min<uint64_t>(appended, N); }
+	constexpr bool empty() const { return appended == 0; }
+	constexpr value_t last() const { return values[(appended - 1) % N]; }
+	constexpr clock::time_point last_time() const { return times[(appended - 1) % N]; }
+
+	constexpr void append(value_t v, clock::time_point t = clock::now()) {
+		uint32_t i = appended % N;
+		block &b = blocks[i / BLOCK];
+		// the first sample of a block overwrites the oldest samples of the ring
+		if (i % BLOCK == 0)
+			b = block{.min = v, .max = v, .sum = double(v)};
+		else
+			b = block{.min = std::min(b.min, v), .max = std::max(b.max, v), .sum = b.sum + double(v)};
+		times[i] = t;
+		values[i] = v;
+		++appended;
+	}
+	// appends the member once the read responses covered all of its registers
+	template<typename Request>
+	void update(const Request &request, const Layout &storage, clock::time_point t = clock::now()) {
+		auto [start, end] = _range();
+		uint16_t offset = to_hb_first(request.i1);
+		uint16_t count = to_hb_first(request.i2);
+		if (request.addr != unit || request.fc != _read_fc() || !_coverage.complete(start, end - start, offset, count))
+			return;
+		value_t v{};
+		swap_byte_order<value_t>{}(register_ref<Layout, decltype(Mem)>(const_cast<Layout&>(storage)).*Mem, v);
+		append(v, t);
+	}
+	// min/max/avg of the samples taken within the last d before now
+	constexpr stats window(clock::duration d, clock::time_point now = clock::now()) const {
+		uint64_t end = appended;
+		uint64_t l = _first_after(now - d);
+		if (l == end)
+			return {};
+		stats s{.min = values[l % N], .max = values[l % N], .count = uint32_t(end - l)};
+		double sum{};
+		while (l < end) {
+			if (l % BLOCK == 0 && l + BLOCK <= end) {
+				const block &b = blocks[(l % N) / BLOCK];
+				s.min = std::min(s.min, b.min);
+				s.max = std::max(s.max, b.max);
+				sum += b.sum;
+				l += BLOCK;
+				continue;
+			}
+			value_t v = values[l % N];
+			s.min = std::min(s.min, v);
+			s.max = std::max(s.max, v);
+			sum += double(v);
+			++l;
+		}
+		s.avg = sum / s.count;
+		return s;
+	}
+
+	// times are monotonic, binary search for the oldest sample at or after t
+	constexpr uint64_t _first_after(clock::time_point t) const {
+		uint64_t lo = appended - size(), hi = appended;
+		while (lo < hi) {
+			uint64_t mid = lo + (hi - lo) / 2;
+			if (times[mid % N] < t)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+	static constexpr function_code _read_fc() {
+		return type_to_register<Layout, decltype(Mem)>() == register_t::HALFS ?
+			function_code::READ_HOLDING_REGISTERS: function_code::READ_INPUT_REGISTERS;
+	}
+	// register range of the member, computed once
+	static std::pair<uint32_t, uint32_t> _range() {
+		static const std::pair<uint32_t, uint32_t> range = []{
+			RegisterType<Layout, decltype(Mem)> reg{};
+			uint32_t start = (reinterpret_cast<uint8_t*>(&(reg.*Mem)) - reinterpret_cast<uint8_t*>(&reg)) / sizeof(uint16_t) + OFFSET<Layout, decltype(Mem)>();
+			return std::pair{start, start + uint32_t(sizeof(reg.*Mem) / sizeof(uint16_t))};
+		}();
+		return range;
+	}
+};
+
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "common.h"
+#include <chrono>
+#include <bit>
+#include <algorithm>
+
+namespace libmodbus_static {
+
+/**
+ * Fixed size log-linear latency histogram (HdrHistogram like) in nanoseconds.
+ * Values below 2 * SUB_BUCKETS ns are counted exactly, above every power of two is split
+ * into SUB_BUCKETS linear buckets, so the relative error is below 1 / SUB_BUCKETS (6.25%).
+ * Values above 2^MAX_BITS ns (~18 min) are counted in the last bucket.
+ */
+struct latency_histogram {
+	using ns = std::chrono::nanoseconds;
+	constexpr static int SUB_BUCKET_BITS{4};
+	constexpr static int SUB_BUCKETS{1 << SUB_BUCKET_BITS};
+	constexpr static int MAX_BITS{40};
+	constexpr static int BUCKETS{SUB_BUCKETS * (MAX_BITS - SUB_BUCKET_BITS) + SUB_BUCKETS};
+
+	std::array<uint32_t, BUCKETS> counts{};
+	uint64_t total{};
+	uint64_t sum{};
+	uint64_t min_value{~uint64_t(0)};
+	uint64_t max_value{};
+
+	constexpr static int bucket_index(uint64_t v) {
+		if (v < 2 * SUB_BUCKETS)
+			return v;
+		int shift = std::bit_width(v) - 1 - SUB_BUCKET_BITS;
+		return std::min(SUB_BUCKETS * shift + int(v >> shift), BUCKETS - 1);
+	}
+	// smallest and largest value counted in a bucket
+	constexpr static uint64_t bucket_low(int i) {
+		if (i < 2 * SUB_BUCKETS)
+			return i;
+		int shift = i / SUB_BUCKETS - 1;
+		return uint64_t(i % SUB_BUCKETS + SUB_BUCKETS) << shift;
+	}
+	constexpr static uint64_t bucket_high(int i) {
+		return i < 2 * SUB_BUCKETS ? i: bucket_low(i) + (uint64_t(1) << (i / SUB_BUCKETS - 1)) - 1;
+	}
+
+	constexpr void record(ns value) {
+		uint64_t v = std::max<int64_t>(value.count(), 0);
+		++counts[bucket_index(v)];
+		++total;
+		sum += v;
+		min_value = std::min(min_value, v);
+		max_value = std::max(max_value, v);
+	}
+	constexpr uint64_t count() const { return total; }
+	constexpr ns min() const { return ns(total ? min_value: 0); }
+	constexpr ns max() const { return ns(max_value); }
+	constexpr ns mean() const { return ns(total ? sum / total: 0); }
+	// value below which p percent of the recorded values are (upper bound of the bucket),
+	// eg. percentile(99.9)
+	constexpr ns percentile(double p) const {
+		if (!total)
+			return ns(0);
+		uint64_t rank = std::max<uint64_t>(1, uint64_t(std::clamp(p, 0., 100.) / 100. * total + .5));
+		uint64_t seen{};
+		for (int i: std::ranges::iota_view{0, BUCKETS}) {
+			seen += counts[i];
+			if (seen >= rank)
+				return ns(std::clamp(bucket_high(i), min_value, max_value));
+		}
+		return max();
+	}
+	constexpr void merge(const latency_histogram &o) {
+		for (int i: std::ranges::iota_view{0, BUCKETS})
+			counts[i] += o.counts[i];
+		total += o.total;
+		sum += o.sum;
+		min_value = std::min(min_value, o.min_value);
+		max_value = std::max(max_value, o.max_value);
+	}
+	constexpr void reset() {
+		counts.fill(0);
+		total = sum = max_value = 0;
+		min_value = ~uint64_t(0);
+	}
+};
+
+/**
+ * Latency histograms per unit id and function code. Entries are taken on the first record
+ * of a unit/function code pair, once all MAX_KEYS entries are used further pairs are counted
+ * in the overflow histogram. All memory is part of the object (~2.4 kB per entry).
+ *
+ * Recording is not synchronized, to read the statistics of another thread take a snapshot
+ * in the thread which records (reset/merge per interval for windowed percentiles). Usage:
+ *
+ * static latency_stats stats{};
+ * actor.latency = &stats;
+ * ...
+ * if (const latency_histogram *h = stats.find(1, function_code::READ_HOLDING_REGISTERS))
+ *	std::println("p99 {}ns", h->percentile(99).count());
+ */
+struct latency_stats {
+	constexpr static int MAX_KEYS{32};
+	struct entry {
+		uint8_t unit{};
+		function_code fc{function_code::NONE};
+		latency_histogram histogram{};
+	};
+
+	std::array<entry, MAX_KEYS> entries{};
+	int entry_count{};
+	latency_histogram overflow{};
+
+	constexpr void record(uint8_t unit, function_code fc, latency_histogram::ns value) {
+		auto e = std::ranges::find_if(entries | std::views::take(entry_count), [unit, fc](const entry &e){
+			return e.unit == unit && e.fc == fc; });
+		if (e != entries.begin() + entry_count) {
+			e->histogram.record(value);
+		} else if (entry_count < MAX_KEYS) {
+			entries[entry_count] = entry{.unit = unit, .fc = fc};
+			entries[entry_count++].histogram.record(value);
+		} else {
+			overflow.record(value);
+		}
+	}
+	constexpr const latency_histogram* find(uint8_t unit, function_code fc) const {
+		auto e = std::ranges::find_if(entries | std::views::take(entry_count), [unit, fc](const entry &e){
+			return e.unit == unit && e.fc == fc; });
+		return e != entries.begin() + entry_count ? &e->histogram: nullptr;
+	}
+	constexpr std::span<const entry> used() const { return {entries.data(), size_t(entry_count)}; }
+	// all entries and the overflow merged into one histogram
+	constexpr latency_histogram total() const {
+		latency_histogram t = overflow;
+		for (const entry &e: used())
+			t.merge(e.histogram);
+		return t;
+	}
+	// copies the statistics, eg. into a buffer read by another thread
+	constexpr void snapshot(latency_stats &dst) const { dst = *this; }
+	constexpr void merge(const latency_stats &o) {
+		for (const entry &e: o.used()) {
+			auto m = std::ranges::find_if(entries | std::views::take(entry_count), [&e](const entry &m){
+				return m.unit == e.unit && m.fc == e.fc; });
+			if (m != entries.begin() + entry_count)
+				m->histogram.merge(e.histogram);
+			else if (entry_count < MAX_KEYS)
+				entries[entry_count++] = e;
+			else
+				overflow.merge(e.histogram);
+		}
+		overflow.merge(o.overflow);
+	}
+	constexpr void reset() {
+		entry_count = 0;
+		overflow.reset();
+	}
+};
+
+}
+
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "modbus-register.h"
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace libmodbus_static {
+
+/**
+ * Simulated line of a loopback_link (per direction).
+ * baud > 0 delays every byte by its rtu character time (bits_per_char / baud), bytes of
+ * consecutive writes queue up on the wire. latency (+ uniform random jitter) is added per
+ * write, drop_rate/flip_rate are the probabilities that a byte is lost or gets a flipped bit.
+ * max_fragment > 0 limits the bytes returned by a single read_bytes.
+ */
+struct loopback_config {
+	uint32_t baud{};
+	int bits_per_char{11};	// start, 8 data, parity, stop
+	std::chrono::microseconds latency{};
+	std::chrono::microseconds jitter{};
+	double drop_rate{};
+	double flip_rate{};
+	int max_fragment{};
+	uint32_t seed{1};
+};
+
+/**
+ * In memory connection of two loopback_io ends (side 0 and side 1), all memory is part of
+ * the link (CAPACITY bytes in flight per direction). Reads and writes are thread safe, so the
+ * ends can be used from different threads, configure has to be called before.
+ */
+template<int CAPACITY = 4096>
+struct loopback_link {
+	using clock = std::chrono::steady_clock;
+	struct entry {
+		clock::time_point due{};
+		uint8_t b{};
+	};
+	struct channel {
+		loopback_config config{};
+		std::array<entry, CAPACITY> fifo{};
+		int begin{};
+		int count{};
+		clock::time_point wire_free{};	// end of the last byte on the wire
+		clock::time_point last_due{};
+		uint32_t rng{1};
+		uint32_t dropped{};
+		uint32_t flipped{};
+		uint32_t overflowed{};
+	};
+
+	std::array<channel, 2> channels{};	// index is the sending side
+	std::mutex mutex{};
+
+	// sets the config of both directions, restarts the random sequence
+	void configure(const loopback_config &c) { configure(0, c); configure(1, c); }
+	void configure(int sending_side, const loopback_config &c) {
+		std::scoped_lock lock{mutex};
+		channels[sending_side].config = c;
+		channels[sending_side].rng = c.seed ? c.seed: 1;
+	}
+	const channel& stats(int sending_side) const { return channels[sending_side]; }
+
+	void write(int side, std::span<const uint8_t> data) {
+		std::scoped_lock lock{mutex};
+		channel &c = channels[side];
+		auto now = clock::now();
+		auto char_time = c.config.baud ? std::chrono::nanoseconds(uint64_t(c.config.bits_per_char) * 1000000000 / c.config.baud):
+			std::chrono::nanoseconds(0);
+		auto delay = c.config.latency + std::chrono::duration_cast<std::chrono::microseconds>(c.config.jitter * _uniform(c));
+		auto wire = std::max(now, c.wire_free);
+		for (uint8_t b: data) {
+			wire += char_time;
+			if (_uniform(c) < c.config.drop_rate) {
+				++c.dropped;
+				continue;
+			}
+			if (_uniform(c) < c.config.flip_rate) {
+				b ^= uint8_t(1) << (_next(c) % 8);
+				++c.flipped;
+			}
+			if (c.count == CAPACITY) {
+				++c.overflowed;
+				continue;
+			}
+			// jitter must not reorder the bytes
+			c.last_due = std::max(c.last_due, wire + delay);
+			c.fifo[(c.begin + c.count++) % CAPACITY] = entry{c.last_due, b};
+		}
+		c.wire_free = wire;
+	}
+	// moves the bytes sent by sending_side which are due at now to dst, returns their number.
+	// first_due/last_due are set to the arrival times of the first and last moved byte
+	int read(int sending_side, std::span<uint8_t> dst, clock::time_point now, clock::time_point *first_due = nullptr,
+		clock::time_point *last_due = nullptr) {
+		std::scoped_lock lock{mutex};
+		channel &c = channels[sending_side];
+		int max = c.config.max_fragment > 0 ? std::min<int>(c.config.max_fragment, dst.size()): dst.size();
+		int n{};
+		for (; n < max && c.count && c.fifo[c.begin].due <= now; ++n, --c.count, c.begin = (c.begin + 1) % CAPACITY) {
+			if (n == 0 && first_due)
+				*first_due = c.fifo[c.begin].due;
+			if (last_due)
+				*last_due = c.fifo[c.begin].due;
+			dst[n] = c.fifo[c.begin].b;
+		}
+		return n;
+	}
+	// time the next byte sent by sending_side is due, max() if there is none
+	clock::time_point next_due(int sending_side) {
+		std::scoped_lock lock{mutex};
+		const channel &c = channels[sending_side];
+		return c.count ? c.fifo[c.begin].due: clock::time_point::max();
+	}
+
+	// xorshift32, deterministic for a given seed
+	static uint32_t _next(channel &c) {
+		c.rng ^= c.rng << 13;
+		c.rng ^= c.rng >> 17;
+		c.rng ^= c.rng << 5;
+		return c.rng;
+	}
+	static double _uniform(channel &c) { return _next(c) / 4294967296.; }
+};
+
+/**
+ * DATA_IO of a modbus_actor (or any other user of the io concept) on one side of a
+ * loopback_link. read_bytes waits at most max_timeout for due bytes and calls on_idle while
+ * waiting, so a server can be driven from the same thread (see loopback_server). Usage:
+ *
+ * static loopback_link link{};
+ * link.configure({.baud = 19200, .flip_rate = 0.001});
+ * static modbus_register<layout> server{.addr = 1};
+ * static loopback_server server_end{server, loopback_io<transport_t::RTU>{&link, 1}};
+ * modbus_actor<layout, loopback_io<transport_t::RTU>> client{role_t::CLIENT, layout{},
+ *	{.link = &link, .side = 0, .on_idle = decltype(server_end)::pump, .on_idle_ctx = &server_end}};
+ * client.read_remote(1, &layout::halfs_layout::value);
+ */
+template<transport_t TRANSPORT, typename Link = loopback_link<>>
+struct loopback_io {
+	using clock = std::chrono::steady_clock;
+	static constexpr transport_t TRANSPORT_TYPE{TRANSPORT};
+	static constexpr int BUFFER_SIZE{512};
+
+	Link *link{};
+	int side{};
+	void (*on_idle)(void *ctx){};
+	void *on_idle_ctx{};
+	std::array<uint8_t, BUFFER_SIZE> receive_buffer{};
+	// arrival times of the first and last byte returned by the last read_bytes
+	clock::time_point first_due{};
+	clock::time_point last_due{};
+
+	void init() {}
+	void deinit() {}
+	std::span<uint8_t> read_bytes(std::chrono::milliseconds max_timeout) {
+		auto deadline = clock::now() + max_timeout;
+		while (true) {
+			if (on_idle)
+				on_idle(on_idle_ctx);
+			auto now = clock::now();
+			if (int n = link->read(1 - side, receive_buffer, now, &first_due, &last_due))
+				return {receive_buffer.data(), size_t(n)};
+			if (now >= deadline)
+				return {};
+			// the peer can write at any time, so do not sleep longer than a few character times
+			auto next = std::min({link->next_due(1 - side), deadline, now + std::chrono::microseconds(200)});
+			std::this_thread::sleep_until(next);
+		}
+	}
+	void write_bytes(std::span<const uint8_t> data) { link->write(side, data); }
+};
+
+/**
+ * Server end of a loopback link, answers the requests for reg. poll() has to be called
+ * regularly, or pump is set as on_idle of the client io to serve from the client thread.
+ * For rtu the frame parser is reset after 3.5 character times of silence like a real device,
+ * so the server recovers from dropped bytes.
+ */
+template<typename Register, typename IO>
+struct loopback_server {
+	using clock = std::chrono::steady_clock;
+	Register &reg;
+	IO io{};
+	clock::time_point _last_byte{};
+
+	void poll() {
+		std::span<uint8_t> data = io.read_bytes(std::chrono::milliseconds(0));
+		if (data.empty())
+			return;
+		if constexpr (IO::TRANSPORT_TYPE == transport_t::RTU) {
+			const loopback_config &c = io.link->stats(1 - io.side).config;
+			auto t35 = std::chrono::nanoseconds(c.baud ? uint64_t(c.bits_per_char) * 3500000000 / c.baud: 0);
+			if (c.baud && io.first_due - _last_byte > t35)
+				reg.switch_to_request();
+		}
+		_last_byte = io.last_due;
+		for (uint8_t b: data) {
+			result_err r = IO::TRANSPORT_TYPE == transport_t::RTU ? reg.process_rtu(b): reg.process_tcp(b);
+			if (r.err == IN_PROGRESS)
+				continue;
+			if (r.err == OK) {
+				r = reg.get_frame_response();
+				if (r.err != OK)
+					r = reg.get_frame_error_response(r.err);
+				if (r.err == OK && r.res.size())
+					io.write_bytes(r.res);
+			}
+			reg.switch_to_request();
+		}
+	}
+	static void pump(void *self) { static_cast<loopback_server*>(self)->poll(); }
+};
+
+}
+
@@ -0,0 +1,393 @@
+#pragma once
+
+#include "modbus-actor.h"
+
+namespace libmodbus_static {
+
+constexpr std::string_view MIRROR_FULL{"MIRROR_FULL"};
+
+// copies a register/bit range between two storages of the same layout
+template<typename Layout>
+constexpr void copy_register_range(Layout &dst, const Layout &src, register_t type, uint16_t offset, uint16_t count) {
+	auto copy_halfs = [&]<typename R>(R &d, const R &s) {
+		std::memcpy(get_start_addr(d, offset), get_start_addr(const_cast<R&>(s), offset), count * 2);
+	};
+	auto copy_bits = [&]<typename R>(R &d, const R &s) {
+		uint8_t *dp = reinterpret_cast<uint8_t*>(&d);
+		const uint8_t *sp = reinterpret_cast<const uint8_t*>(&s);
+		for (int bit: std::ranges::iota_view{int(offset) - R::OFFSET, int(offset) - R::OFFSET + count}) {
+			uint8_t mask = 1 << (bit % 8);
+			dp[bit / 8] = (dp[bit / 8] & ~mask) | (sp[bit / 8] & mask);
+		}
+	};
+	switch (type) {
+	case register_t::BITS:        if constexpr (HasBits<Layout>) copy_bits(dst.bits_registers, src.bits_registers); break;
+	case register_t::BITS_WRITE:  if constexpr (HasWriteBits<Layout>) copy_bits(dst.bits_write_registers, src.bits_write_registers); break;
+	case register_t::HALFS:       if constexpr (HasHalfs<Layout>) copy_halfs(dst.halfs_registers, src.halfs_registers); break;
+	case register_t::HALFS_WRITE: if constexpr (HasWriteHalfs<Layout>) copy_halfs(dst.halfs_write_registers, src.halfs_write_registers); break;
+	default: break;
+	}
+}
+
+// checks if a register/bit range lies within the layout
+template<typename Layout>
+constexpr result is_range_covered(register_t type, uint32_t offset, uint32_t count) {
+	switch (type) {
+	case register_t::BITS:        if constexpr (HasBits<Layout>) return is_bit_covered<decltype(Layout::bits_registers)>(offset, count); break;
+	case register_t::BITS_WRITE:  if constexpr (HasWriteBits<Layout>) return is_bit_covered<decltype(Layout::bits_write_registers)>(offset, count); break;
+	case register_t::HALFS:       if constexpr (HasHalfs<Layout>) return is_register_covered<decltype(Layout::halfs_registers)>(offset, count); break;
+	case register_t::HALFS_WRITE: if constexpr (HasWriteHalfs<Layout>) return is_register_covered<decltype(Layout::halfs_write_registers)>(offset, count); break;
+	default: break;
+	}
+	return REGISTER_NOT_FULLY_COVERED;
+}
+
+/**
+ * Caching proxy which answers tcp requests for a (slow) device from a local image.
+ *
+ * The image is split into blocks (eg. the requests of a poll_plan) with a max age each. A read
+ * is answered directly if all blocks it touches are younger than their max age, else the stale
+ * blocks are refreshed from the device via the actor and the read is answered afterwards.
+ * Reads of ranges not covered by any block and all writes are forwarded to the device, a write
+ * is answered and applied to the image once the device confirmed it. Broadcast writes are
+ * forwarded as broadcasts and never answered, the requests after them wait in poll() until the
+ * turnaround delay of the actor is over. Exceptions of the device are passed on, forwards and
+ * refreshes without response are answered with GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND.
+ *
+ * The mirror is a handler for tcp_linux_server, delayed responses are delivered via
+ * on_response (see modbus_gateway). poll() has to be called regularly. Usage:
+ *
+ * static modbus_actor<layout, rtu_io> device{role_t::CLIENT, layout{}, rtu_io{...}};
+ * static modbus_mirror<decltype(device)> mirror{.actor = device, .unit = 1};
+ * static const auto measurements = make_poll_plan<layout>(poll_plan_config{}, &halfs_layout::w, &halfs_layout::va);
+ * mirror.add_blocks(measurements, ms(500));
+ * static tcp_linux_server<decltype(mirror)> server{.handler = mirror};
+ */
+template<typename Actor, int MAX_BLOCKS = 16, int MAX_PENDING = 16>
+struct modbus_mirror {
+	using clock = std::chrono::steady_clock;
+	using Layout = decltype(Actor::storage);
+	struct block {
+		poll_request range{};
+		ms max_age{};
+		clock::time_point updated{};
+		bool valid{};
+		bool wanted{};
+		request_handle refresh{};
+		result last_result{OK};
+	};
+	struct pending_request {
+		uint64_t connection{};
+		std::array<uint8_t, TCP_ADU_SIZE> adu{};
+		uint16_t size{};
+		poll_request range{};
+		bool write{};
+		bool forward{};
+		bool broadcast{};
+		bool sent{};	// broadcasts are not answered, they are done once sent
+		request_handle h{};
+	};
+
+	Actor &actor;
+	uint8_t unit{1};
+	ms timeout{ADAPTIVE_TIMEOUT};
+	// called for every response adu which was not returned by process_tcp_adu
+	void (*on_response)(void *ctx, uint64_t connection, std::span<const uint8_t> adu){};
+	void *on_response_ctx{};
+
+	modbus_register<Layout> image{.addr = unit};
+	std::array<block, MAX_BLOCKS> blocks{};
+	int block_count{};
+	std::array<pending_request, MAX_PENDING> _pending{};
+	int _pending_count{};
+	std::array<uint8_t, 9> _exception_adu{};
+
+	result add_block(register_t type, uint16_t offset, uint16_t count, ms max_age) {
+		if (block_count == MAX_BLOCKS)
+			return MIRROR_FULL;
+		if (result r = is_range_covered<Layout>(type, offset, count); r != OK)
+			return r;
+		blocks[block_count++] = block{.range = {type, offset, count}, .max_age = max_age};
+		return OK;
+	}
+	template<int N>
+	result add_blocks(const poll_plan<N> &plan, ms max_age) {
+		for (const poll_request &r: plan)
+			if (result res = add_block(r.type, r.offset, r.count, max_age); res != OK)
+				return res;
+		return OK;
+	}
+
+	// answers a request from the image or queues it until the image is fresh
+	result_err process_tcp_adu(std::span<const uint8_t> adu, uint64_t connection = 0) {
+		image.addr = unit;
+		if (adu.size() > 7 && _is_write(function_code(adu[7])))
+			return _process_write(adu, connection);
+		result_err r = image.process_tcp_adu(adu);
+		if (r.err != OK || r.res.empty() || r.res[7] & 0x80)
+			return r;
+		poll_request range = _request_range();
+		if (_covered(range) && !_request_refresh(range, clock::now()))
+			return r;
+		// the response is created again once the image is fresh
+		if (_pending_count == MAX_PENDING)
+			return {_exception(adu, exception_code::SLAVE_DEVICE_BUSY), MIRROR_FULL};
+		pending_request &p = _pending[_pending_count++];
+		p = pending_request{.connection = connection, .size = uint16_t(adu.size()), .range = range, .forward = !_covered(range)};
+		std::ranges::copy(adu, p.adu.begin());
+		_submit(p);
+		return {};
+	}
+
+	// polls the actor and answers the pending requests which are done. All responses are
+	// copied from the actor storage before writes stage their values there again
+	result poll(ms max_wait = ms(0)) {
+		if (actor.in_flight_count())
+			actor.poll(max_wait);
+		auto now = clock::now();
+		for (block &b: blocks | std::views::take(block_count)) {
+			if (!b.refresh.valid())
+				continue;
+			result r = actor.take(b.refresh);
+			if (r == IN_PROGRESS)
+				continue;
+			b.refresh = {};
+			b.wanted = false;
+			b.last_result = r;
+			if (r == OK) {
+				copy_register_range(image.storage, actor.storage, b.range.type, b.range.offset, b.range.count);
+				b.updated = now;
+				b.valid = true;
+			}
+		}
+		for (int i = 0; i < _pending_count;) {
+			if (_finish(_pending[i])) {
+				_pending[i] = _pending[--_pending_count];
+				continue;
+			}
+			++i;
+		}
+		_submit_blocks();
+		for (pending_request &p: _pending | std::views::take(_pending_count))
+			_submit(p);
+		return OK;
+	}
+
+	// ---------------------------------------------------------------------------------------
+	// Internal functions
+	// ---------------------------------------------------------------------------------------
+	// the write is only parsed and checked, the values reach the image once the device confirmed
+	// them. Invalid writes are answered by the image, which rejects them unchanged
+	result_err _process_write(std::span<const uint8_t> adu, uint64_t connection) {
+		result r = _parse(adu);
+		if (r == WRONG_ADDR)
+			return {};
+		bool broadcast = r == OK && image.lc.addr == BROADCAST_ADDR;
+		poll_request range = _request_range();
+		if (r != OK || _stage_write(range, nullptr) != OK)
+			return broadcast ? result_err{}: image.process_tcp_adu(adu);
+		if (_pending_count == MAX_PENDING)
+			return {broadcast ? std::span<uint8_t>{}: _exception(adu, exception_code::SLAVE_DEVICE_BUSY), MIRROR_FULL};
+		pending_request &p = _pending[_pending_count++];
+		p = pending_request{.connection = connection, .size = uint16_t(adu.size()), .range = range, .write = true,
+			.forward = !broadcast, .broadcast = broadcast};
+		std::ranges::copy(adu, p.adu.begin());
+		_submit(p);
+		if (broadcast && _finish(p))
+			--_pending_count;
+		return {};
+	}
+	// parses a request adu into the image without answering it
+	result _parse(std::span<const uint8_t> adu) {
+		image.switch_to_request();
+		result_err r{.err = IN_PROGRESS};
+		for (auto b = adu.begin(); b != adu.end() && r.err == IN_PROGRESS; ++b)
+			r = image.process_tcp(*b);
+		return r.err;
+	}
+	// stages the values of the write request of p in the actor storage. This is done right
+	// before the frame is built, so neither refreshes nor queued writes overwrite them
+	result _stage_pending_write(const pending_request &p) {
+		if (result r = _parse({p.adu.data(), p.size}); r != OK)
+			return r;
+		return _stage_write(p.range, &actor.storage);
+	}
+	// copies the values of the write request parsed by the image into dst, a null dst only
+	// checks them
+	result _stage_write(const poll_request &range, Layout *dst) {
+		if (result r = is_range_covered<Layout>(range.type, range.offset, range.count); r != OK)
+			return r;
+		uint16_t value = to_hb_first(image.lc.i2);
+		uint8_t *byte_count = image.buffer().byte_count();
+		switch (image.lc.fc) {
+		case function_code::WRITE_SINGLE_COIL:
+			if constexpr (HasWriteBits<Layout>) {
+				if (value != 0xff00 && value != 0x0000)
+					return INVALID_DATA_VALUE;
+				if (!dst)
+					break;
+				int bit = range.offset - decltype(dst->bits_write_registers)::OFFSET;
+				uint8_t *data = reinterpret_cast<uint8_t*>(&dst->bits_write_registers);
+				data[bit / 8] = value ? data[bit / 8] | (1 << (bit % 8)): data[bit / 8] & ~(1 << (bit % 8));
+			}
+			break;
+		case function_code::WRITE_SINGLE_REGISTER:
+			if constexpr (HasWriteHalfs<Layout>) {
+				if (!dst)
+					break;
+				uint8_t *start_addr = get_start_addr(dst->halfs_write_registers, range.offset);
+				start_addr[0] = h_byte(value);
+				start_addr[1] = l_byte(value);
+			}
+			break;
+		case function_code::WRITE_MULTIPLE_COILS:
+			if constexpr (HasWriteBits<Layout>) {
+				if (!byte_count || *byte_count != (range.count + 7) / 8)
+					return INVALID_DATA_VALUE;
+				if (dst)
+					write_bits_to_storage(dst->bits_write_registers, range.offset, range.count, byte_count + 1);
+			}
+			break;
+		case function_code::WRITE_MULTIPLE_REGISTERS:
+			if constexpr (HasWriteHalfs<Layout>) {
+				if (!byte_count || *byte_count != range.count * 2)
+					return INVALID_DATA_VALUE;
+				if (dst)
+					std::copy_n(byte_count + 1, range.count * 2, get_start_addr(dst->halfs_write_registers, range.offset));
+			}
+			break;
+		default: return INVALID_DATA_VALUE;
+		}
+		return OK;
+	}
+	constexpr static bool _is_write(function_code fc) {
+		return fc == function_code::WRITE_SINGLE_COIL || fc == function_code::WRITE_SINGLE_REGISTER ||
+			fc == function_code::WRITE_MULTIPLE_COILS || fc == function_code::WRITE_MULTIPLE_REGISTERS;
+	}
+	poll_request _request_range() const {
+		uint16_t offset = (l_byte(image.lc.i1) << 8) | h_byte(image.lc.i1);
+		uint16_t count = (l_byte(image.lc.i2) << 8) | h_byte(image.lc.i2);
+		switch (image.lc.fc) {
+		case function_code::READ_COILS: return {register_t::BITS, offset, count};
+		case function_code::READ_DISCRETE_INPUTS: return {register_t::BITS_WRITE, offset, count};
+		case function_code::READ_HOLDING_REGISTERS: return {register_t::HALFS, offset, count};
+		case function_code::READ_INPUT_REGISTERS: return {register_t::HALFS_WRITE, offset, count};
+		case function_code::WRITE_SINGLE_COIL: return {register_t::BITS_WRITE, offset, 1};
+		case function_code::WRITE_SINGLE_REGISTER: return {register_t::HALFS_WRITE, offset, 1};
+		case function_code::WRITE_MULTIPLE_COILS: return {register_t::BITS_WRITE, offset, count};
+		case function_code::WRITE_MULTIPLE_REGISTERS: return {register_t::HALFS_WRITE, offset, count};
+		default: return {};
+		}
+	}
+	constexpr static bool _overlaps(const poll_request &a, const poll_request &b) {
+		return a.type == b.type && a.offset < b.end() && b.offset < a.end();
+	}
+	// true if the range is completely covered by blocks
+	bool _covered(const poll_request &range) const {
+		for (uint32_t pos = range.offset; pos < range.end();) {
+			auto b = std::ranges::find_if(blocks | std::views::take(block_count), [&](const block &b) {
+				return b.range.type == range.type && b.range.offset <= pos && pos < b.range.end(); });
+			if (b == blocks.begin() + block_count)
+				return false;
+			pos = b->range.end();
+		}
+		return true;
+	}
+	// marks all stale blocks overlapping the range for refresh, true if any block is refreshed
+	bool _request_refresh(const poll_request &range, clock::time_point now) {
+		for (block &b: blocks | std::views::take(block_count)) {
+			if (_overlaps(b.range, range) && (!b.valid || now - b.updated >= b.max_age))
+				b.wanted = true;
+		}
+		_submit_blocks();
+		return _refreshing(range);
+	}
+	bool _refreshing(const poll_request &range) const {
+		return std::ranges::any_of(blocks | std::views::take(block_count), [&](const block &b) {
+			return b.wanted && _overlaps(b.range, range); });
+	}
+	void _submit_blocks() {
+		for (block &b: blocks | std::views::take(block_count)) {
+			if (!b.wanted || b.refresh.valid())
+				continue;
+			b.refresh = actor.submit_read(unit, b.range.type, b.range.offset, b.range.count, timeout);
+			if (b.refresh.valid() || b.refresh.err == IN_FLIGHT_FULL)
+				continue;
+			b.wanted = false;
+			b.last_result = b.refresh.err;
+		}
+	}
+	void _submit(pending_request &p) {
+		const poll_request &r = p.range;
+		if (p.broadcast && !p.sent) {
+			// an rtu actor sends the broadcast once no request is in flight
+			result res = _stage_pending_write(p);
+			p.sent = res != OK || actor.submit_broadcast(r.type, r.offset, r.count) != IN_FLIGHT_FULL;
+		}
+		if (!p.forward || p.h.valid() || p.h.err != OK)
+			return;
+		if (!p.write)
+			p.h = actor.submit_read(unit, r.type, r.offset, r.count, timeout);
+		else if (result res = _stage_pending_write(p); res != OK)
+			p.h = {.err = res};
+		else
+			p.h = actor.submit_write(unit, r.type, r.offset, r.count, timeout);
+	}
+	// answers the pending request if it is done, true if it was answered
+	bool _finish(pending_request &p) {
+		std::span<const uint8_t> adu{p.adu.data(), p.size};
+		result state{OK};
+		if (p.broadcast) {
+			if (!p.sent)
+				return false;
+			_invalidate(p.range);
+			return true;
+		}
+		if (p.forward) {
+			// requests which could not be submitted yet are submitted again at the end of poll()
+			if (p.h.err == IN_FLIGHT_FULL)
+				p.h = {};
+			if (!p.h.valid() && p.h.err == OK)
+				return false;
+			state = actor.take(p.h);
+			if (state == IN_PROGRESS)
+				return false;
+			// a confirmed write is applied to the image by answering it below
+			if (state == OK && !p.write)
+				copy_register_range(image.storage, actor.storage, p.range.type, p.range.offset, p.range.count);
+			if (p.write)
+				_invalidate(p.range);
+		} else {
+			if (_refreshing(p.range))
+				return false;
+			for (const block &b: blocks | std::views::take(block_count))
+				if (_overlaps(b.range, p.range) && b.last_result != OK)
+					state = b.last_result;
+		}
+		if (state != OK) {
+			exception_code ec = result_exception(state);
+			_respond(p.connection, _exception(adu, ec != exception_code::NONE ? ec: exception_code::GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND));
+			return true;
+		}
+		auto [res, err] = image.process_tcp_adu(adu);
+		_respond(p.connection, res);
+		return true;
+	}
+	// a write changes the blocks it touches, they are read again on the next access
+	void _invalidate(const poll_request &range) {
+		for (block &b: blocks | std::views::take(block_count))
+			if (_overlaps(b.range, range))
+				b.valid = false;
+	}
+	void _respond(uint64_t connection, std::span<const uint8_t> adu) {
+		if (on_response && !adu.empty())
+			on_response(on_response_ctx, connection, adu);
+	}
+	std::span<uint8_t> _exception(std::span<const uint8_t> adu, exception_code ec) {
+		_exception_adu = {adu[0], adu[1], 0, 0, 0, 3, adu[6], uint8_t(adu[7] | 0x80), uint8_t(ec)};
+		return _exception_adu;
+	}
+};
+
+}
+
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "modbus-register.h"
+
+namespace libmodbus_static {
+
+constexpr std::string_view UNIT_IN_USE{"UNIT_IN_USE"};
+constexpr std::string_view INVALID_UNIT{"INVALID_UNIT"};
+
+/** Register image of a unit of a modbus_multi_server, the frame is the one of the server */
+template<typename Layout, int MAX_SIZE = TCP_ADU_SIZE, typename Trace = no_trace>
+using unit_register = modbus_register<Layout, MAX_SIZE, Trace, shared_frame<MAX_SIZE>>;
+
+/**
+ * Server for many unit ids (eg. the simulation of a whole rtu bus), the units can have
+ * different layouts.
+ *
+ * Every frame is parsed once into the frame of the server. As soon as the unit id is parsed
+ * the parsing continues in the unit_register of that id, found via a 256 entry table, so
+ * the response is created by the register of the unit without any copy. Frames for unknown
+ * unit ids are parsed to their end and ignored, broadcasts are applied to all units.
+ *
+ * The server has the process/response interface of modbus_register, so it can be used with
+ * tcp_linux_server, loopback_server or a byte loop over a serial port. Usage:
+ *
+ * static modbus_multi_server<> plant{};
+ * static std::array<unit_register<meter_layout>, 200> meters{};
+ * static unit_register<inverter_layout> inverter{};
+ * for (int i: std::ranges::iota_view{0, 200})
+ *	plant.add_unit(i + 1, meters[i]);
+ * plant.add_unit(247, inverter);
+ * static tcp_linux_server<decltype(plant)> server{.handler = plant};
+ */
+template<int MAX_SIZE = TCP_ADU_SIZE>
+struct modbus_multi_server {
+	struct no_registers {};
+	using parser_t = unit_register<no_registers, MAX_SIZE>;
+	// type erased functions of a unit_register
+	struct unit_ops {
+		result_err (*process)(void *reg, uint8_t b, bool tcp);
+		result_err (*response)(void *reg);
+		result_err (*error_response)(void *reg, result err);
+		void (*apply_write)(void *reg, function_code fc, uint16_t offset, uint16_t count);
+	};
+	struct unit_entry {
+		void *reg{};
+		const unit_ops *ops{};
+	};
+	template<typename Reg>
+	static constexpr unit_ops OPS{
+		.process = [](void *r, uint8_t b, bool tcp) { return tcp ? static_cast<Reg*>(r)->process_tcp(b): static_cast<Reg*>(r)->process_rtu(b); },
+		.response = [](void *r) { return static_cast<Reg*>(r)->get_frame_response(); },
+		.error_response = [](void *r, result err) { return static_cast<Reg*>(r)->get_frame_error_response(err); },
+		.apply_write = [](void *r, function_code fc, uint16_t offset, uint16_t count) {
+			static_cast<Reg*>(r)->lc.fc = fc;
+			static_cast<Reg*>(r)->_apply_write(offset, count);
+		},
+	};
+
+	modbus_frame<MAX_SIZE> frame{};
+	// parses the mbap header and frames of unknown units, only accepts broadcasts
+	parser_t _parser{.addr = BROADCAST_ADDR, .frame_storage = {&frame}};
+	std::array<unit_entry, 256> units{};
+	std::array<uint8_t, 256> _unit_ids{};
+	int unit_count{};
+	unit_entry _current{&_parser, &OPS<parser_t>};
+
+	template<typename Layout, typename Trace>
+	result add_unit(uint8_t unit, unit_register<Layout, MAX_SIZE, Trace> &reg) {
+		if (unit == BROADCAST_ADDR)
+			return INVALID_UNIT;
+		if (units[unit].reg)
+			return UNIT_IN_USE;
+		reg.addr = unit;
+		reg.role = role_t::SERVER;
+		reg.frame_storage.frame = &frame;
+		units[unit] = unit_entry{&reg, &OPS<unit_register<Layout, MAX_SIZE, Trace>>};
+		_unit_ids[unit_count++] = unit;
+		return OK;
+	}
+	void remove_unit(uint8_t unit) {
+		if (!units[unit].reg)
+			return;
+		units[unit] = {};
+		auto id = std::ranges::find(_unit_ids | std::views::take(unit_count), unit);
+		*id = _unit_ids[--unit_count];
+		switch_to_request();
+	}
+
+	constexpr void switch_to_request() {
+		_parser.switch_to_request();
+		_current = unit_entry{&_parser, &OPS<parser_t>};
+	}
+	constexpr result_err process_rtu(uint8_t b) { return _process(b, false); }
+	constexpr result_err process_tcp(uint8_t b) { return _process(b, true); }
+	constexpr result_err get_frame_response() {
+		if (frame.cur_state != modbus_frame<MAX_SIZE>::state::FINAL)
+			return {.err = "FRAME_NOT_DONE"};
+		if (_current.reg != &_parser)
+			return _current.ops->response(_current.reg);
+		// only unit 0 is completed by the parser, on a serial line it is a broadcast which is
+		// written to every unit, on tcp no unit 0 exists
+		const auto &lc = _parser.lc;
+		if (lc.transport != transport_t::RTU) {
+			switch_to_request();
+			return {};
+		}
+		uint16_t offset = (l_byte(lc.i1) << 8) | h_byte(lc.i1);
+		uint16_t count = (l_byte(lc.i2) << 8) | h_byte(lc.i2);
+		for (uint8_t unit: _unit_ids | std::views::take(unit_count))
+			units[unit].ops->apply_write(units[unit].reg, lc.fc, offset, count);
+		switch_to_request();
+		return {};
+	}
+	constexpr result_err get_frame_error_response(result err) {
+		return _current.ops->error_response(_current.reg, err);
+	}
+	// see modbus_register::process_tcp_adu
+	constexpr result_err process_tcp_adu(std::span<const uint8_t> adu) {
+		switch_to_request();
+		result_err r{.err = IN_PROGRESS};
+		for (auto b = adu.begin(); b != adu.end() && r.err == IN_PROGRESS; ++b)
+			r = process_tcp(*b);
+		if (r.err == WRONG_ADDR)
+			return {};
+		if (r.err == IN_PROGRESS) {
+			frame.clear();
+			return {.err = "INCOMPLETE_FRAME"};
+		}
+		if (r.err != OK)
+			return r;
+		r = get_frame_response();
+		if (r.err != OK)
+			r = get_frame_error_response(r.err);
+		return r;
+	}
+
+	constexpr result_err _process(uint8_t b, bool tcp) {
+		using state = typename modbus_frame<MAX_SIZE>::state;
+		if (frame.frame_data.empty())
+			_current = unit_entry{&_parser, &OPS<parser_t>};
+		// the unit id is the first byte of an rtu frame and follows the mbap header for tcp
+		bool is_unit = frame.cur_state == (tcp ? state::WRITE_ADDR: state::WRITE_ADDR_START_MBAP);
+		if (is_unit && units[b].reg)
+			_current = units[b];
+		return _current.ops->process(_current.reg, b, tcp);
+	}
+};
+
+}
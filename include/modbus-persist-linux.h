@@ -0,0 +1,176 @@
+#pragma once
+
+#include "modbus-register.h"
+#include <chrono>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace libmodbus_static {
+
+constexpr std::string_view PERSIST_OPEN_FAILED{"PERSIST_OPEN_FAILED"};
+constexpr std::string_view PERSIST_MAP_FAILED{"PERSIST_MAP_FAILED"};
+constexpr std::string_view PERSIST_SYNC_FAILED{"PERSIST_SYNC_FAILED"};
+
+/**
+ * Storage sync policy which keeps the write blocks (bits_write_registers and
+ * halfs_write_registers) of a register in a memory mapped file, so setpoints written by the
+ * master survive a restart of the server.
+ *
+ * After a storage change which changed the write blocks they are copied into the mapping,
+ * which only touches the page cache. The disk is written in the background by the kernel, at
+ * most every sync_interval an asynchronous msync is started, so the hot path never blocks on
+ * disk. Changes within sync_interval of the last sync stay dirty until sync_if_due(), which
+ * the server loop calls. flush() syncs synchronously (eg. on shutdown), close() flushes
+ * pending changes.
+ *
+ * open() restores the write blocks from the file if its header matches the layout
+ * (see layout_hash), else the file is initialized with the current storage. Usage:
+ *
+ * static persistent_register<layout> reg{.addr = 1};
+ * reg.storage_sync.open("/var/lib/plant/setpoints.bin", reg.storage);
+ * static tcp_linux_server<persistent_register<layout>> server{.handler = reg};
+ * while (running) {
+ *	server.poll(ms(100));
+ *	reg.storage_sync.sync_if_due();
+ * }
+ */
+template<typename Layout>
+requires HasWriteBits<Layout> || HasWriteHalfs<Layout>
+struct mmap_persistence {
+	using clock = std::chrono::steady_clock;
+	struct file_header {
+		constexpr static uint64_t MAGIC{0x5453495342444d4c};	// "LMDBSIST"
+		constexpr static uint32_t VERSION{1};
+		uint64_t magic{};
+		uint32_t version{VERSION};
+		uint32_t size{};
+		uint64_t layout_hash{};
+	};
+	constexpr static size_t BITS_SIZE{[]{ if constexpr (HasWriteBits<Layout>) return sizeof(Layout::bits_write_registers); else return 0; }()};
+	constexpr static size_t HALFS_SIZE{[]{ if constexpr (HasWriteHalfs<Layout>) return sizeof(Layout::halfs_write_registers); else return 0; }()};
+	constexpr static size_t SIZE{sizeof(file_header) + BITS_SIZE + HALFS_SIZE};
+
+	Layout *storage{};
+	file_header *header{};
+	int fd{-1};
+	// true if open() restored the write blocks from the file
+	bool restored{};
+	bool dirty{};
+	int _depth{};
+	std::chrono::milliseconds sync_interval{1000};
+	clock::time_point _last_sync{};
+	uint32_t syncs{};
+
+	void begin_write() { ++_depth; }
+	void end_write() {
+		if (--_depth || !header)
+			return;
+		// changes of the other blocks are not persisted
+		if (_changed(*storage, _image())) {
+			_store(*storage, _image());
+			dirty = true;
+		}
+		sync_if_due();
+	}
+	// starts the write back of pending changes if sync_interval passed since the last sync
+	void sync_if_due(clock::time_point now = clock::now()) {
+		if (!dirty || !header || now - _last_sync < sync_interval)
+			return;
+		// only schedules the write back, does not wait for the disk
+		msync(header, SIZE, MS_ASYNC);
+		_last_sync = now;
+		dirty = false;
+		++syncs;
+	}
+
+	result open(const char *path, Layout &s) {
+		close();
+		fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+		if (fd < 0)
+			return PERSIST_OPEN_FAILED;
+		struct stat st{};
+		bool valid_size = fstat(fd, &st) == 0 && size_t(st.st_size) == SIZE;
+		if (!valid_size && ftruncate(fd, SIZE) != 0) {
+			close();
+			return PERSIST_MAP_FAILED;
+		}
+		void *map = mmap(nullptr, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			close();
+			return PERSIST_MAP_FAILED;
+		}
+		header = static_cast<file_header*>(map);
+		storage = &s;
+		restored = valid_size && header->magic == file_header::MAGIC && header->version == file_header::VERSION &&
+			header->size == SIZE && header->layout_hash == layout_hash<Layout>();
+		if (restored)
+			_load(_image(), s);
+		else
+			_init(s);
+		_last_sync = clock::now();
+		return OK;
+	}
+	// writes the pending changes to disk and waits for it
+	result flush() {
+		if (!header)
+			return OK;
+		if (msync(header, SIZE, MS_SYNC) != 0)
+			return PERSIST_SYNC_FAILED;
+		_last_sync = clock::now();
+		dirty = false;
+		++syncs;
+		return OK;
+	}
+	void close() {
+		if (header) {
+			flush();
+			munmap(header, SIZE);
+		}
+		if (fd >= 0)
+			::close(fd);
+		header = {};
+		storage = {};
+		fd = -1;
+	}
+
+	uint8_t* _image() { return reinterpret_cast<uint8_t*>(header + 1); }
+	// a new file is written completely before the magic marks it valid
+	void _init(const Layout &s) {
+		header->magic = 0;
+		msync(header, SIZE, MS_SYNC);
+		*header = file_header{.size = SIZE, .layout_hash = layout_hash<Layout>()};
+		_store(s, _image());
+		msync(header, SIZE, MS_SYNC);
+		header->magic = file_header::MAGIC;
+		msync(header, SIZE, MS_SYNC);
+	}
+	static bool _changed(const Layout &s, const uint8_t *image) {
+		bool changed{};
+		if constexpr (HasWriteBits<Layout>)
+			changed |= std::memcmp(image, &s.bits_write_registers, BITS_SIZE) != 0;
+		if constexpr (HasWriteHalfs<Layout>)
+			changed |= std::memcmp(image + BITS_SIZE, &s.halfs_write_registers, HALFS_SIZE) != 0;
+		return changed;
+	}
+	static void _store(const Layout &s, uint8_t *dst) {
+		if constexpr (HasWriteBits<Layout>)
+			std::memcpy(dst, &s.bits_write_registers, BITS_SIZE);
+		if constexpr (HasWriteHalfs<Layout>)
+			std::memcpy(dst + BITS_SIZE, &s.halfs_write_registers, HALFS_SIZE);
+	}
+	static void _load(const uint8_t *src, Layout &s) {
+		if constexpr (HasWriteBits<Layout>)
+			std::memcpy(&s.bits_write_registers, src, BITS_SIZE);
+		if constexpr (HasWriteHalfs<Layout>)
+			std::memcpy(&s.halfs_write_registers, src + BITS_SIZE, HALFS_SIZE);
+	}
+};
+
+template<typename Layout>
+using persistent_register = modbus_register<Layout, TCP_ADU_SIZE, no_trace, owned_frame<TCP_ADU_SIZE>, mmap_persistence<Layout>>;
+
+}
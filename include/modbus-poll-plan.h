@@ -0,0 +1,119 @@
+#pragma once
+
+#include "modbus-register.h"
+
+namespace libmodbus_static {
+
+constexpr uint16_t MAX_READ_REGISTERS{125};
+constexpr uint16_t MAX_READ_BITS{2000};
+constexpr uint16_t MAX_WRITE_REGISTERS{123};
+constexpr uint16_t MAX_WRITE_BITS{1968};
+
+/** Single read request of a poll plan, offset and count in registers (halfs) or bits */
+struct poll_request {
+	register_t type{};
+	uint16_t offset{};
+	uint16_t count{};
+	constexpr uint32_t end() const { return uint32_t(offset) + count; }
+	constexpr bool operator==(const poll_request &o) const = default;
+};
+
+/**
+ * Merge settings for make_poll_plan. Fields which are at most max_*_gap registers/bits apart
+ * are read with a single request (the gap is read as well), a request never gets larger
+ * than max_registers/max_bits.
+ */
+struct poll_plan_config {
+	uint16_t max_register_gap{8};
+	uint16_t max_bit_gap{64};
+	uint16_t max_registers{MAX_READ_REGISTERS};
+	uint16_t max_bits{MAX_READ_BITS};
+};
+
+/** Fixed size list of read requests, created by make_poll_plan and run by modbus_actor::read_remote */
+template<int N>
+struct poll_plan {
+	std::array<poll_request, N> requests{};
+	int count{};
+
+	constexpr int size() const { return count; }
+	constexpr const poll_request& operator[](int i) const { return requests[i]; }
+	constexpr auto begin() const { return requests.begin(); }
+	constexpr auto end() const { return requests.begin() + count; }
+};
+
+// upper bound of requests a single plan item can result in
+template<typename Layout, typename Item>
+constexpr int poll_item_capacity() {
+	if constexpr (IsBitsRegisters<Layout, Item>)
+		return sizeof(Item) * 8;
+	else
+		return (sizeof(MemberType<Layout, Item>) + 1) / 2;
+}
+
+// appends the register/bit ranges of a single plan item
+template<typename Layout, typename Item>
+void add_poll_item(std::span<poll_request> ranges, int &count, const Item &item) {
+	if constexpr (IsBitsRegisters<Layout, Item>) {
+		std::span<const uint8_t> bytes = to_byte_span(item);
+		for (int bit: std::ranges::iota_view{0, int(bytes.size() * 8)}) {
+			if (bytes[bit / 8] & (1 << (bit % 8)))
+				ranges[count++] = {type_to_register<Layout, Item>(), uint16_t(Item::OFFSET + bit), 1};
+		}
+	} else {
+		// member offsets are no constant expressions, they are taken from a probe instance
+		static Layout probe{};
+		auto &reg = register_ref<Layout, Item>(probe);
+		uint32_t start_str = reinterpret_cast<uint8_t*>(&(reg.*item)) - reinterpret_cast<uint8_t*>(&reg);
+		ranges[count++] = {type_to_register<Layout, Item>(), uint16_t(start_str / 2 + OFFSET<Layout, Item>()),
+			uint16_t((sizeof(reg.*item) + 1) / 2)};
+	}
+}
+
+/**
+ * Creates the minimal list of FC01/FC02/FC03/FC04 requests which read all given items.
+ * Items are member pointers of the halfs layouts or bit masks of the bits layouts (every
+ * set bit is a field to read). Usage:
+ *
+ * static const auto plan = make_poll_plan<layout>(poll_plan_config{}, &halfs_layout::a, &halfs_layout::c,
+ *	bits_layout{.enabled = true, .visible = true});
+ * actor.read_remote(1, plan);
+ */
+template<typename Layout, typename... Items>
+requires (sizeof...(Items) > 0) && ((IsValidRegister<Layout, Items> || IsBitsRegisters<Layout, Items>) && ...)
+poll_plan<(poll_item_capacity<Layout, Items>() + ... + 0)> make_poll_plan(const poll_plan_config &config, const Items&... items) {
+	constexpr int N = (poll_item_capacity<Layout, Items>() + ... + 0);
+	std::array<poll_request, N> ranges{};
+	int range_count{};
+	(add_poll_item<Layout>(ranges, range_count, items), ...);
+	std::ranges::sort(ranges.begin(), ranges.begin() + range_count, [](const poll_request &a, const poll_request &b) {
+		return a.type != b.type ? a.type < b.type: a.offset < b.offset;
+	});
+
+	poll_plan<N> plan{};
+	auto is_bits = [](register_t t) { return t == register_t::BITS || t == register_t::BITS_WRITE; };
+	auto push = [&](poll_request r) {
+		uint16_t limit = std::max<uint16_t>(is_bits(r.type) ? config.max_bits: config.max_registers, 1);
+		for (; r.count > limit; r.offset += limit, r.count -= limit)
+			plan.requests[plan.count++] = {r.type, r.offset, limit};
+		plan.requests[plan.count++] = r;
+	};
+	poll_request cur = ranges[0];
+	for (const poll_request &next: ranges | std::views::take(range_count) | std::views::drop(1)) {
+		uint32_t gap = is_bits(cur.type) ? config.max_bit_gap: config.max_register_gap;
+		uint32_t limit = is_bits(cur.type) ? config.max_bits: config.max_registers;
+		uint32_t end = std::max(cur.end(), next.end());
+		if (cur.type == next.type && next.offset <= cur.end() + gap && end - cur.offset <= limit) {
+			cur.count = end - cur.offset;
+			continue;
+		}
+		push(cur);
+		cur = next;
+	}
+	if (range_count)
+		push(cur);
+	return plan;
+}
+
+}
+
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "modbus-actor.h"
+#include <thread>
+
+namespace libmodbus_static {
+
+constexpr std::string_view SCHEDULER_FULL{"SCHEDULER_FULL"};
+
+/** Timing statistics of a poll group, jitter is the delay between release and first request */
+struct poll_group_stats {
+	using us = std::chrono::microseconds;
+	uint32_t cycles{};	// completed cycles
+	uint32_t skipped{};	// releases dropped because the previous cycle was still running
+	uint32_t late{};	// cycles completed after their deadline
+	uint32_t errors{};	// cycles with at least one failed request
+	us jitter_min{us::max()};
+	us jitter_max{};
+	us jitter_sum{};
+	result last_result{OK};
+
+	constexpr us jitter_mean() const { return cycles ? jitter_sum / cycles: us{}; }
+};
+
+/**
+ * Fixed capacity multi rate poll scheduler for a modbus_actor.
+ *
+ * Every group reads a poll_plan from a unit with a period (ms(0) reads the group only once)
+ * and a relative deadline (ms(0) uses the period). Requests are dispatched earliest deadline
+ * first one request at a time, so a long running slow group can not starve a fast group by
+ * more than a single request. As long as requests are pending the actor is kept filled up to
+ * its MAX_IN_FLIGHT limit. A group released while its previous cycle is still running skips
+ * that release instead of queueing up.
+ *
+ * The plans are referenced, not copied, they have to outlive the scheduler. Usage:
+ *
+ * static const auto power = make_poll_plan<layout>(poll_plan_config{}, &halfs_layout::w, &halfs_layout::va);
+ * static const auto name = make_poll_plan<layout>(poll_plan_config{}, &halfs_layout::name);
+ * poll_scheduler sched{actor};
+ * sched.add_group(1, power, ms(100));
+ * sched.add_group(1, name, ms(0));
+ * while (true)
+ *	sched.poll(ms(10));
+ */
+template<typename Actor, int MAX_GROUPS = 16, int MAX_PENDING = 64>
+struct poll_scheduler {
+	using clock = std::chrono::steady_clock;
+	struct group {
+		uint8_t unit{};
+		std::span<const poll_request> requests{};
+		ms period{};
+		ms deadline{};
+		clock::time_point next_release{};
+		clock::time_point release{};
+		clock::time_point due{};
+		int next_request{};
+		int outstanding{};
+		bool running{};
+		bool active{};
+		result cycle_result{OK};
+		poll_group_stats stats{};
+	};
+	struct pending {
+		request_handle h{};
+		int group{};
+	};
+
+	Actor &actor;
+	std::array<group, MAX_GROUPS> groups{};
+	int group_count{};
+	std::array<pending, MAX_PENDING> _pending{};
+	int _pending_count{};
+	// called after every completed cycle of a group
+	void (*on_cycle)(void *ctx, int group, result r){};
+	void *on_cycle_ctx{};
+
+	// adds a group which is released the first time on the next poll, returns its index in id
+	template<int N>
+	result add_group(uint8_t unit, const poll_plan<N> &plan, ms period, ms deadline = ms(0), int *id = nullptr) {
+		if (group_count == MAX_GROUPS)
+			return SCHEDULER_FULL;
+		groups[group_count] = group{
+			.unit = unit,
+			.requests = {plan.begin(), plan.end()},
+			.period = period,
+			.deadline = deadline,
+			.next_release = clock::now(),
+			.active = true,
+		};
+		if (id)
+			*id = group_count;
+		++group_count;
+		return OK;
+	}
+	// stops releasing a group, a running cycle is finished
+	void remove_group(int id) { groups[id].active = false; }
+	// true while any group is released or waiting for its next release
+	constexpr bool busy() const {
+		return std::ranges::any_of(groups | std::views::take(group_count), [](const group &g){ return g.active || g.running; });
+	}
+
+	// releases due groups, dispatches requests and waits at most max_wait for responses
+	// (less if a group is released earlier)
+	result poll(ms max_wait = ms(0)) {
+		_release(clock::now());
+		_dispatch(clock::now());
+		ms wait = std::clamp(std::chrono::duration_cast<ms>(_next_release() - clock::now()), ms(0), max_wait);
+		if (_pending_count)
+			actor.poll(wait);
+		else if (wait > ms(0))
+			std::this_thread::sleep_for(wait);
+		_collect(clock::now());
+		_release(clock::now());
+		_dispatch(clock::now());
+		return OK;
+	}
+
+	// ---------------------------------------------------------------------------------------
+	// Internal scheduling functions
+	// ---------------------------------------------------------------------------------------
+	clock::time_point _next_release() const {
+		clock::time_point next{clock::time_point::max()};
+		for (const group &g: groups | std::views::take(group_count)) {
+			if (g.active && !g.running)
+				next = std::min(next, g.next_release);
+		}
+		return next;
+	}
+	void _release(clock::time_point now) {
+		for (group &g: groups | std::views::take(group_count)) {
+			if (!g.active || now < g.next_release)
+				continue;
+			if (g.running) {
+				// previous cycle still running, drop the releases in between
+				for (; g.next_release <= now; g.next_release += g.period)
+					++g.stats.skipped;
+				continue;
+			}
+			g.release = g.next_release;
+			g.due = g.deadline > ms(0) ? g.release + g.deadline:
+				g.period > ms(0) ? g.release + g.period: clock::time_point::max();
+			g.next_request = 0;
+			g.outstanding = 0;
+			g.cycle_result = OK;
+			g.running = true;
+			if (g.period == ms(0)) {
+				g.active = false;
+				continue;
+			}
+			for (g.next_release += g.period; g.next_release <= now; g.next_release += g.period)
+				++g.stats.skipped;
+		}
+	}
+	void _dispatch(clock::time_point now) {
+		while (_pending_count < MAX_PENDING) {
+			group *next{};
+			for (group &g: groups | std::views::take(group_count)) {
+				if (g.running && g.next_request < int(g.requests.size()) && (!next || g.due < next->due))
+					next = &g;
+			}
+			if (!next)
+				return;
+			const poll_request &r = next->requests[next->next_request];
+			// units with open circuit breaker fail directly and do not block the others
+			request_handle h = actor.submit_read(next->unit, r.type, r.offset, r.count);
+			if (h.err == IN_FLIGHT_FULL)
+				return;
+			if (next->next_request++ == 0)
+				_record_jitter(*next, now);
+			if (!h.valid()) {
+				next->cycle_result = h.err;
+				_finish(*next, now);
+				continue;
+			}
+			++next->outstanding;
+			_pending[_pending_count++] = pending{h, int(next - groups.data())};
+		}
+	}
+	void _collect(clock::time_point now) {
+		for (int i = 0; i < _pending_count;) {
+			result r = actor.take(_pending[i].h);
+			if (r == IN_PROGRESS) {
+				++i;
+				continue;
+			}
+			group &g = groups[_pending[i].group];
+			_pending[i] = _pending[--_pending_count];
+			--g.outstanding;
+			if (r != OK && g.cycle_result == OK)
+				g.cycle_result = r;
+			_finish(g, now);
+		}
+	}
+	void _record_jitter(group &g, clock::time_point now) {
+		auto jitter = std::chrono::duration_cast<poll_group_stats::us>(now - g.release);
+		g.stats.jitter_min = std::min(g.stats.jitter_min, jitter);
+		g.stats.jitter_max = std::max(g.stats.jitter_max, jitter);
+		g.stats.jitter_sum += jitter;
+	}
+	// completes the cycle of a group once all its requests are done
+	void _finish(group &g, clock::time_point now) {
+		// the remaining requests of a failed cycle are dropped
+		if (g.cycle_result != OK)
+			g.next_request = g.requests.size();
+		if (g.next_request < int(g.requests.size()) || g.outstanding)
+			return;
+		g.running = false;
+		++g.stats.cycles;
+		if (now > g.due)
+			++g.stats.late;
+		if (g.cycle_result != OK)
+			++g.stats.errors;
+		g.stats.last_result = g.cycle_result;
+		if (on_cycle)
+			on_cycle(on_cycle_ctx, int(&g - groups.data()), g.cycle_result);
+	}
+};
+
+}
+
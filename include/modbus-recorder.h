@@ -0,0 +1,288 @@
+#pragma once
+
+#include "modbus-register.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace libmodbus_static {
+
+constexpr std::string_view RECORDER_OPEN_FAILED{"RECORDER_OPEN_FAILED"};
+constexpr std::string_view RECORDER_WRITE_FAILED{"RECORDER_WRITE_FAILED"};
+constexpr std::string_view RECORDING_INVALID{"RECORDING_INVALID"};
+constexpr std::string_view RECORDING_LAYOUT_MISMATCH{"RECORDING_LAYOUT_MISMATCH"};
+
+/** File format of a poll_recorder: a recording_header followed by records */
+struct recording_header {
+	constexpr static uint64_t MAGIC{0x31304345524d4c}; // "LMREC01"
+	constexpr static uint32_t VERSION{1};
+	uint64_t magic{MAGIC};
+	uint32_t version{VERSION};
+	uint32_t record_header_size{};
+	uint64_t layout_hash{};
+};
+// a record is this header followed by size bytes of register data as sent on the wire
+struct record_header {
+	int64_t time_ns{};	// system clock
+	uint8_t unit{};
+	function_code fc{};
+	uint16_t offset{};	// first register/bit
+	uint16_t count{};	// number of registers/bits
+	uint16_t size{};
+};
+
+/**
+ * Binary recorder of the read responses of an actor. The raw register data of every
+ * response (the bytes copied into the storage) is appended with a timestamp to a
+ * preallocated ring and written to a file in large sequential writes, which is much
+ * cheaper than formatting the values. The file is turned into typed values offline with a
+ * recording_reader.
+ *
+ * record() and flush() may run in different threads (single producer, single consumer).
+ * By default record() flushes itself once flush_size bytes are buffered, set inline_flush to
+ * false if another thread calls flush(). Records which do not fit into the ring are
+ * dropped and counted. All memory is part of the object. Usage:
+ *
+ * static poll_recorder recorder{};
+ * recorder.open<meter_layout>("/var/log/plant/meters.bin");
+ * actor.recorder = &recorder;
+ */
+struct poll_recorder {
+	constexpr static int RING_SIZE{1 << 20};
+
+	std::array<uint8_t, RING_SIZE> ring{};
+	std::atomic<uint64_t> _head{};
+	std::atomic<uint64_t> _tail{};
+	std::FILE *file{};
+	size_t flush_size{RING_SIZE / 16};
+	bool inline_flush{true};
+	uint64_t records{};
+	uint64_t dropped{};
+
+	poll_recorder() = default;
+	poll_recorder(const poll_recorder&) = delete;
+	poll_recorder& operator=(const poll_recorder&) = delete;
+	~poll_recorder() { close(); }
+
+	template<typename Layout>
+	result open(const char *path) {
+		close();
+		file = std::fopen(path, "wb");
+		if (!file)
+			return RECORDER_OPEN_FAILED;
+		// the ring is the buffer
+		std::setvbuf(file, nullptr, _IONBF, 0);
+		recording_header h{.record_header_size = sizeof(record_header), .layout_hash = layout_hash<Layout>()};
+		if (std::fwrite(&h, sizeof(h), 1, file) != 1) {
+			close();
+			return RECORDER_WRITE_FAILED;
+		}
+		return OK;
+	}
+	bool record(uint8_t unit, function_code fc, uint16_t offset, uint16_t count, std::span<const uint8_t> data) {
+		uint64_t head = _head.load(std::memory_order_relaxed);
+		size_t size = sizeof(record_header) + data.size();
+		if (RING_SIZE - (head - _tail.load(std::memory_order_acquire)) < size) {
+			++dropped;
+			return false;
+		}
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		record_header h{
+			.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+			.unit = unit,
+			.fc = fc,
+			.offset = offset,
+			.count = count,
+			.size = uint16_t(data.size()),
+		};
+		_copy_in(head, reinterpret_cast<const uint8_t*>(&h), sizeof(h));
+		_copy_in(head + sizeof(h), data.data(), data.size());
+		_head.store(head + size, std::memory_order_release);
+		++records;
+		if (inline_flush && buffered() >= flush_size)
+			flush();
+		return true;
+	}
+	size_t buffered() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+	// writes all buffered records to the file
+	result flush() {
+		uint64_t tail = _tail.load(std::memory_order_relaxed);
+		uint64_t head = _head.load(std::memory_order_acquire);
+		while (file && tail != head) {
+			size_t offset = tail % RING_SIZE;
+			size_t n = std::min<size_t>(head - tail, RING_SIZE - offset);
+			if (std::fwrite(ring.data() + offset, 1, n, file) != n)
+				return RECORDER_WRITE_FAILED;
+			tail += n;
+			_tail.store(tail, std::memory_order_release);
+		}
+		return OK;
+	}
+	void close() {
+		if (!file)
+			return;
+		flush();
+		std::fclose(file);
+		file = {};
+	}
+
+	void _copy_in(uint64_t pos, const uint8_t *src, size_t size) {
+		size_t offset = pos % RING_SIZE;
+		size_t first = std::min<size_t>(size, RING_SIZE - offset);
+		std::memcpy(ring.data() + offset, src, first);
+		std::memcpy(ring.data(), src + first, size - first);
+	}
+};
+
+/**
+ * Offline decoder of a poll_recorder file. The records are applied in order to a register
+ * image per unit, so the typed values of the layout can be read after every record.
+ * Usage:
+ *
+ * recording_reader<meter_layout> reader{};
+ * reader.open("/var/log/plant/meters.bin");
+ * for (auto &s: reader.column(&meter_layout::halfs_layout::power))
+ *	std::println("{} {} {}", s.time, s.unit, s.value);
+ */
+template<typename Layout>
+struct recording_reader {
+	struct record {
+		std::chrono::system_clock::time_point time{};
+		uint8_t unit{};
+		function_code fc{};
+		uint16_t offset{};
+		uint16_t count{};
+		std::span<const uint8_t> data{};
+	};
+	template<typename T>
+	struct sample {
+		std::chrono::system_clock::time_point time{};
+		uint8_t unit{};
+		T value{};
+	};
+
+	std::vector<uint8_t> content{};
+	// true if the file ends with an incomplete record (eg. the recorder was killed)
+	bool truncated{};
+
+	result open(const char *path) {
+		content.clear();
+		std::FILE *f = std::fopen(path, "rb");
+		if (!f)
+			return RECORDER_OPEN_FAILED;
+		std::array<uint8_t, 1 << 16> chunk{};
+		for (size_t n; (n = std::fread(chunk.data(), 1, chunk.size(), f)) > 0;)
+			content.insert(content.end(), chunk.begin(), chunk.begin() + n);
+		std::fclose(f);
+		recording_header h{};
+		if (content.size() < sizeof(h))
+			return RECORDING_INVALID;
+		std::memcpy(&h, content.data(), sizeof(h));
+		if (h.magic != recording_header::MAGIC || h.version != recording_header::VERSION ||
+			h.record_header_size != sizeof(record_header))
+			return RECORDING_INVALID;
+		if (h.layout_hash != layout_hash<Layout>())
+			return RECORDING_LAYOUT_MISMATCH;
+		return OK;
+	}
+
+	// calls f(const record&, const Layout &image) for every record, image is the register
+	// image of the unit after the record was applied
+	template<typename F>
+	void for_each(F &&f) {
+		std::vector<Layout> images(256);
+		truncated = false;
+		for (size_t pos = sizeof(recording_header); pos < content.size();) {
+			record_header h{};
+			if (content.size() - pos < sizeof(h)) {
+				truncated = true;
+				return;
+			}
+			std::memcpy(&h, content.data() + pos, sizeof(h));
+			pos += sizeof(h);
+			if (content.size() - pos < h.size) {
+				truncated = true;
+				return;
+			}
+			record r{
+				.time = std::chrono::system_clock::time_point{std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(h.time_ns))},
+				.unit = h.unit,
+				.fc = h.fc,
+				.offset = h.offset,
+				.count = h.count,
+				.data = {content.data() + pos, h.size},
+			};
+			pos += h.size;
+			if (_apply(images[r.unit], r) == OK)
+				f(r, std::as_const(images[r.unit]));
+		}
+	}
+	// values of a register member after every record which contained it, a member split over
+	// two records of a chunked read is taken after the second
+	template<typename Mem, typename MemT = MemberType<Layout, Mem>>
+	requires IsValidRegister<Layout, Mem>
+	std::vector<sample<MemT>> column(Mem mem) {
+		Layout l{};
+		auto &reg = register_ref<Layout, Mem>(l);
+		uint32_t start = (reinterpret_cast<uint8_t*>(&(reg.*mem)) - reinterpret_cast<uint8_t*>(&reg)) / sizeof(uint16_t) + OFFSET<Layout, Mem>();
+		uint32_t end = start + sizeof(reg.*mem) / sizeof(uint16_t);
+		function_code fc = type_to_register<Layout, Mem>() == register_t::HALFS ?
+			function_code::READ_HOLDING_REGISTERS: function_code::READ_INPUT_REGISTERS;
+		std::vector<sample<MemT>> res;
+		std::vector<field_coverage> coverage(256);
+		for_each([&](const record &r, const Layout &image) {
+			if (r.fc != fc || !coverage[r.unit].complete(start, end - start, r.offset, r.count))
+				return;
+			MemT value{};
+			swap_byte_order<MemT>{}(register_ref<Layout, Mem>(const_cast<Layout&>(image)).*mem, value);
+			res.push_back({.time = r.time, .unit = r.unit, .value = value});
+		});
+		return res;
+	}
+
+	// same storage mapping as the client response handling of modbus_register
+	static result _apply(Layout &l, const record &r) {
+		uint8_t *data = const_cast<uint8_t*>(r.data.data());
+		switch (r.fc) {
+		case function_code::READ_COILS:
+			if constexpr (HasBits<Layout>) {
+				if (is_bit_covered<decltype(l.bits_registers)>(r.offset, r.count) != OK || r.data.size() != (r.count + 7u) / 8)
+					return RECORDING_INVALID;
+				write_bits_to_storage(l.bits_registers, r.offset, r.count, data);
+				return OK;
+			}
+			break;
+		case function_code::READ_DISCRETE_INPUTS:
+			if constexpr (HasWriteBits<Layout>) {
+				if (is_bit_covered<decltype(l.bits_write_registers)>(r.offset, r.count) != OK || r.data.size() != (r.count + 7u) / 8)
+					return RECORDING_INVALID;
+				write_bits_to_storage(l.bits_write_registers, r.offset, r.count, data);
+				return OK;
+			}
+			break;
+		case function_code::READ_HOLDING_REGISTERS:
+			if constexpr (HasHalfs<Layout>) {
+				if (is_register_covered<decltype(l.halfs_registers)>(r.offset, r.count) != OK || r.data.size() != r.count * 2u)
+					return RECORDING_INVALID;
+				std::copy_n(data, r.data.size(), get_start_addr(l.halfs_registers, r.offset));
+				return OK;
+			}
+			break;
+		case function_code::READ_INPUT_REGISTERS:
+			if constexpr (HasWriteHalfs<Layout>) {
+				if (is_register_covered<decltype(l.halfs_write_registers)>(r.offset, r.count) != OK || r.data.size() != r.count * 2u)
+					return RECORDING_INVALID;
+				std::copy_n(data, r.data.size(), get_start_addr(l.halfs_write_registers, r.offset));
+				return OK;
+			}
+			break;
+		default: break;
+		}
+		return RECORDING_INVALID;
+	}
+};
+
+}
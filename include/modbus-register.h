@@ -1,16 +1,14 @@
 #pragma once
 
 #include "common.h"
+#include "modbus-trace.h"
 #include <cstring>
+#include <algorithm>
 #include <array>
 #include <ranges>
 #include <cstdint>
 #include <bit>
 
-//TODO: remove
-#include <iostream>
-#include <bitset>
-
 namespace libmodbus_static {
 
 constexpr std::string_view IN_PROGRESS{"IN_PROGRESS"};
@@ -18,6 +16,35 @@ constexpr std::string_view INVALID_RESPONSE{"RESPONSE_FROM_SERVER_INVALID"};
 constexpr std::string_view WRONG_ADDR{"WRONG_ADDR"};
 constexpr std::string_view REGISTER_NOT_FULLY_COVERED{"REGISTER_NOT_FULLY_COVERED"};
 constexpr std::string_view BITS_NOT_FULLY_COVERED{"BITS_NOT_FULLY_COVERED"};
+constexpr std::string_view ILLEGAL_FUNCTION_CODE{"ILLEGAL_FUNCTION_CODE"};
+constexpr std::string_view INVALID_DATA_VALUE{"INVALID_DATA_VALUE"};
+// results of exception responses received by a client, indexed by the exception code
+constexpr std::array<std::string_view, 12> EXCEPTION_RESULTS{
+	"EXCEPTION_NONE", "EXCEPTION_ILLEGAL_FUNCTION", "EXCEPTION_ILLEGAL_DATA_ADDRESS", "EXCEPTION_ILLEGAL_DATA_VALUE",
+	"EXCEPTION_SLAVE_DEVICE_FAILURE", "EXCEPTION_ACKNOWLEDGE", "EXCEPTION_SLAVE_DEVICE_BUSY",
+	"EXCEPTION_NEGATIVE_ACKNOWLEDGMENT", "EXCEPTION_MEMORY_PARITY_ERROR", "EXCEPTION_UNKNOWN",
+	"EXCEPTION_GATEWAY_PATH_UNAVAILABLE", "EXCEPTION_GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND",
+};
+constexpr std::string_view exception_result(exception_code ec) {
+	return uint8_t(ec) < EXCEPTION_RESULTS.size() ? EXCEPTION_RESULTS[uint8_t(ec)]: EXCEPTION_RESULTS[9];
+}
+// exception code of an exception response result, NONE for all other results
+constexpr exception_code result_exception(std::string_view r) {
+	auto e = std::ranges::find(EXCEPTION_RESULTS, r);
+	if (e == EXCEPTION_RESULTS.begin() || e == EXCEPTION_RESULTS.end() || *e == EXCEPTION_RESULTS[9])
+		return exception_code::NONE;
+	return exception_code(e - EXCEPTION_RESULTS.begin());
+}
+
+// unit address of broadcast requests, they are applied by every server and never answered
+constexpr uint8_t BROADCAST_ADDR{0};
+
+// a server answers requests for its addr (and applies broadcasts), a client sends requests
+// and validates the responses against them
+enum struct role_t: uint8_t {
+	SERVER = 0,
+	CLIENT = 1,
+};
 
 template<int N>
 using mod_string = std::array<char, N>;
@@ -96,9 +123,9 @@ constexpr static void read_bits_from_storage(T &bits, int reg_offset, int reg_co
 	uint8_t *data = reinterpret_cast<uint8_t*>(&bits);
 	int start_bit = reg_offset - std::decay_t<decltype(bits)>::OFFSET;
 	for (int cur_bit = start_bit; cur_bit < (start_bit + reg_count); cur_bit += 8) {
-		uint8_t i = cur_bit / 8;
-		uint8_t r = cur_bit % 8;
-		uint8_t s = reg_count - (cur_bit - start_bit);
+		int i = cur_bit / 8;
+		int r = cur_bit % 8;
+		int s = reg_count - (cur_bit - start_bit);
 		uint8_t t = s < 8 ? ((1 << s) - 1): 0xff;
 		uint8_t byte = (data[i] >> r) & t;
 		if (r && s > r)
@@ -240,14 +267,119 @@ constexpr R& get_register_ref(L &l) { return l.bits_registers; }
 template<typename L, typename R> requires requires (L l, R r) {l.bits_write_registers = r;}
 constexpr R& get_register_ref(L &l) { return l.bits_write_registers; }
 
-template<typename Layout, int MAX_SIZE = 256>
+constexpr uint64_t _fnv1a(uint64_t v, uint64_t h) {
+	for (int i: std::ranges::iota_view{0, 8})
+		h = (h ^ ((v >> (i * 8)) & 0xff)) * 0x100000001b3;
+	return h;
+}
+template<typename Block>
+constexpr uint64_t _block_hash(uint64_t h) {
+	return _fnv1a(sizeof(Block), _fnv1a(Block::OFFSET, h));
+}
+
+/**
+ * Structural hash of a register layout: size and alignment of the layout, offset and size
+ * of its register blocks and Layout::VERSION if it has one. Shared or persisted images of
+ * a changed layout are then rejected (see modbus-shm-linux.h, modbus-persist-linux.h).
+ * Renamed or reordered members of the same size are not detected, bump VERSION for those.
+ */
+template<typename Layout>
+constexpr uint64_t layout_hash() {
+	uint64_t h = _fnv1a(alignof(Layout), _fnv1a(sizeof(Layout), 0xcbf29ce484222325));
+	if constexpr (requires { Layout::VERSION; })
+		h = _fnv1a(uint64_t(Layout::VERSION), h);
+	if constexpr (HasBits<Layout>)
+		h = _block_hash<decltype(Layout::bits_registers)>(_fnv1a(1, h));
+	if constexpr (HasWriteBits<Layout>)
+		h = _block_hash<decltype(Layout::bits_write_registers)>(_fnv1a(2, h));
+	if constexpr (HasHalfs<Layout>)
+		h = _block_hash<decltype(Layout::halfs_registers)>(_fnv1a(3, h));
+	if constexpr (HasWriteHalfs<Layout>)
+		h = _block_hash<decltype(Layout::halfs_write_registers)>(_fnv1a(4, h));
+	return h;
+}
+
+/**
+ * Storage sync policies of modbus_register, begin_write/end_write enclose every change of
+ * the storage done by the register (write(), applied write requests, read responses).
+ * no_storage_sync costs nothing, shm_seqlock (modbus-shm-linux.h) lets other processes
+ * read the storage consistently.
+ */
+template<typename S>
+concept IsStorageSync = requires(S s) {
+	{ s.begin_write() };
+	{ s.end_write() };
+};
+
+struct no_storage_sync {
+	constexpr void begin_write() {}
+	constexpr void end_write() {}
+};
+
+// encloses the storage changes of a scope in begin_write/end_write
+template<typename S>
+struct storage_write_section {
+	S &sync;
+	constexpr storage_write_section(S &sync): sync{sync} { sync.begin_write(); }
+	constexpr ~storage_write_section() { sync.end_write(); }
+};
+
+/**
+ * Response split into the frame header and the register data which stays in the storage,
+ * see modbus_register::get_frame_response_iov. err is the result of the request processing
+ */
+struct response_iov {
+	std::span<const uint8_t> header{};
+	std::span<const uint8_t> payload{};
+	result err{OK};
+};
+
+/** Register/bit range of a request, offset and count are modbus register/bit addresses */
+struct register_range {
+	register_t type{};
+	uint32_t offset{};
+	uint32_t count{};
+};
+
+/**
+ * Part of a multi register field received by consecutive read responses. Oversized reads are
+ * split into requests of at most 125 registers (see modbus_actor::_transfer) which can cut
+ * through a field, the field is complete once its remaining registers follow directly.
+ */
+struct field_coverage {
+	uint32_t received{};
+
+	// true if the response [offset, offset + count) completes the field [addr, addr + size)
+	constexpr bool complete(uint32_t addr, uint32_t size, uint32_t offset, uint32_t count) {
+		if (offset >= addr + size || offset + count <= addr)
+			return false;
+		if (offset > addr && offset != addr + received) {
+			received = 0;
+			return false;
+		}
+		received = std::min(size, offset + count - addr);
+		if (received < size)
+			return false;
+		received = 0;
+		return true;
+	}
+};
+
+// the default frame fits a full tcp adu, so a register can answer the largest reads over tcp and rtu
+template<typename Layout, int MAX_SIZE = TCP_ADU_SIZE, typename Trace = no_trace, typename FrameStorage = owned_frame<MAX_SIZE>,
+	typename StorageSync = no_storage_sync>
+requires IsTracePolicy<Trace> && IsFrameStorage<FrameStorage, MAX_SIZE> && IsStorageSync<StorageSync>
 struct modbus_register {
 	template<int slot = 0>
 	static modbus_register& Default(uint8_t address) { static modbus_register r{.addr = address}; return r; }
+	template<int slot = 0>
+	static modbus_register& DefaultClient() { static modbus_register r{.role = role_t::CLIENT}; return r; }
 
 	uint8_t addr{};
+	role_t role{role_t::SERVER};
 	Layout storage{};
-	modbus_frame<MAX_SIZE> buffer{};
+	// frame of the register or a frame shared with other registers, see owned_frame/shared_frame
+	FrameStorage frame_storage{};
 	struct last_completed{
 		transport_t transport{};
 		uint16_t tcp_tid{};
@@ -257,19 +389,26 @@ struct modbus_register {
 		uint16_t i2{};
 		uint16_t crc{};
 		constexpr bool operator==(const last_completed &o) const {
-			return addr == o.addr && fc == o.fc && i1 == o.i1 && i2 == o.i2 && crc == o.crc;
+			return tcp_tid == o.tcp_tid && addr == o.addr && fc == o.fc && i1 == o.i1 && i2 == o.i2 && crc == o.crc;
 		}
 		constexpr bool operator!=(const last_completed &o) const { return !(*this == o); }
 	} lc {};
+	// trace hooks, see modbus-trace.h
+	[[no_unique_address]] Trace trace{};
+	// guards the changes of storage, see IsStorageSync
+	[[no_unique_address]] StorageSync storage_sync{};
+
+	constexpr modbus_frame<MAX_SIZE>& buffer() { return frame_storage.get(); }
+	constexpr const modbus_frame<MAX_SIZE>& buffer() const { return frame_storage.get(); }
 	
 
 	constexpr void switch_to_request() {
-		buffer.clear(); 
-		buffer.set_type({.REQUEST = true});
+		buffer().clear(); 
+		buffer().set_type({.REQUEST = true});
 	}
 	constexpr void switch_to_response() { 
-		buffer.clear(); 
-		buffer.set_type({.RESPONSE = true});
+		buffer().clear(); 
+		buffer().set_type({.RESPONSE = true});
 	}
 
 	// Does all the magic
@@ -285,97 +424,104 @@ struct modbus_register {
 		return {.err = "NOT_YET_IMPLEMENTED"};
 	}
 	constexpr result_err process_tcp(uint8_t b) {
-		if (buffer.cur_state == modbus_frame<MAX_SIZE>::state::WRITE_ADDR_START_MBAP) {
-			if (buffer.frame_data.size() > int(sizeof(*buffer.tcp_header))) {
-				buffer.clear();
+		if (buffer().cur_state == modbus_frame<MAX_SIZE>::state::WRITE_ADDR_START_MBAP) {
+			if (buffer().frame_data.size() > int(sizeof(*buffer().tcp_header()))) {
+				buffer().clear();
 				return {.err = "FATAL_TOO_LARGE_SIZE_FOR_TCP_HEADER"};
 			}
-			if (!buffer.frame_data.push(b)) {
-				buffer.clear();
+			if (!buffer().frame_data.push(b)) {
+				buffer().clear();
 				return {.err = "ERR_WRITE_TCP_HEADER"};
 			}
 			// done with tcp header recieving
-			if (buffer.frame_data.size() == sizeof(*buffer.tcp_header)) {
-				buffer.transport = transport_t::TCP;
-				buffer.tcp_header = reinterpret_cast<modbus_frame<MAX_SIZE>::mbap_header*>(buffer.frame_data.begin());
-				uint16_t l = buffer.tcp_header->length;
-				buffer.tcp_header->length = (l_byte(l) << 8) | h_byte(l);
-				buffer.cur_state = modbus_frame<MAX_SIZE>::state::WRITE_ADDR;
+			if (buffer().frame_data.size() == sizeof(*buffer().tcp_header())) {
+				buffer().transport = transport_t::TCP;
+				uint16_t l = buffer().tcp_header()->length;
+				buffer().tcp_header()->length = (l_byte(l) << 8) | h_byte(l);
+				buffer().cur_state = modbus_frame<MAX_SIZE>::state::WRITE_ADDR;
 			}
 			return {.err = IN_PROGRESS};
 		}
-		if (!buffer.tcp_header) {
-			buffer.clear();
+		if (!buffer().tcp_header()) {
+			buffer().clear();
 			return {.err = "FATAL_MISSING_TCP_HEADER_IN_FRAME"};
 		}
-		if (buffer.frame_data.size() > int(buffer.tcp_header->length + sizeof(*buffer.tcp_header))) {
-			buffer.clear();
+		if (buffer().frame_data.size() > int(buffer().tcp_header()->length + sizeof(*buffer().tcp_header()))) {
+			buffer().clear();
 			return {.err = "FATAL_TCP_FRAME_LENGTH_FULL"};
 		}
 		return _process(b);
 	}
 
 	constexpr result start_rtu_frame(uint8_t addr) {
-		buffer.clear();
-		return buffer.write_addr(addr);
+		buffer().clear();
+		return buffer().write_addr(addr);
 	}
 	constexpr result start_ascii_frame(uint8_t addr) {
-		buffer.clear();
-		result r = buffer.write_ascii_start();
+		buffer().clear();
+		result r = buffer().write_ascii_start();
 		if (r != OK)
 			return r;
-		return buffer.write_addr(addr);
+		return buffer().write_addr(addr);
 	}
 	constexpr result start_tcp_frame(uint16_t trans, uint8_t addr) {
-		buffer.clear();
-		result r = buffer.write_mbap({.transaction_id = trans});
+		buffer().clear();
+		result r = buffer().write_mbap({.transaction_id = trans});
 		if (r != OK)
 			return r;
-		return buffer.write_addr(addr);
+		return buffer().write_addr(addr);
 	}
-	constexpr std::span<const uint8_t> get_current_frame() const { return buffer.frame_data.span();}
+	constexpr std::span<const uint8_t> get_current_frame() const { return buffer().frame_data.span();}
 
+	// register range from the start of member_a to the end of member_b
 	template<typename MemA, typename MemB>
 	requires IsValidRegister<Layout, MemA> && IsValidRegister<Layout, MemB>
-	constexpr result_err get_frame_read(MemA member_a, MemB member_b) {
-		auto reg = register_ref<Layout, MemA>(storage);
+	constexpr register_range member_range(MemA member_a, MemB member_b) {
+		auto &reg = register_ref<Layout, MemA>(storage);
 		uint32_t start_str = uintptr_t(reinterpret_cast<uint8_t*>(&(reg.*member_a)) - reinterpret_cast<uint8_t*>(&reg));
 		uint32_t end_str = uintptr_t(reinterpret_cast<uint8_t*>(&(reg.*member_b)) - reinterpret_cast<uint8_t*>(&reg)) + sizeof(reg.*member_b);
-		uint32_t start_reg = start_str / sizeof(uint16_t) + OFFSET<Layout, MemA>();
-		uint8_t *str_addr = reinterpret_cast<uint8_t*>(&reg);
-		register_t reg_type = type_to_register<Layout, MemA>();
-		return get_frame_read(reg_type, start_reg, (end_str - start_str) / sizeof(uint16_t));
+		return {type_to_register<Layout, MemA>(), uint32_t(start_str / sizeof(uint16_t) + OFFSET<Layout, MemA>()), uint32_t((end_str - start_str) / sizeof(uint16_t))};
 	}
-	template<typename Mem>
-	requires IsValidRegister<Layout, Mem>
-	constexpr result_err get_frame_read(Mem mem) { return get_frame_read<Mem, Mem>(mem, mem); };
-
+	// bit range from the first to the last bit set in mask
 	template<typename Reg>
 	requires IsBitsRegisters<Layout, Reg>
-	constexpr result_err get_frame_read(const Reg &mask) { 
+	constexpr result mask_range(const Reg &mask, register_range &range) {
 		std::span<const uint8_t> bytes = to_byte_span(mask);
 		if (1 != popcount(bytes) && 2 != popcount(bytes))
-			return {.err = "EXACTLY_1_OR_2_BIT_HAS_TO_BE_SET_IN_START_BIT"};
+			return "EXACTLY_1_OR_2_BIT_HAS_TO_BE_SET_IN_START_BIT";
 		uint32_t start_byte = std::ranges::find_if(bytes, [](uint8_t e){ return e != 0; }) - bytes.begin();
 		uint32_t end_byte{uint32_t(bytes.size()) - 1};
 		for (;end_byte >= 0 && bytes[end_byte] == 0; --end_byte);
 		uint32_t start_str = start_byte * 8 + std::countr_zero(bytes[start_byte]);
 		uint32_t end_str = end_byte * 8 + 8 - std::countl_zero(bytes[end_byte]);
-		uint32_t start_reg = start_str + Reg::OFFSET;
-		register_t reg_type = type_to_register<Layout, Reg>();
-		return get_frame_read(reg_type, start_reg, end_str - start_str);
+		range = {type_to_register<Layout, Reg>(), start_str + Reg::OFFSET, end_str - start_str};
+		return OK;
+	}
+
+	template<typename MemA, typename MemB>
+	requires IsValidRegister<Layout, MemA> && IsValidRegister<Layout, MemB>
+	constexpr result_err get_frame_read(MemA member_a, MemB member_b) {
+		register_range r = member_range(member_a, member_b);
+		return get_frame_read(r.type, r.offset, r.count);
+	}
+	template<typename Mem>
+	requires IsValidRegister<Layout, Mem>
+	constexpr result_err get_frame_read(Mem mem) { return get_frame_read<Mem, Mem>(mem, mem); };
+
+	template<typename Reg>
+	requires IsBitsRegisters<Layout, Reg>
+	constexpr result_err get_frame_read(const Reg &mask) { 
+		register_range r{};
+		if (result e = mask_range(mask, r); e != OK)
+			return {.err = e};
+		return get_frame_read(r.type, r.offset, r.count);
 	}
 
 	template<typename MemA, typename MemB>
 	requires IsValidRegister<Layout, MemA> && IsValidRegister<Layout, MemB>
 	constexpr result_err get_frame_write(MemA member_a, MemB member_b) {
-		auto reg = register_ref<Layout, MemA>(storage);
-		register_t type = type_to_register<Layout, MemA>();
-		uint32_t start_str = uintptr_t(reinterpret_cast<uint8_t*>(&(reg.*member_a)) - reinterpret_cast<uint8_t*>(&reg));
-		uint32_t end_str = uintptr_t(reinterpret_cast<uint8_t*>(&(reg.*member_b)) - reinterpret_cast<uint8_t*>(&reg)) + sizeof(reg.*member_b);
-		uint32_t start_reg = start_str / sizeof(uint16_t) + OFFSET<Layout, MemA>();
-		uint8_t *str_addr = reinterpret_cast<uint8_t*>(&reg);
-		return get_frame_write(type, start_reg, std::span<uint8_t>{str_addr + start_str, str_addr + end_str});
+		register_range r = member_range(member_a, member_b);
+		return get_frame_write(r.type, r.offset, r.count);
 	}
 
 	template<typename Mem>
@@ -385,181 +531,235 @@ struct modbus_register {
 	template<typename Reg>
 	requires IsBitsRegisters<Layout, Reg>
 	constexpr result_err get_frame_write(const Reg &mask) { 
-		std::span<const uint8_t> bytes = to_byte_span(mask);
-		if (1 != popcount(bytes) && 2 != popcount(bytes))
-			return {.err = "EXACTLY_1_OR_2_BIT_HAS_TO_BE_SET_IN_START_BIT"};
-		uint32_t start_byte = std::ranges::find_if(bytes, [](uint8_t e){ return e != 0; }) - bytes.begin();
-		uint32_t end_byte{uint32_t(bytes.size()) - 1};
-		for (;end_byte >= 0 && bytes[end_byte] == 0; --end_byte);
-		uint32_t start_str = start_byte * 8 + std::countr_zero(bytes[start_byte]);
-		uint32_t end_str = end_byte * 8 + 8 - std::countl_zero(bytes[end_byte]);
-		uint32_t start_reg = start_str + Reg::OFFSET;
-		register_t reg_type = type_to_register<Layout, Reg>();
-		auto reg = register_ref<Layout, Reg>(storage);
-		uint8_t *start_addr = reinterpret_cast<uint8_t*>(&reg);
-		return get_frame_write(reg_type, start_reg, std::span<uint8_t>{start_addr, sizeof(reg)}, start_str, end_str - start_str);
+		register_range r{};
+		if (result e = mask_range(mask, r); e != OK)
+			return {.err = e};
+		return get_frame_write(r.type, r.offset, r.count);
 	}
 
-	#define RES_ERR_ASSERT(cond, msg) if (cond != OK) {buffer.clear(); return {.err = msg};}
-	#define RES_FORWARD(stm) if (result r = stm; r != OK) {buffer.clear(); return {.err = r};}
-	#define RES_BOOL_ASSERT(cond, msg) if (!(cond)) {buffer.clear(); return {.err = msg};}
+	#define RES_ERR_ASSERT(cond, msg) if (cond != OK) {buffer().clear(); return {.err = msg};}
+	#define RES_FORWARD(stm) if (result r = stm; r != OK) {buffer().clear(); return {.err = r};}
+	#define RES_BOOL_ASSERT(cond, msg) if (!(cond)) {buffer().clear(); return {.err = msg};}
 	constexpr result_err get_frame_response() {
-		if (buffer.cur_state != modbus_frame<MAX_SIZE>::state::FINAL)
+		if (buffer().cur_state != modbus_frame<MAX_SIZE>::state::FINAL)
 			return {.err = "FRAME_NOT_DONE"};
 
 		// header information
 		uint16_t reg_offset = (l_byte(lc.i1) << 8) | h_byte(lc.i1);
 		uint16_t reg_count = (l_byte(lc.i2) << 8) | h_byte(lc.i2);
+		// write requests are applied before the request frame is overwritten by the response
+		RES_FORWARD(_apply_write(reg_offset, reg_count));
+		// broadcasts are never answered
+		if (_is_broadcast()) {
+			switch_to_request();
+			return {};
+		}
 		switch_to_response();
 		switch(lc.transport) {
-		case transport_t::ASCII: RES_FORWARD(buffer.write_ascii_start()); break;
-		case transport_t::TCP: RES_FORWARD(buffer.write_mbap({lc.tcp_tid})); break;
+		case transport_t::ASCII: RES_FORWARD(buffer().write_ascii_start()); break;
+		case transport_t::TCP: RES_FORWARD(buffer().write_mbap({lc.tcp_tid})); break;
 		default: break;
 		}
-		RES_FORWARD(buffer.write_addr(lc.addr));
-		RES_FORWARD(buffer.write_fc(lc.fc));
+		RES_FORWARD(buffer().write_addr(lc.addr));
+		RES_FORWARD(buffer().write_fc(lc.fc));
 
 		// data information
-		switch(function_code(*buffer.fc)) {
+		switch(function_code(*buffer().fc())) {
 		case function_code::READ_COILS:
 			if constexpr (!HasBits<Layout>) {
-				buffer.clear();
+				buffer().clear();
 				return {.err = "LAYOUT_HAS_NO_BITS"};
 			} else {
 				RES_FORWARD(is_bit_covered<decltype(storage.bits_registers)>(reg_offset, reg_count));
 				uint16_t n_bytes = (reg_count + 7) / 8;
-				RES_FORWARD(buffer.write_length(n_bytes));
-				uint8_t *dst = buffer.frame_data.end();
-				RES_FORWARD(buffer.write_data(std::span<uint8_t>((uint8_t*)nullptr, n_bytes)));
+				RES_FORWARD(buffer().write_length(n_bytes));
+				uint8_t *dst = buffer().frame_data.end();
+				RES_FORWARD(buffer().write_data(std::span<uint8_t>((uint8_t*)nullptr, n_bytes)));
 				read_bits_from_storage(storage.bits_registers, reg_offset, reg_count, dst);
 			}
 			break;
 		case function_code::READ_DISCRETE_INPUTS:
 			if constexpr (!HasWriteBits<Layout>) {
-				buffer.clear();
+				buffer().clear();
 				return {.err = "LAYOUT_HAS_NO_BITS"};
 			} else {
 				RES_FORWARD(is_bit_covered<decltype(storage.bits_write_registers)>(reg_offset, reg_count));
 				uint16_t n_bytes = (reg_count + 7) / 8;
-				RES_FORWARD(buffer.write_length(n_bytes));
-				uint8_t *dst = buffer.frame_data.end();
-				RES_FORWARD(buffer.write_data(std::span<uint8_t>((uint8_t*)nullptr, n_bytes)));
+				RES_FORWARD(buffer().write_length(n_bytes));
+				uint8_t *dst = buffer().frame_data.end();
+				RES_FORWARD(buffer().write_data(std::span<uint8_t>((uint8_t*)nullptr, n_bytes)));
 				read_bits_from_storage(storage.bits_write_registers, reg_offset, reg_count, dst);
 			}
 			break;
 		case function_code::READ_HOLDING_REGISTERS:
 			if constexpr (!HasHalfs<Layout>) {
-				buffer.clear();
+				buffer().clear();
 				return {.err = "LAYOUT_HAS_NO_HALFS"};
 			} else {
-				RES_FORWARD(is_bit_covered<decltype(storage.halfs_registers)>(reg_offset, reg_count));
-				RES_FORWARD(buffer.write_length(reg_count * 2));
+				RES_FORWARD(is_register_covered<decltype(storage.halfs_registers)>(reg_offset, reg_count));
+				RES_FORWARD(buffer().write_length(reg_count * 2));
 				uint8_t *start_addr = get_start_addr(storage.halfs_registers, reg_offset);
-				RES_FORWARD(buffer.write_data(std::span<uint8_t>{start_addr, reg_count * 2u}));
+				RES_FORWARD(buffer().write_data(std::span<uint8_t>{start_addr, reg_count * 2u}));
 			}
 			break;
 		case function_code::READ_INPUT_REGISTERS:
 			if constexpr (!HasWriteHalfs<Layout>) {
-				buffer.clear();
+				buffer().clear();
 				return {.err = "LAYOUT_HAS_NO_WRITE_HALFS"};
 			} else {
 				RES_FORWARD(is_register_covered<decltype(storage.halfs_write_registers)>(reg_offset, reg_count));
-				RES_FORWARD(buffer.write_length(reg_count * 2));
+				RES_FORWARD(buffer().write_length(reg_count * 2));
 				uint8_t *start_addr = get_start_addr(storage.halfs_write_registers, reg_offset);
-				RES_FORWARD(buffer.write_data(std::span<uint8_t>{start_addr, reg_count * 2u}));
+				RES_FORWARD(buffer().write_data(std::span<uint8_t>{start_addr, reg_count * 2u}));
 			}
 			break;
 		case function_code::WRITE_SINGLE_COIL:
-			if constexpr (!HasWriteBits<Layout>) {
-				buffer.clear();
-				return {.err = "LAYOUT_HAS_NO_WRITE_HALFS"};
-			} else {
-				RES_FORWARD(is_bit_covered<decltype(storage.bits_write_registers)>(reg_offset, 1));
-				RES_BOOL_ASSERT(buffer.data, "MISSING_DATA_IN_FRAME");
-				int bit = reg_offset - decltype(storage.bits_write_registers)::OFFSET;
-				bool bit_on{};
-				switch ((*buffer.data << 8) | (*(buffer.data + 1))) {
-					case 0xff00: bit_on = true; break;
-					case 0x0000: bit_on = true; break;
-					default: buffer.clear(); return {.err = "INVALID_COIL_WRITE_DATA"};
-				}
-				uint8_t *data = reinterpret_cast<uint8_t*>(&storage.bits_write_registers);
-				if (bit_on)
-					data[bit / 8] |= 1 << (bit % 8);
-				else
-					data[bit / 8] &= ~(1 << (bit % 8));
-			}
-			break;
 		case function_code::WRITE_SINGLE_REGISTER:
-			if constexpr (!HasWriteHalfs<Layout>) {
-				buffer.clear();
-				return {.err = "LAYOUT_HAS_NO_WRITE_HALFS"};
-			} else {
-				RES_FORWARD(is_register_covered<decltype(storage.halfs_write_registers)>(reg_offset, 1));
-				RES_BOOL_ASSERT(buffer.data, "MISSING_DATA_IN_FRAME");
-				uint8_t *start_addr = get_start_addr(storage.halfs_write_registers, reg_offset);
-				std::copy_n(buffer.data, 2, start_addr);
-			}
-			break;
 		case function_code::WRITE_MULTIPLE_COILS:
-			if constexpr (!HasWriteBits<Layout>) {
-				buffer.clear();
-				return {.err = "LAYOUT_HAS_NO_WRITE_HALFS"};
-			} else {
-				RES_FORWARD(is_bit_covered<decltype(storage.bits_registers)>(reg_offset, reg_count));
-				RES_BOOL_ASSERT(buffer.data && buffer.byte_count, "MISSING_DATA_IN_FRAME");
-				write_bits_to_storage(storage.bits_registers, reg_offset, reg_count, buffer.data);
-			}
-			break;
 		case function_code::WRITE_MULTIPLE_REGISTERS:
-			if constexpr (!HasWriteHalfs<Layout>) {
-				buffer.clear();
-				return {.err = "LAYOUT_HAS_NO_WRITE_HALFS"};
-			} else {
-				RES_FORWARD(is_register_covered<decltype(storage.halfs_write_registers)>(reg_offset, reg_count));
-				RES_BOOL_ASSERT(buffer.data, "MISSING_DATA_IN_FRAME");
-				uint8_t *start_addr = get_start_addr(storage.halfs_write_registers, reg_offset);
-				std::copy_n(buffer.data, reg_count * 2, start_addr);
-			}
+			// echo of the start address and the written value/count
+			RES_FORWARD(buffer().write_data(h_byte(reg_offset)));
+			RES_FORWARD(buffer().write_data(l_byte(reg_offset)));
+			RES_FORWARD(buffer().write_data(h_byte(reg_count)));
+			RES_FORWARD(buffer().write_data(l_byte(reg_count)));
 			break;
-		default: break;
+		default: 
+			buffer().clear();
+			return {.err = ILLEGAL_FUNCTION_CODE};
 		}
 
 		// footer (crc) information
 		switch(lc.transport) {
-		case transport_t::RTU: RES_FORWARD(buffer.write_checksum(checksum::calculate_crc16(buffer.frame_data.span()))); break;
-		case transport_t::TCP: swap_byte_order<uint16_t>{}(buffer.frame_data.size() - sizeof(*buffer.tcp_header), buffer.tcp_header->length); break;
+		case transport_t::RTU: RES_FORWARD(buffer().write_checksum(checksum::calculate_crc16(buffer().frame_data.span()))); break;
+		case transport_t::TCP: swap_byte_order<uint16_t>{}(buffer().frame_data.size() - sizeof(*buffer().tcp_header()), buffer().tcp_header()->length); break;
 		case transport_t::ASCII: RES_BOOL_ASSERT(false, "NOT_IMPLEMENTED");
 		default: break;
 		}
 
-		return {buffer.frame_data.span()};
+		return {buffer().frame_data.span()};
+	}
+	// tcp responses to FC03/FC04 only get their header written into the frame, the payload
+	// points to the registers in the storage, which are already in wire byte order. This saves
+	// the copy of up to 250 bytes for large reads, the payload has to be sent before the
+	// storage changes. Tcp has no trailing crc, all other responses are returned as header
+	constexpr response_iov get_frame_response_iov() {
+		function_code fc = lc.fc;
+		uint16_t reg_offset = (l_byte(lc.i1) << 8) | h_byte(lc.i1);
+		uint16_t reg_count = (l_byte(lc.i2) << 8) | h_byte(lc.i2);
+		if (buffer().cur_state != modbus_frame<MAX_SIZE>::state::FINAL || lc.transport != transport_t::TCP ||
+			(fc != function_code::READ_HOLDING_REGISTERS && fc != function_code::READ_INPUT_REGISTERS)) {
+			result_err r = get_frame_response();
+			if (r.err != OK)
+				r = get_frame_error_response(r.err);
+			return {.header = r.res, .err = r.err};
+		}
+		const uint8_t *payload{};
+		result covered{fc == function_code::READ_HOLDING_REGISTERS ? "LAYOUT_HAS_NO_HALFS": "LAYOUT_HAS_NO_WRITE_HALFS"};
+		if constexpr (HasHalfs<Layout>) {
+			if (fc == function_code::READ_HOLDING_REGISTERS) {
+				covered = is_register_covered<decltype(storage.halfs_registers)>(reg_offset, reg_count);
+				payload = get_start_addr(storage.halfs_registers, reg_offset);
+			}
+		}
+		if constexpr (HasWriteHalfs<Layout>) {
+			if (fc == function_code::READ_INPUT_REGISTERS) {
+				covered = is_register_covered<decltype(storage.halfs_write_registers)>(reg_offset, reg_count);
+				payload = get_start_addr(storage.halfs_write_registers, reg_offset);
+			}
+		}
+		// only the header has to fit into the frame, the pdu limits a read to 125 registers
+		if (covered == OK && reg_count > 125)
+			covered = INVALID_DATA_VALUE;
+		result_err r{};
+		if (covered == OK)
+			r = _write_read_header(reg_count * 2);
+		if (covered != OK || r.err != OK) {
+			r = get_frame_error_response(covered != OK ? covered: r.err);
+			return {.header = r.res, .err = r.err};
+		}
+		return {.header = r.res, .payload = {payload, reg_count * 2u}};
+	}
+	// mbap, address, function code and byte count of a read response with n_bytes of data
+	constexpr result_err _write_read_header(uint16_t n_bytes) {
+		switch_to_response();
+		RES_FORWARD(buffer().write_mbap({lc.tcp_tid}));
+		RES_FORWARD(buffer().write_addr(lc.addr));
+		RES_FORWARD(buffer().write_fc(lc.fc));
+		RES_FORWARD(buffer().write_length(n_bytes));
+		swap_byte_order<uint16_t>{}(buffer().frame_data.size() - sizeof(*buffer().tcp_header()) + n_bytes, buffer().tcp_header()->length);
+		return {buffer().frame_data.span()};
 	}
 	constexpr result_err get_frame_error_response(result err) {
+		if (_is_broadcast()) {
+			switch_to_request();
+			return {};
+		}
 		switch_to_response();
-		buffer.t.EXCEPTION = true;
+		buffer().t.EXCEPTION = true;
 		switch(lc.transport) {
-		case transport_t::ASCII: RES_FORWARD(buffer.write_ascii_start()); break;
-		case transport_t::TCP: RES_FORWARD(buffer.write_mbap({lc.tcp_tid})); break;
+		case transport_t::ASCII: RES_FORWARD(buffer().write_ascii_start()); break;
+		case transport_t::TCP: RES_FORWARD(buffer().write_mbap({lc.tcp_tid})); break;
 		default: break;
 		}
-		RES_FORWARD(buffer.write_addr(lc.addr));
-		RES_FORWARD(buffer.write_fc(lc.fc));
-		if (err == REGISTER_NOT_FULLY_COVERED) {
-			RES_FORWARD(buffer.write_ec(exception_code::ILLEGAL_DATA_ADDRESS));
-		} else {
-			RES_FORWARD(buffer.write_ec(exception_code::SLAVE_DEVICE_FAILURE));
-		}
+		RES_FORWARD(buffer().write_addr(lc.addr));
+		RES_FORWARD(buffer().write_fc(lc.fc));
+		exception_code ec{exception_code::SLAVE_DEVICE_FAILURE};
+		if (err == REGISTER_NOT_FULLY_COVERED || err == BITS_NOT_FULLY_COVERED)
+			ec = exception_code::ILLEGAL_DATA_ADDRESS;
+		else if (err == ILLEGAL_FUNCTION_CODE || err.starts_with("LAYOUT_HAS_NO"))
+			ec = exception_code::ILLEGAL_FUNCTION;
+		else if (err == INVALID_DATA_VALUE)
+			ec = exception_code::ILLEGAL_DATA_VALUE;
+		RES_FORWARD(buffer().write_ec(ec));
+		trace.exception_sent(lc.addr, lc.fc, ec);
 
 		// footer (crc) information
 		switch(lc.transport) {
-		case transport_t::RTU: RES_FORWARD(buffer.write_checksum(checksum::calculate_crc16(buffer.frame_data.span()))); break;
-		case transport_t::TCP: swap_byte_order<uint16_t>{}(buffer.frame_data.size() - sizeof(*buffer.tcp_header), buffer.tcp_header->length); break;
+		case transport_t::RTU: RES_FORWARD(buffer().write_checksum(checksum::calculate_crc16(buffer().frame_data.span()))); break;
+		case transport_t::TCP: swap_byte_order<uint16_t>{}(buffer().frame_data.size() - sizeof(*buffer().tcp_header()), buffer().tcp_header()->length); break;
 		case transport_t::ASCII: RES_BOOL_ASSERT(false, "NOT_IMPLEMENTED");
 		default: break;
 		}
 
-		return {buffer.frame_data.span()};
+		return {buffer().frame_data.span()};
+	}
+
+	// processes one complete tcp adu and returns the response frame. An empty response
+	// without error means the frame was not addressed to this register or was a broadcast
+	constexpr result_err process_tcp_adu(std::span<const uint8_t> adu) {
+		switch_to_request();
+		result_err r{.err = IN_PROGRESS};
+		for (auto b = adu.begin(); b != adu.end() && r.err == IN_PROGRESS; ++b)
+			r = process_tcp(*b);
+		if (r.err == WRONG_ADDR)
+			return {};
+		if (r.err == IN_PROGRESS) {
+			buffer().clear();
+			return {.err = "INCOMPLETE_FRAME"};
+		}
+		if (r.err != OK)
+			return r;
+		r = get_frame_response();
+		if (r.err != OK)
+			r = get_frame_error_response(r.err);
+		return r;
+	}
+
+	// process_tcp_adu variant which returns register read responses as a response_iov
+	constexpr response_iov process_tcp_adu_iov(std::span<const uint8_t> adu) {
+		switch_to_request();
+		result_err r{.err = IN_PROGRESS};
+		for (auto b = adu.begin(); b != adu.end() && r.err == IN_PROGRESS; ++b)
+			r = process_tcp(*b);
+		if (r.err == WRONG_ADDR)
+			return {};
+		if (r.err == IN_PROGRESS) {
+			buffer().clear();
+			return {.err = "INCOMPLETE_FRAME"};
+		}
+		if (r.err != OK)
+			return {.header = r.res, .err = r.err};
+		return get_frame_response_iov();
 	}
 
 	template<typename Mem, typename MemT = MemberType<Layout, Mem>>
@@ -573,6 +773,7 @@ struct modbus_register {
 	template<typename Mem, typename MemT = MemberType<Layout, Mem>>
 	requires IsValidRegister<Layout, Mem>
 	constexpr void write(const MemT &src, Mem dst) {
+		storage_write_section section{storage_sync};
 		swap_byte_order<MemT>{}(src, register_ref<Layout, Mem>(storage).*dst);
 	}
 
@@ -583,60 +784,84 @@ struct modbus_register {
 	// Client
 	constexpr result_err get_frame_read(register_t reg_type, uint32_t reg_offset, uint32_t reg_count) {
 		switch (reg_type) {
-			case register_t::BITS:        RES_FORWARD(buffer.write_fc(function_code::READ_COILS)); break;
-			case register_t::BITS_WRITE:  RES_FORWARD(buffer.write_fc(function_code::READ_DISCRETE_INPUTS)); break;
-			case register_t::HALFS:       RES_FORWARD(buffer.write_fc(function_code::READ_HOLDING_REGISTERS)); break;
-			case register_t::HALFS_WRITE: RES_FORWARD(buffer.write_fc(function_code::READ_INPUT_REGISTERS)); break;
+			case register_t::BITS:        RES_FORWARD(buffer().write_fc(function_code::READ_COILS)); break;
+			case register_t::BITS_WRITE:  RES_FORWARD(buffer().write_fc(function_code::READ_DISCRETE_INPUTS)); break;
+			case register_t::HALFS:       RES_FORWARD(buffer().write_fc(function_code::READ_HOLDING_REGISTERS)); break;
+			case register_t::HALFS_WRITE: RES_FORWARD(buffer().write_fc(function_code::READ_INPUT_REGISTERS)); break;
 			default:;
 		}
 
-		RES_ERR_ASSERT(buffer.write_data(h_byte(reg_offset)), "WRITE_REG_OFF_ERR");
-		RES_ERR_ASSERT(buffer.write_data(l_byte(reg_offset)), "WRITE_REG_OFF_ERR");
-		RES_ERR_ASSERT(buffer.write_data(h_byte(reg_count)), "WRITE_REG_COUNT_ERR");
-		RES_ERR_ASSERT(buffer.write_data(l_byte(reg_count)), "WRITE_REG_COUNT_ERR");
-		switch(buffer.transport) {
-		case transport_t::RTU: RES_FORWARD(buffer.write_checksum(checksum::calculate_crc16(buffer.frame_data.span()))); break;
-		case transport_t::TCP: swap_byte_order<uint16_t>{}(buffer.frame_data.size() - sizeof(*buffer.tcp_header), buffer.tcp_header->length); break;
+		RES_ERR_ASSERT(buffer().write_data(h_byte(reg_offset)), "WRITE_REG_OFF_ERR");
+		RES_ERR_ASSERT(buffer().write_data(l_byte(reg_offset)), "WRITE_REG_OFF_ERR");
+		RES_ERR_ASSERT(buffer().write_data(h_byte(reg_count)), "WRITE_REG_COUNT_ERR");
+		RES_ERR_ASSERT(buffer().write_data(l_byte(reg_count)), "WRITE_REG_COUNT_ERR");
+		switch(buffer().transport) {
+		case transport_t::RTU: RES_FORWARD(buffer().write_checksum(checksum::calculate_crc16(buffer().frame_data.span()))); break;
+		case transport_t::TCP: swap_byte_order<uint16_t>{}(buffer().frame_data.size() - sizeof(*buffer().tcp_header()), buffer().tcp_header()->length); break;
 		case transport_t::ASCII: RES_BOOL_ASSERT(false, "NOT_IMPLEMENTED");
 		default: break;
 		}
 		lc = get_last_completed();
-		return {buffer.frame_data.span()};
+		return {buffer().frame_data.span()};
+	}
+	// writes the current storage content of a raw register/bit range
+	constexpr result_err get_frame_write(register_t reg_type, uint32_t reg_offset, uint32_t reg_count) {
+		switch (reg_type) {
+		case register_t::BITS_WRITE:
+			if constexpr (HasWriteBits<Layout>) {
+				using R = decltype(storage.bits_write_registers);
+				RES_FORWARD(is_bit_covered<R>(reg_offset, reg_count));
+				uint8_t *start_addr = reinterpret_cast<uint8_t*>(&storage.bits_write_registers);
+				return get_frame_write(reg_type, reg_offset, std::span<uint8_t>{start_addr, sizeof(R)}, 
+					reg_offset - R::OFFSET, reg_count);
+			}
+			break;
+		case register_t::HALFS_WRITE:
+			if constexpr (HasWriteHalfs<Layout>) {
+				RES_FORWARD(is_register_covered<decltype(storage.halfs_write_registers)>(reg_offset, reg_count));
+				uint8_t *start_addr = get_start_addr(storage.halfs_write_registers, reg_offset);
+				return get_frame_write(reg_type, reg_offset, std::span<uint8_t>{start_addr, reg_count * 2});
+			}
+			break;
+		default: return get_frame_write(reg_type, reg_offset, std::span<uint8_t>{});
+		}
+		buffer().clear();
+		return {.err = "LAYOUT_HAS_NO_WRITE_REGISTERS"};
 	}
 	constexpr result_err get_frame_write(register_t reg_type, uint32_t reg_offset, std::span<uint8_t> data, uint16_t start_bit = 0, uint16_t bit_count = 0) {
 		switch (reg_type) {
 			case register_t::BITS:        return {.err = "BITS_NOT_ALLOWED"};
 			case register_t::BITS_WRITE:  
 				if (bit_count == 1) {
-					RES_FORWARD(buffer.write_fc(function_code::WRITE_SINGLE_COIL)); 
+					RES_FORWARD(buffer().write_fc(function_code::WRITE_SINGLE_COIL)); 
 				}
 				else {
-					RES_FORWARD(buffer.write_fc(function_code::WRITE_MULTIPLE_COILS)); 
+					RES_FORWARD(buffer().write_fc(function_code::WRITE_MULTIPLE_COILS)); 
 				}
 				break;
 			case register_t::HALFS:       return {.err = "HALFS_NOT_ALLOWED"};
 			case register_t::HALFS_WRITE:
 				if (data.size() == 2) {
-					RES_FORWARD(buffer.write_fc(function_code::WRITE_SINGLE_REGISTER));
+					RES_FORWARD(buffer().write_fc(function_code::WRITE_SINGLE_REGISTER));
 				}
 				else {
-					RES_FORWARD(buffer.write_fc(function_code::WRITE_MULTIPLE_REGISTERS));
+					RES_FORWARD(buffer().write_fc(function_code::WRITE_MULTIPLE_REGISTERS));
 				}
 				break;
 			default: return {.err = "INVALID_REGISTER_TYPE"};
 		}
 
 		// write offset and size
-		RES_ERR_ASSERT(buffer.write_data(h_byte(reg_offset)), "WRITE_REG_OFF_ERR");
-		RES_ERR_ASSERT(buffer.write_data(l_byte(reg_offset)), "WRITE_REG_OFF_ERR");
-		if (function_code(*buffer.fc) == function_code::WRITE_MULTIPLE_COILS || 
-			function_code(*buffer.fc) == function_code::WRITE_MULTIPLE_REGISTERS) {
+		RES_ERR_ASSERT(buffer().write_data(h_byte(reg_offset)), "WRITE_REG_OFF_ERR");
+		RES_ERR_ASSERT(buffer().write_data(l_byte(reg_offset)), "WRITE_REG_OFF_ERR");
+		if (function_code(*buffer().fc()) == function_code::WRITE_MULTIPLE_COILS || 
+			function_code(*buffer().fc()) == function_code::WRITE_MULTIPLE_REGISTERS) {
 			uint16_t reg_count = reg_type == register_t::HALFS_WRITE ? data.size() / 2 : bit_count;
-			uint8_t byte_count = reg_type == register_t::HALFS_WRITE ? data.size() / 2 : (bit_count + 7) / 8;
-			RES_ERR_ASSERT(buffer.write_data(h_byte(reg_count)), "WRITE_REG_COUNT_ERR");
-			RES_ERR_ASSERT(buffer.write_data(l_byte(reg_count)), "WRITE_REG_COUNT_ERR");
-			buffer.byte_count = buffer.frame_data.end();
-			RES_ERR_ASSERT(buffer.write_data(byte_count), "WRITE_BYTE_SIZE_ERR");
+			uint8_t byte_count = reg_type == register_t::HALFS_WRITE ? data.size() : (bit_count + 7) / 8;
+			RES_ERR_ASSERT(buffer().write_data(h_byte(reg_count)), "WRITE_REG_COUNT_ERR");
+			RES_ERR_ASSERT(buffer().write_data(l_byte(reg_count)), "WRITE_REG_COUNT_ERR");
+			buffer()._byte_count = typename modbus_frame<MAX_SIZE>::offset_t(buffer()._end_offset());
+			RES_ERR_ASSERT(buffer().write_data(byte_count), "WRITE_BYTE_SIZE_ERR");
 		}
 
 		// write data
@@ -644,50 +869,126 @@ struct modbus_register {
 			case register_t::BITS_WRITE:
 				if (bit_count == 1) {
 					uint8_t bit = data[start_bit / 8] & (1 << (start_bit % 8));
-					RES_FORWARD(buffer.write_data(bit ? 0xff: 0));
-					RES_FORWARD(buffer.write_data(0));
+					RES_FORWARD(buffer().write_data(bit ? 0xff: 0));
+					RES_FORWARD(buffer().write_data(0));
 				} else {
-					for (uint32_t cur_bit = start_bit; cur_bit < bit_count; cur_bit += 8) {
+					for (uint32_t cur_bit = start_bit; cur_bit < uint32_t(start_bit + bit_count); cur_bit += 8) {
 						uint8_t byte = data[cur_bit / 8] >> (cur_bit % 8);
 						if (cur_bit % 8)
 							byte |= data[cur_bit / 8 + 1] << (8 - (cur_bit % 8));
-						RES_FORWARD(buffer.write_data(byte));
+						RES_FORWARD(buffer().write_data(byte));
 					}
 				}
 				break;
 			case register_t::HALFS_WRITE:
-				RES_ERR_ASSERT(buffer.write_data(data), "WRITE_DATA_ERR");
+				RES_ERR_ASSERT(buffer().write_data(data), "WRITE_DATA_ERR");
 				break;
 			default: break;
 		}
 
-		if (buffer.is_ascii()) {
+		if (buffer().is_ascii()) {
 			return {.err = "ASCII not implemented yet"};
-		} else if (buffer.is_rtu()) {
-			uint16_t crc = checksum::calculate_crc16(buffer.frame_data.span());
-			RES_FORWARD(buffer.write_checksum(crc));
+		} else if (buffer().is_rtu()) {
+			uint16_t crc = checksum::calculate_crc16(buffer().frame_data.span());
+			RES_FORWARD(buffer().write_checksum(crc));
 		}
-		if (buffer.is_tcp()) {
-			swap_byte_order<uint16_t>{}(buffer.frame_data.size() - sizeof(*buffer.tcp_header), 
-				buffer.tcp_header->length);
+		if (buffer().is_tcp()) {
+			swap_byte_order<uint16_t>{}(buffer().frame_data.size() - sizeof(*buffer().tcp_header()), 
+				buffer().tcp_header()->length);
 		}
 		lc = get_last_completed();
-		return {buffer.frame_data.span()};
+		return {buffer().frame_data.span()};
+	}
+
+	// unit 0 is a broadcast on a serial line, on tcp it is an ordinary unit id which is answered
+	constexpr bool _is_broadcast() const { return lc.addr == BROADCAST_ADDR && lc.transport == transport_t::RTU; }
+	// applies write requests in the frame buffer to the storage, only an accepted write opens a
+	// storage write section, so reads and rejected writes leave the storage sync untouched
+	constexpr result _apply_write(uint16_t reg_offset, uint16_t reg_count) {
+		switch(lc.fc) {
+		case function_code::WRITE_SINGLE_COIL:
+			if constexpr (!HasWriteBits<Layout>) {
+				return "LAYOUT_HAS_NO_WRITE_BITS";
+			} else {
+				if (result r = is_bit_covered<decltype(storage.bits_write_registers)>(reg_offset, 1); r != OK)
+					return r;
+				if (reg_count != 0xff00 && reg_count != 0x0000)
+					return INVALID_DATA_VALUE;
+				storage_write_section section{storage_sync};
+				int bit = reg_offset - decltype(storage.bits_write_registers)::OFFSET;
+				uint8_t *data = reinterpret_cast<uint8_t*>(&storage.bits_write_registers);
+				if (reg_count)
+					data[bit / 8] |= 1 << (bit % 8);
+				else
+					data[bit / 8] &= ~(1 << (bit % 8));
+			}
+			break;
+		case function_code::WRITE_SINGLE_REGISTER:
+			if constexpr (!HasWriteHalfs<Layout>) {
+				return "LAYOUT_HAS_NO_WRITE_HALFS";
+			} else {
+				if (result r = is_register_covered<decltype(storage.halfs_write_registers)>(reg_offset, 1); r != OK)
+					return r;
+				storage_write_section section{storage_sync};
+				uint8_t *start_addr = get_start_addr(storage.halfs_write_registers, reg_offset);
+				start_addr[0] = h_byte(reg_count);
+				start_addr[1] = l_byte(reg_count);
+			}
+			break;
+		case function_code::WRITE_MULTIPLE_COILS:
+			if constexpr (!HasWriteBits<Layout>) {
+				return "LAYOUT_HAS_NO_WRITE_BITS";
+			} else {
+				if (result r = is_bit_covered<decltype(storage.bits_write_registers)>(reg_offset, reg_count); r != OK)
+					return r;
+				if (!buffer().byte_count() || *buffer().byte_count() != (reg_count + 7) / 8)
+					return INVALID_DATA_VALUE;
+				storage_write_section section{storage_sync};
+				write_bits_to_storage(storage.bits_write_registers, reg_offset, reg_count, buffer().byte_count() + 1);
+			}
+			break;
+		case function_code::WRITE_MULTIPLE_REGISTERS:
+			if constexpr (!HasWriteHalfs<Layout>) {
+				return "LAYOUT_HAS_NO_WRITE_HALFS";
+			} else {
+				if (result r = is_register_covered<decltype(storage.halfs_write_registers)>(reg_offset, reg_count); r != OK)
+					return r;
+				if (!buffer().byte_count() || *buffer().byte_count() != reg_count * 2)
+					return INVALID_DATA_VALUE;
+				storage_write_section section{storage_sync};
+				uint8_t *start_addr = get_start_addr(storage.halfs_write_registers, reg_offset);
+				std::copy_n(buffer().byte_count() + 1, reg_count * 2, start_addr);
+			}
+			break;
+		default: break;
+		}
+		return OK;
 	}
 
 	constexpr result_err _process(uint8_t b) {
-		result r = buffer.process(b);
+		bool frame_start = !buffer().addr();
+		result r = buffer().process(b);
 		if (r != OK) {
-			buffer.clear();
+			if (r == INVALID_CRC)
+				trace.crc_failure(*buffer().addr(), buffer().fc() ? function_code(*buffer().fc()): function_code::NONE);
+			buffer().clear();
 			return {.err = r};
 		}
-		if (r == OK && buffer.cur_state != modbus_frame<MAX_SIZE>::state::FINAL)
+		if (frame_start && buffer().addr())
+			trace.frame_start(*buffer().addr());
+		if (r == OK && buffer().cur_state != modbus_frame<MAX_SIZE>::state::FINAL)
 			return {.err = IN_PROGRESS};
 		uint16_t reg_offset = (l_byte(lc.i1) << 8) | h_byte(lc.i1);
 		uint16_t reg_count = (l_byte(lc.i2) << 8) | h_byte(lc.i2);
 		last_completed response_lc = get_last_completed();
-		// modbus client
-		if (addr == 0) { 
+		if (role == role_t::CLIENT && buffer().t.EXCEPTION) {
+			// the device rejected the request, the storage stays unchanged
+			bool valid = lc.addr == response_lc.addr && uint8_t(lc.fc) == (uint8_t(response_lc.fc) & 0x7f);
+			exception_code ec = exception_code(*buffer().ec());
+			buffer().clear();
+			return {.err = valid ? exception_result(ec): INVALID_RESPONSE};
+		}
+		if (role == role_t::CLIENT) {
 			// validation checks
 			bool valid = true;
 			bool is_bit{};
@@ -702,57 +1003,63 @@ struct modbus_register {
 				case function_code::READ_HOLDING_REGISTERS:
 				case function_code::READ_INPUT_REGISTERS:
 					valid = lc.addr == response_lc.addr && lc.fc == response_lc.fc &&
-						is_bit ? (reg_count + 7) / 8 == l_byte(response_lc.i1): reg_count * 2 == l_byte(response_lc.i1);
+						(is_bit ? (reg_count + 7) / 8 == l_byte(response_lc.i1): reg_count * 2 == l_byte(response_lc.i1));
+					break;
+				case function_code::WRITE_MULTIPLE_COILS:
+				case function_code::WRITE_MULTIPLE_REGISTERS:
+					valid = lc.addr == response_lc.addr && lc.fc == response_lc.fc &&
+						lc.i1 == response_lc.i1 && lc.i2 == response_lc.i2;
 					break;
 				default: break;
 			}
 			if (!valid) {
-				buffer.clear();
+				buffer().clear();
 				return {.err = INVALID_RESPONSE};
 			}
 			// data extraction
+			storage_write_section section{storage_sync};
 			switch(lc.fc) {
 			case function_code::READ_COILS:
 				if constexpr (!HasBits<Layout>) {
-					buffer.clear();
+					buffer().clear();
 					return {.err = "LAYOUT_HAS_NO_BITS"};
 				} else {
 					RES_FORWARD(is_bit_covered<decltype(storage.bits_registers)>(reg_offset, reg_count));
-					RES_BOOL_ASSERT(buffer.data && buffer.byte_count, "INCOMPLETE_RESPONSE");
-					write_bits_to_storage(storage.bits_registers, reg_offset, reg_count, buffer.data);
+					RES_BOOL_ASSERT(buffer().data() && buffer().byte_count(), "INCOMPLETE_RESPONSE");
+					write_bits_to_storage(storage.bits_registers, reg_offset, reg_count, buffer().data());
 				}
 				break;
 			case function_code::READ_DISCRETE_INPUTS:
 				if constexpr (!HasWriteBits<Layout>) {
-					buffer.clear();
+					buffer().clear();
 					return {.err = "LAYOUT_HAS_NO_WRITE_BITS"};
 				} else {
 					RES_FORWARD(is_bit_covered<decltype(storage.bits_write_registers)>(reg_offset, reg_count));
-					RES_BOOL_ASSERT(buffer.data && buffer.byte_count, "INCOMPLETE_RESPONSE");
-					write_bits_to_storage(storage.bits_write_registers, reg_offset, reg_count, buffer.data);
+					RES_BOOL_ASSERT(buffer().data() && buffer().byte_count(), "INCOMPLETE_RESPONSE");
+					write_bits_to_storage(storage.bits_write_registers, reg_offset, reg_count, buffer().data());
 				}
 				break;
 			case function_code::READ_HOLDING_REGISTERS:
 				if constexpr (!HasHalfs<Layout>) {
-					buffer.clear();
+					buffer().clear();
 					return {.err = "LAYOUT_HAS_NO_HALFS"};
 				} else {
 					constexpr int START = decltype(storage.halfs_registers)::OFFSET;
 					RES_FORWARD(is_register_covered<decltype(storage.halfs_registers)>(reg_offset, reg_count));
-					RES_BOOL_ASSERT(buffer.data && buffer.byte_count, "INCOMPLETE_RESPONSE");
-					std::copy_n(buffer.data, *buffer.byte_count, 
+					RES_BOOL_ASSERT(buffer().data() && buffer().byte_count(), "INCOMPLETE_RESPONSE");
+					std::copy_n(buffer().data(), *buffer().byte_count(), 
 						reinterpret_cast<uint8_t*>(&storage.halfs_registers) + (reg_offset - START) * 2);
 					}
 				break;
 			case function_code::READ_INPUT_REGISTERS:
 				if constexpr (!HasWriteHalfs<Layout>) {
-					buffer.clear();
+					buffer().clear();
 					return {.err = "LAYOUT_HAS_NO_WRITE_HALFS"};
 				} else {
 					constexpr int START = decltype(storage.halfs_write_registers)::OFFSET;
 					RES_FORWARD(is_register_covered<decltype(storage.halfs_write_registers)>(reg_offset, reg_count));
-					RES_BOOL_ASSERT(buffer.data && buffer.byte_count, "INCOMPLETE_RESPONSE");
-					std::copy_n(buffer.data, *buffer.byte_count, 
+					RES_BOOL_ASSERT(buffer().data() && buffer().byte_count(), "INCOMPLETE_RESPONSE");
+					std::copy_n(buffer().data(), *buffer().byte_count(), 
 						reinterpret_cast<uint8_t*>(&storage.halfs_write_registers) + (reg_offset - START) * 2);
 					}
 				break;
@@ -760,25 +1067,26 @@ struct modbus_register {
 			}
 		} else {
 			// validation checks
-			if (response_lc.addr != addr) {
-				buffer.clear();
+			if (response_lc.addr != addr && response_lc.addr != BROADCAST_ADDR) {
+				buffer().clear();
 				return {.err = WRONG_ADDR};
 			}
 		}
 		lc = response_lc;
+		trace.frame_complete(lc.addr, lc.fc, buffer().frame_data.size());
 		
-		return {.res = buffer.frame_data.span()};
+		return {.res = buffer().frame_data.span()};
 	}
 
 	last_completed get_last_completed() {
 		return last_completed{
-			.transport = buffer.transport,
-			.tcp_tid = buffer.tcp_header ? to_hb_first(buffer.tcp_header->transaction_id): uint16_t(0),
-			.addr = buffer.addr ? *buffer.addr: uint8_t(0),
-			.fc = buffer.fc ? function_code(*buffer.fc): function_code::NONE,
-			.i1 = *reinterpret_cast<uint16_t*>(buffer.fc + 1),
-			.i2 = *reinterpret_cast<uint16_t*>(buffer.fc + 3),
-			.crc = *(reinterpret_cast<uint16_t*>(buffer.frame_data.end()) - 1),
+			.transport = buffer().transport,
+			.tcp_tid = buffer().tcp_header() ? to_hb_first(buffer().tcp_header()->transaction_id): uint16_t(0),
+			.addr = buffer().addr() ? *buffer().addr(): uint8_t(0),
+			.fc = buffer().fc() ? function_code(*buffer().fc()): function_code::NONE,
+			.i1 = *reinterpret_cast<uint16_t*>(buffer().fc() + 1),
+			.i2 = *reinterpret_cast<uint16_t*>(buffer().fc() + 3),
+			.crc = *(reinterpret_cast<uint16_t*>(buffer().frame_data.end()) - 1),
 		};
 	}
 	#undef RES_ERR_ASSERT
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "modbus-register.h"
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+namespace libmodbus_static {
+
+constexpr std::string_view OPEN_FAILED{"OPEN_FAILED"};
+constexpr std::string_view UNSUPPORTED_BAUD{"UNSUPPORTED_BAUD"};
+constexpr std::string_view TERMIOS_FAILED{"TERMIOS_FAILED"};
+
+/**
+ * Rtu character time and the 3.5 character silence which ends a frame.
+ * Above 19200 baud the modbus spec fixes the silence to 1750us (and 1.5 characters to 750us)
+ */
+constexpr std::chrono::nanoseconds rtu_char_time(uint32_t baud, int bits_per_char = 11) {
+	return std::chrono::nanoseconds(baud ? uint64_t(bits_per_char) * 1000000000 / baud: 0);
+}
+constexpr std::chrono::nanoseconds rtu_frame_silence(uint32_t baud, int bits_per_char = 11) {
+	if (baud > 19200)
+		return std::chrono::microseconds(1750);
+	return std::chrono::nanoseconds(baud ? uint64_t(bits_per_char) * 3500000000 / baud: 0);
+}
+
+constexpr speed_t termios_speed(uint32_t baud) {
+	switch (baud) {
+	case 1200: return B1200;
+	case 2400: return B2400;
+	case 4800: return B4800;
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	default: return B0;
+	}
+}
+
+/**
+ * Rtu DATA_IO for linux serial ports (eg. /dev/ttyUSB0, /dev/ttyS0).
+ *
+ * The port is put into raw mode with VMIN = VTIME = 0 and read non blocking, inter character
+ * timing is done with ppoll in microseconds instead of the 100ms VTIME resolution. If the
+ * driver supports it ASYNC_LOW_LATENCY is set, so received bytes are not held back by the
+ * tty layer (for ftdi adapters additionally set /sys/bus/usb-serial/devices/.../latency_timer).
+ *
+ * read_bytes returns the received bytes as soon as they are there, so a complete frame is
+ * processed without waiting for the end of frame silence. frame_gap() tells if read_bytes
+ * waited at least 3.5 characters for the returned bytes without receiving anything, the actor
+ * then drops a partially parsed frame (eg. after noise or a lost byte) like a real device
+ * would. Bytes which were buffered while nobody waited for them never count as a gap. A
+ * closed port (hang up or end of file) makes read_bytes return immediately.
+ *
+ * If fd is already set on init (eg. the master side of a pty_pair) it is configured but not
+ * opened/closed by the io. Usage:
+ *
+ * modbus_actor<layout, rtu_linux_io> client{role_t::CLIENT, layout{}, {"/dev/ttyUSB0", 19200, 'E'}};
+ * client.read_remote(1, &layout::halfs_layout::value);
+ */
+struct rtu_linux_io {
+	using clock = std::chrono::steady_clock;
+	static constexpr transport_t TRANSPORT_TYPE{transport_t::RTU};
+
+	const char *device{};
+	uint32_t baud{19200};
+	char parity{'E'};	// 'N', 'E' or 'O'
+	int stop_bits{1};
+	int fd{-1};
+	result status{OK};
+	bool _owns_fd{};
+	bool _gap{true};
+	// time read_bytes waited without data since the last received byte, the line is idle at the start
+	clock::duration _silent{std::chrono::hours(1)};
+	std::array<uint8_t, RTU_FRAME_SIZE> receive_buffer{};
+
+	constexpr int bits_per_char() const { return 9 + (parity != 'N') + stop_bits; }
+	constexpr std::chrono::nanoseconds frame_silence() const { return rtu_frame_silence(baud, bits_per_char()); }
+
+	void init() {
+		if (fd < 0) {
+			fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+			_owns_fd = fd >= 0;
+		}
+		if (fd < 0) {
+			status = OPEN_FAILED;
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		speed_t speed = termios_speed(baud);
+		if (speed == B0) {
+			status = UNSUPPORTED_BAUD;
+			return;
+		}
+		termios t{};
+		if (tcgetattr(fd, &t) != 0) {
+			status = TERMIOS_FAILED;
+			return;
+		}
+		cfmakeraw(&t);
+		cfsetispeed(&t, speed);
+		cfsetospeed(&t, speed);
+		t.c_cflag |= CLOCAL | CREAD;
+		t.c_cflag &= ~(PARENB | PARODD | CSTOPB | CRTSCTS);
+		if (parity != 'N')
+			t.c_cflag |= PARENB | (parity == 'O' ? PARODD: 0);
+		if (stop_bits == 2)
+			t.c_cflag |= CSTOPB;
+		t.c_cc[VMIN] = 0;
+		t.c_cc[VTIME] = 0;
+		if (tcsetattr(fd, TCSANOW, &t) != 0) {
+			status = TERMIOS_FAILED;
+			return;
+		}
+#ifdef ASYNC_LOW_LATENCY
+		// not supported by every driver (eg. ptys), the port works without it
+		serial_struct serial{};
+		if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+			serial.flags |= ASYNC_LOW_LATENCY;
+			ioctl(fd, TIOCSSERIAL, &serial);
+		}
+#endif
+		tcflush(fd, TCIOFLUSH);
+		status = OK;
+	}
+	void deinit() {
+		if (_owns_fd && fd >= 0)
+			close(fd);
+		if (_owns_fd)
+			fd = -1;
+	}
+	result get_status() const { return status; }
+
+	// waits at most max_timeout for data and returns all bytes which are already received
+	std::span<uint8_t> read_bytes(std::chrono::milliseconds max_timeout) {
+		if (fd < 0)
+			return {};
+		auto deadline = clock::now() + max_timeout;
+		while (true) {
+			ssize_t n = read(fd, receive_buffer.data(), receive_buffer.size());
+			if (n > 0) {
+				_gap = _silent >= frame_silence();
+				_silent = {};
+				return {receive_buffer.data(), size_t(n)};
+			}
+			// with VMIN = 0 a tty also returns 0 for no data, a closed port is told by ppoll
+			if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				return {};
+			auto now = clock::now();
+			if (now >= deadline)
+				return {};
+			auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now);
+			timespec ts{.tv_sec = time_t(wait.count() / 1000000000), .tv_nsec = long(wait.count() % 1000000000)};
+			pollfd p{.fd = fd, .events = POLLIN, .revents = 0};
+			int ready = ppoll(&p, 1, &ts, nullptr);
+			if (ready < 0 && errno != EINTR)
+				return {};
+			// nothing was read, so the port is closed and not just drained
+			if (ready > 0 && (p.revents & (POLLHUP | POLLERR | POLLNVAL)))
+				return {};
+			// the line was silent until ppoll returned
+			_silent += clock::now() - now;
+		}
+	}
+	// true if the bytes of the last read_bytes followed at least 3.5 characters of observed silence
+	bool frame_gap() const { return _gap; }
+	bool readable() const {
+		pollfd p{.fd = fd, .events = POLLIN, .revents = 0};
+		return fd >= 0 && ::poll(&p, 1, 0) > 0;
+	}
+	int poll_fd() const { return fd; }
+	void write_bytes(std::span<const uint8_t> data) {
+		while (fd >= 0 && data.size()) {
+			ssize_t n = write(fd, data.data(), data.size());
+			if (n > 0) {
+				data = data.subspan(n);
+				continue;
+			}
+			if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				return;
+			pollfd p{.fd = fd, .events = POLLOUT, .revents = 0};
+			::poll(&p, 1, 100);
+		}
+	}
+};
+
+/**
+ * Pseudo terminal pair to run an rtu client and server without hardware, the master
+ * fd is used by one rtu_linux_io, the slave device by the other. Some kernels reject parity
+ * on ptys, so use 'N' with 2 stop bits (also 11 bits per character):
+ *
+ * pty_pair pty{};
+ * pty.open();
+ * modbus_actor<layout, rtu_linux_io> server{1, layout{}, {.parity = 'N', .stop_bits = 2, .fd = pty.master}};
+ * modbus_actor<layout, rtu_linux_io> client{role_t::CLIENT, layout{},
+ *	{.device = pty.slave_name.data(), .parity = 'N', .stop_bits = 2}};
+ */
+struct pty_pair {
+	int master{-1};
+	std::array<char, 64> slave_name{};
+
+	result open() {
+		master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		if (master < 0)
+			return OPEN_FAILED;
+		const char *name = grantpt(master) == 0 && unlockpt(master) == 0 ? ptsname(master): nullptr;
+		if (!name || std::string_view{name}.size() >= slave_name.size()) {
+			close();
+			return OPEN_FAILED;
+		}
+		std::ranges::copy(std::string_view{name}, slave_name.begin());
+		return OK;
+	}
+	void close() {
+		if (master >= 0)
+			::close(master);
+		master = -1;
+	}
+};
+
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "modbus-register.h"
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace libmodbus_static {
+
+constexpr std::string_view SHM_OPEN_FAILED{"SHM_OPEN_FAILED"};
+constexpr std::string_view SHM_MAP_FAILED{"SHM_MAP_FAILED"};
+constexpr std::string_view SHM_LAYOUT_MISMATCH{"SHM_LAYOUT_MISMATCH"};
+
+/** Header at the start of a shared memory register image, magic is written last */
+struct shm_header {
+	constexpr static uint64_t MAGIC{0x4547414d49424d4c};	// "LMBIMAGE"
+	constexpr static uint32_t VERSION{1};
+	std::atomic<uint64_t> magic{};
+	uint32_t version{VERSION};
+	uint32_t storage_offset{};
+	uint32_t storage_size{};
+	uint32_t mapping_size{};
+	uint64_t layout_hash{};
+	// seqlock generation, odd while the storage is written
+	alignas(64) std::atomic<uint32_t> generation{};
+};
+
+/**
+ * Storage sync policy which makes the storage changes of a register visible to readers in
+ * other processes via the seqlock generation of a shm_header. Nested write sections (eg. a
+ * storage_write_section around several write() calls) are published at once.
+ */
+struct shm_seqlock {
+	shm_header *header{};
+	int _depth{};
+
+	void begin_write() {
+		if (!header || _depth++)
+			return;
+		header->generation.store(header->generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	void end_write() {
+		if (!header || --_depth)
+			return;
+		header->generation.store(header->generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+template<typename Layout>
+using shm_register = modbus_register<Layout, TCP_ADU_SIZE, no_trace, owned_frame<TCP_ADU_SIZE>, shm_seqlock>;
+
+/**
+ * Places a register (or an actor) with the shm_seqlock storage sync in a POSIX shared memory
+ * segment, so co-located processes (loggers, uis, controllers) read its storage directly via
+ * shm_view instead of querying it over modbus. Only the storage is read by other processes,
+ * the rest of the register stays private to the creating process.
+ *
+ * With a name (eg. "/plant-meter") the segment is created via shm_open and removed again on
+ * close, without a name an anonymous memfd is created, its fd can be passed to other
+ * processes (unix socket, fork or /proc/<pid>/fd/<fd>). Usage:
+ *
+ * static shm_image<shm_register<meter_layout>> image{};
+ * image.create("/plant-meter");
+ * image.reg->addr = 1;
+ * static tcp_linux_server<shm_register<meter_layout>> server{.handler = *image.reg};
+ */
+template<typename Reg>
+requires std::same_as<decltype(Reg::storage_sync), shm_seqlock>
+struct shm_image {
+	using layout_t = decltype(Reg::storage);
+	constexpr static size_t REG_OFFSET{(sizeof(shm_header) + alignof(Reg) - 1) / alignof(Reg) * alignof(Reg)};
+	constexpr static size_t SIZE{REG_OFFSET + sizeof(Reg)};
+
+	int fd{-1};
+	shm_header *header{};
+	Reg *reg{};
+	std::array<char, 64> _name{};
+
+	shm_image() = default;
+	shm_image(const shm_image&) = delete;
+	shm_image& operator=(const shm_image&) = delete;
+	~shm_image() { close(); }
+
+	// the arguments construct the register/actor inside the segment
+	template<typename... Args>
+	result create(const char *name, Args&&... args) {
+		close();
+		if (name && std::string_view{name}.size() >= _name.size())
+			return SHM_OPEN_FAILED;
+		if (name) {
+			// a segment of a crashed process is replaced
+			shm_unlink(name);
+			fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+			if (fd >= 0)
+				std::ranges::copy(std::string_view{name}, _name.begin());
+		} else {
+			fd = memfd_create("modbus-image", MFD_CLOEXEC);
+		}
+		if (fd < 0)
+			return SHM_OPEN_FAILED;
+		if (ftruncate(fd, SIZE) != 0) {
+			close();
+			return SHM_MAP_FAILED;
+		}
+		void *map = mmap(nullptr, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			close();
+			return SHM_MAP_FAILED;
+		}
+		header = new (map) shm_header{};
+		reg = new (static_cast<char*>(map) + REG_OFFSET) Reg(std::forward<Args>(args)...);
+		reg->storage_sync.header = header;
+		header->storage_offset = reinterpret_cast<char*>(&reg->storage) - static_cast<char*>(map);
+		header->storage_size = sizeof(layout_t);
+		header->mapping_size = SIZE;
+		header->layout_hash = layout_hash<layout_t>();
+		header->magic.store(shm_header::MAGIC, std::memory_order_release);
+		return OK;
+	}
+	void close() {
+		if (reg)
+			reg->~Reg();
+		if (header)
+			munmap(header, SIZE);
+		if (fd >= 0)
+			::close(fd);
+		if (_name[0])
+			shm_unlink(_name.data());
+		reg = {};
+		header = {};
+		fd = -1;
+		_name = {};
+	}
+};
+
+/**
+ * Read only view of a shm_image in another process. Reads retry while the register writes,
+ * so they always return a consistent state of the storage. generation() changes with every
+ * write, which allows to poll for changes. Usage:
+ *
+ * shm_view<meter_layout> meter{};
+ * if (meter.open("/plant-meter") == OK)
+ *	float power = meter.read(&meter_layout::halfs_layout::power);
+ */
+template<typename Layout>
+struct shm_view {
+	static_assert(std::is_trivially_copyable_v<Layout>, "The layout is copied byte wise from the shared memory");
+
+	const shm_header *header{};
+	const Layout *storage{};
+	size_t _size{};
+
+	shm_view() = default;
+	shm_view(const shm_view&) = delete;
+	shm_view& operator=(const shm_view&) = delete;
+	~shm_view() { close(); }
+
+	result open(const char *name) {
+		close();
+		int f = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+		if (f < 0)
+			return SHM_OPEN_FAILED;
+		result r = _map(f);
+		::close(f);
+		return r;
+	}
+	// maps the segment of an fd (eg. a memfd of a shm_image), the fd stays owned by the caller
+	result open_fd(int f) {
+		close();
+		return _map(f);
+	}
+	void close() {
+		if (header)
+			munmap(const_cast<shm_header*>(header), _size);
+		header = {};
+		storage = {};
+		_size = {};
+	}
+
+	uint32_t generation() const { return header->generation.load(std::memory_order_acquire); }
+	Layout snapshot() const {
+		Layout res{};
+		_read(storage, &res, sizeof(Layout));
+		return res;
+	}
+	template<typename Mem, typename MemT = MemberType<Layout, Mem>>
+	requires IsValidRegister<Layout, Mem>
+	MemT read(Mem src) const {
+		const auto &src_ref = register_ref<Layout, Mem>(*const_cast<Layout*>(storage)).*src;
+		std::remove_cvref_t<decltype(src_ref)> raw{};
+		_read(&src_ref, &raw, sizeof(raw));
+		MemT res{};
+		swap_byte_order<MemT>{}(raw, res);
+		return res;
+	}
+
+	void _read(const void *src, void *dst, size_t size) const {
+		while (true) {
+			uint32_t g = header->generation.load(std::memory_order_acquire);
+			if (g & 1)
+				continue;
+			std::memcpy(dst, src, size);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (header->generation.load(std::memory_order_relaxed) == g)
+				return;
+		}
+	}
+	result _map(int f) {
+		struct stat st{};
+		if (fstat(f, &st) != 0 || size_t(st.st_size) < sizeof(shm_header))
+			return SHM_MAP_FAILED;
+		void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, f, 0);
+		if (map == MAP_FAILED)
+			return SHM_MAP_FAILED;
+		header = static_cast<const shm_header*>(map);
+		_size = st.st_size;
+		if (header->magic.load(std::memory_order_acquire) != shm_header::MAGIC ||
+			header->version != shm_header::VERSION || header->layout_hash != layout_hash<Layout>() ||
+			header->storage_size != sizeof(Layout) || header->storage_offset + sizeof(Layout) > _size) {
+			close();
+			return SHM_LAYOUT_MISMATCH;
+		}
+		storage = reinterpret_cast<const Layout*>(static_cast<const char*>(map) + header->storage_offset);
+		return OK;
+	}
+};
+
+}
@@ -0,0 +1,368 @@
+#pragma once
+
+#include "modbus-register.h"
+#include "modbus-latency.h"
+#include <chrono>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace libmodbus_static {
+
+constexpr std::string_view CONNECTION_CLOSED{"CONNECTION_CLOSED"};
+constexpr std::string_view SEND_BUFFER_FULL{"SEND_BUFFER_FULL"};
+
+// identifies a connection of a tcp_linux_server, stays invalid after the connection was closed
+using connection_id = uint64_t;
+
+/**
+ * Handler for complete modbus tcp adus, eg. a modbus_register.
+ * The returned span is sent back to the client, an empty span sends nothing.
+ * Handlers which answer later (eg. a gateway) additionally take the connection_id,
+ * the response is then sent with tcp_linux_server::send.
+ * Handlers with process_tcp_adu_iov (eg. a modbus_register) return large read responses as
+ * header and payload, which are sent with a single scatter gather call
+ */
+template<typename H>
+concept IsTcpAduIovHandler = requires(H h, std::span<const uint8_t> adu) {
+	{ h.process_tcp_adu_iov(adu) } -> std::same_as<response_iov>;
+};
+template<typename H>
+concept IsTcpAduHandler = requires(H h, std::span<const uint8_t> adu, connection_id c) {
+	{ h.process_tcp_adu(adu) } -> std::same_as<result_err>;
+} || requires(H h, std::span<const uint8_t> adu, connection_id c) {
+	{ h.process_tcp_adu(adu, c) } -> std::same_as<result_err>;
+};
+
+/**
+ * Single threaded modbus tcp server transport for linux based on edge triggered epoll.
+ *
+ * Connections are kept open, every connection has its own receive and send buffer, so
+ * pipelined requests of a client are answered in order while other clients are served in
+ * between. If a client does not read its responses the send buffer fills up and the server
+ * stops reading from that connection until the responses could be sent (backpressure).
+ * Connections without traffic for idle_timeout are closed.
+ *
+ * All memory is part of the server object (MAX_CONNECTIONS * 2 * BUFFER_SIZE bytes), so
+ * it should be placed in static storage. Usage:
+ *
+ * static modbus_register<layout> reg{.addr = 1};
+ * static tcp_linux_server<decltype(reg)> server{.handler = reg};
+ * server.init(502);
+ * while (running)
+ *	server.poll(ms(100));
+ */
+template<typename Handler, int MAX_CONNECTIONS = 256, int BUFFER_SIZE = 1024>
+requires IsTcpAduHandler<Handler>
+struct tcp_linux_server {
+	constexpr static int MAX_ADU_SIZE{TCP_ADU_SIZE};
+	constexpr static uint64_t LISTEN_ID{~uint64_t(0)};
+	// smaller payloads are copied into the send buffer, a copy is cheaper than a syscall
+	constexpr static size_t IOV_MIN_PAYLOAD{64};
+	static_assert(BUFFER_SIZE >= MAX_ADU_SIZE, "A connection buffer has to hold at least one adu");
+
+	struct connection {
+		int fd{-1};
+		uint32_t generation{};
+		std::array<uint8_t, BUFFER_SIZE> rx{};
+		int rx_begin{};
+		int rx_end{};
+		std::array<uint8_t, BUFFER_SIZE> tx{};
+		int tx_begin{};
+		int tx_end{};
+		std::chrono::steady_clock::time_point last_activity{};
+		bool readable{};	// edge triggered, the kernel may still hold data
+	};
+
+	Handler &handler;
+	std::chrono::milliseconds idle_timeout{60000};
+	// optional processing time of the handler per unit and function code
+	latency_stats *latency{};
+	int listen_fd{-1};
+	int epoll_fd{-1};
+	std::array<connection, MAX_CONNECTIONS> connections{};
+	std::array<int, MAX_CONNECTIONS> free_slots{};
+	int free_count{};
+	std::chrono::steady_clock::time_point last_idle_check{};
+
+	result init(uint16_t port, int backlog = 128) {
+		for (int i: std::ranges::iota_view{0, MAX_CONNECTIONS})
+			free_slots[i] = MAX_CONNECTIONS - 1 - i;
+		free_count = MAX_CONNECTIONS;
+
+		listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listen_fd < 0)
+			return "SOCKET_FAILED";
+		int one{1};
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = INADDR_ANY;
+		if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+			deinit();
+			return "BIND_FAILED";
+		}
+		if (listen(listen_fd, backlog) < 0) {
+			deinit();
+			return "LISTEN_FAILED";
+		}
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		epoll_event ev{.events = EPOLLIN | EPOLLET, .data = {.u64 = LISTEN_ID}};
+		if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+			deinit();
+			return "EPOLL_FAILED";
+		}
+		last_idle_check = std::chrono::steady_clock::now();
+		return OK;
+	}
+	void deinit() {
+		for (int i: std::ranges::iota_view{0, MAX_CONNECTIONS}) {
+			if (connections[i].fd >= 0)
+				_close(i);
+		}
+		if (epoll_fd >= 0)
+			close(epoll_fd);
+		if (listen_fd >= 0)
+			close(listen_fd);
+		epoll_fd = listen_fd = -1;
+	}
+	// port the server is listening on, useful if it was bound to port 0
+	uint16_t port() const {
+		sockaddr_in addr{};
+		socklen_t len = sizeof(addr);
+		if (getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0)
+			return 0;
+		return ntohs(addr.sin_port);
+	}
+	int connection_count() const { return MAX_CONNECTIONS - free_count; }
+	constexpr connection_id id(int slot) const { return (uint64_t(connections[slot].generation) << 32) | slot; }
+
+	// queues a response on a connection, eg. for responses which were not returned by the handler
+	result send(connection_id c, std::span<const uint8_t> data) {
+		int slot = int(c & 0xffffffff);
+		if (slot >= MAX_CONNECTIONS || connections[slot].fd < 0 || id(slot) != c)
+			return CONNECTION_CLOSED;
+		connection &con = connections[slot];
+		if (BUFFER_SIZE - con.tx_end < int(data.size())) {
+			std::copy(con.tx.begin() + con.tx_begin, con.tx.begin() + con.tx_end, con.tx.begin());
+			con.tx_end -= con.tx_begin;
+			con.tx_begin = 0;
+		}
+		if (BUFFER_SIZE - con.tx_end < int(data.size()))
+			return SEND_BUFFER_FULL;
+		std::ranges::copy(data, con.tx.begin() + con.tx_end);
+		con.tx_end += data.size();
+		if (!_flush(con)) {
+			_close(slot);
+			return CONNECTION_CLOSED;
+		}
+		return OK;
+	}
+
+	// waits at most timeout for socket events and serves all ready connections
+	result poll(std::chrono::milliseconds timeout) {
+		if (epoll_fd < 0)
+			return "SERVER_NOT_INITIALIZED";
+		std::array<epoll_event, 64> events;
+		int n = epoll_wait(epoll_fd, events.data(), events.size(), timeout.count());
+		if (n < 0 && errno != EINTR)
+			return "EPOLL_WAIT_FAILED";
+		for (const epoll_event &ev: events | std::views::take(std::max(n, 0))) {
+			if (ev.data.u64 == LISTEN_ID) {
+				_accept();
+				continue;
+			}
+			int slot = int(ev.data.u64);
+			connection &c = connections[slot];
+			if (c.fd < 0)
+				continue;
+			if (ev.events & (EPOLLERR | EPOLLHUP)) {
+				_close(slot);
+				continue;
+			}
+			if (ev.events & EPOLLIN)
+				c.readable = true;
+			_service(slot);
+		}
+		_close_idle();
+		return OK;
+	}
+
+	// ---------------------------------------------------------------------------------------
+	// Internal connection handling
+	// ---------------------------------------------------------------------------------------
+	void _accept() {
+		while (true) {
+			int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
+				return;
+			if (free_count == 0) {
+				close(fd);
+				continue;
+			}
+			int one{1};
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			int slot = free_slots[--free_count];
+			connection &c = connections[slot];
+			c.fd = fd;
+			++c.generation;
+			c.rx_begin = c.rx_end = c.tx_begin = c.tx_end = 0;
+			c.readable = true;
+			c.last_activity = std::chrono::steady_clock::now();
+			epoll_event ev{.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data = {.u64 = uint64_t(slot)}};
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+				_close(slot);
+				continue;
+			}
+			_service(slot);
+		}
+	}
+	void _close(int slot) {
+		connection &c = connections[slot];
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+		close(c.fd);
+		c.fd = -1;
+		free_slots[free_count++] = slot;
+	}
+	void _close_idle() {
+		auto now = std::chrono::steady_clock::now();
+		if (now - last_idle_check < idle_timeout / 4)
+			return;
+		last_idle_check = now;
+		for (int i: std::ranges::iota_view{0, MAX_CONNECTIONS}) {
+			if (connections[i].fd >= 0 && now - connections[i].last_activity > idle_timeout)
+				_close(i);
+		}
+	}
+	// sends as much of the send buffer as the socket takes, false if the connection died
+	bool _flush(connection &c) {
+		while (c.tx_begin < c.tx_end) {
+			ssize_t n = ::send(c.fd, c.tx.data() + c.tx_begin, c.tx_end - c.tx_begin, MSG_NOSIGNAL);
+			if (n < 0)
+				return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+			c.tx_begin += n;
+		}
+		c.tx_begin = c.tx_end = 0;
+		return true;
+	}
+	// sends the pending send buffer, header and payload with a single call, as the payload
+	// points into the register storage the unsent rest is copied into the send buffer.
+	// There has to be room for a complete adu in the send buffer, false if the connection died
+	bool _send_iov(connection &c, std::span<const uint8_t> header, std::span<const uint8_t> payload) {
+		std::array<iovec, 3> iov{{
+			{c.tx.data() + c.tx_begin, size_t(c.tx_end - c.tx_begin)},
+			{const_cast<uint8_t*>(header.data()), header.size()},
+			{const_cast<uint8_t*>(payload.data()), payload.size()},
+		}};
+		// sendmsg instead of writev, a closed peer must not raise SIGPIPE
+		msghdr msg{};
+		msg.msg_iov = iov.data();
+		msg.msg_iovlen = iov.size();
+		ssize_t n = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return false;
+		size_t sent = std::max<ssize_t>(n, 0);
+		size_t pending = c.tx_end - c.tx_begin;
+		c.tx_begin += std::min(sent, pending);
+		sent -= std::min(sent, pending);
+		if (c.tx_begin == c.tx_end)
+			c.tx_begin = c.tx_end = 0;
+		for (std::span<const uint8_t> part: {header, payload}) {
+			size_t skip = std::min(sent, part.size());
+			sent -= skip;
+			std::ranges::copy(part.subspan(skip), c.tx.begin() + c.tx_end);
+			c.tx_end += part.size() - skip;
+		}
+		return true;
+	}
+	// answers all complete adus in the receive buffer as long as the responses fit into the
+	// send buffer, then reads more data. Stops if the socket would block in either direction
+	void _service(int slot) {
+		connection &c = connections[slot];
+		c.last_activity = std::chrono::steady_clock::now();
+		while (true) {
+			while (c.rx_end - c.rx_begin >= 6) {
+				const uint8_t *adu = c.rx.data() + c.rx_begin;
+				int size = 6 + ((adu[4] << 8) | adu[5]);
+				if (size > MAX_ADU_SIZE || size == 6) {
+					_close(slot);
+					return;
+				}
+				if (c.rx_end - c.rx_begin < size)
+					break;
+				if (BUFFER_SIZE - c.tx_end < MAX_ADU_SIZE) {
+					if (!_flush(c)) {
+						_close(slot);
+						return;
+					}
+					if (c.tx_begin > 0) {
+						std::copy(c.tx.begin() + c.tx_begin, c.tx.begin() + c.tx_end, c.tx.begin());
+						c.tx_end -= c.tx_begin;
+						c.tx_begin = 0;
+					}
+					if (BUFFER_SIZE - c.tx_end < MAX_ADU_SIZE)
+						return; // backpressure, continued on EPOLLOUT
+				}
+				std::span<const uint8_t> request{adu, size_t(size)};
+				response_iov r{};
+				auto start = latency ? std::chrono::steady_clock::now(): std::chrono::steady_clock::time_point{};
+				if constexpr (IsTcpAduIovHandler<Handler>) {
+					r = handler.process_tcp_adu_iov(request);
+				} else if constexpr (requires { handler.process_tcp_adu(request, id(slot)); }) {
+					auto [res, err] = handler.process_tcp_adu(request, id(slot));
+					r = {.header = res, .err = err};
+				} else {
+					auto [res, err] = handler.process_tcp_adu(request);
+					r = {.header = res, .err = err};
+				}
+				if (latency && size > 7)
+					latency->record(adu[6], function_code(adu[7]), std::chrono::steady_clock::now() - start);
+				c.rx_begin += size;
+				if (r.payload.size() >= IOV_MIN_PAYLOAD) {
+					if (!_send_iov(c, r.header, r.payload)) {
+						_close(slot);
+						return;
+					}
+					continue;
+				}
+				for (std::span<const uint8_t> part: {r.header, r.payload}) {
+					std::ranges::copy(part, c.tx.begin() + c.tx_end);
+					c.tx_end += part.size();
+				}
+			}
+			if (!_flush(c)) {
+				_close(slot);
+				return;
+			}
+			if (c.rx_begin > 0) {
+				std::copy(c.rx.begin() + c.rx_begin, c.rx.begin() + c.rx_end, c.rx.begin());
+				c.rx_end -= c.rx_begin;
+				c.rx_begin = 0;
+			}
+			if (!c.readable || c.rx_end == BUFFER_SIZE)
+				return;
+			ssize_t n = recv(c.fd, c.rx.data() + c.rx_end, BUFFER_SIZE - c.rx_end, 0);
+			if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+				_close(slot);
+				return;
+			}
+			if (n < 0) {
+				c.readable = errno == EINTR;
+				if (!c.readable)
+					return;
+				continue;
+			}
+			c.rx_end += n;
+		}
+	}
+};
+
+}
+
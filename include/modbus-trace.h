@@ -0,0 +1,98 @@
+#pragma once
+
+#include "common.h"
+#include <chrono>
+#include <algorithm>
+
+namespace libmodbus_static {
+
+/**
+ * Trace policy of modbus_register/modbus_actor, called on
+ * - frame_start: the unit address of a received frame was parsed
+ * - frame_complete: a received frame is complete and valid
+ * - crc_failure: a received rtu frame had an invalid crc
+ * - exception_sent: an exception response was created
+ * - timeout: a request of an actor timed out
+ */
+template<typename T>
+concept IsTracePolicy = requires(T t, uint8_t unit, function_code fc, exception_code ec, uint16_t size) {
+	t.frame_start(unit);
+	t.frame_complete(unit, fc, size);
+	t.crc_failure(unit, fc);
+	t.exception_sent(unit, fc, ec);
+	t.timeout(unit, fc);
+};
+
+/** Default trace policy, all hooks are empty and compile away */
+struct no_trace {
+	constexpr void frame_start(uint8_t) {}
+	constexpr void frame_complete(uint8_t, function_code, uint16_t) {}
+	constexpr void crc_failure(uint8_t, function_code) {}
+	constexpr void exception_sent(uint8_t, function_code, exception_code) {}
+	constexpr void timeout(uint8_t, function_code) {}
+};
+
+enum struct trace_event: uint8_t {
+	FRAME_START = 0,
+	FRAME_COMPLETE = 1,
+	CRC_FAILURE = 2,
+	EXCEPTION_SENT = 3,
+	TIMEOUT = 4,
+};
+
+/** Binary trace event, time_us is the truncated steady_clock time (wraps after ~71 min) */
+struct trace_record {
+	uint32_t time_us{};
+	uint16_t size{};
+	trace_event event{};
+	uint8_t unit{};
+	function_code fc{};
+	exception_code ec{};
+	constexpr bool operator==(const trace_record &o) const = default;
+};
+
+/**
+ * Trace policy which keeps the last N events in a ring buffer for post mortem dumps.
+ * The records are plain binary data, a dump can be written as is and decoded offline.
+ *
+ * modbus_actor<layout, rtu_io, 1, ring_trace<512>> actor{role_t::CLIENT, layout{}};
+ * ...
+ * std::array<trace_record, 512> dump;
+ * int n = actor.trace.copy_to(dump);
+ */
+template<int N = 256>
+struct ring_trace {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "N has to be a power of two to stay ordered on wrap around");
+	std::array<trace_record, N> records{};
+	uint32_t written{};
+
+	constexpr void frame_start(uint8_t unit) { push({.event = trace_event::FRAME_START, .unit = unit}); }
+	constexpr void frame_complete(uint8_t unit, function_code fc, uint16_t size) {
+		push({.size = size, .event = trace_event::FRAME_COMPLETE, .unit = unit, .fc = fc});
+	}
+	constexpr void crc_failure(uint8_t unit, function_code fc) { push({.event = trace_event::CRC_FAILURE, .unit = unit, .fc = fc}); }
+	constexpr void exception_sent(uint8_t unit, function_code fc, exception_code ec) {
+		push({.event = trace_event::EXCEPTION_SENT, .unit = unit, .fc = fc, .ec = ec});
+	}
+	constexpr void timeout(uint8_t unit, function_code fc) { push({.event = trace_event::TIMEOUT, .unit = unit, .fc = fc}); }
+
+	constexpr void push(trace_record r) {
+		r.time_us = uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+		records[written++ % N] = r;
+	}
+	constexpr int size() const { return std::min<uint32_t>(written, N); }
+	// i-th stored record, 0 is the oldest
+	constexpr const trace_record& operator[](int i) const { return records[(written - size() + i) % N]; }
+	// copies the stored records oldest first, returns the number of copied records
+	constexpr int copy_to(std::span<trace_record> dst) const {
+		int n = std::min<int>(size(), dst.size());
+		for (int i: std::ranges::iota_view{0, n})
+			dst[i] = (*this)[size() - n + i];
+		return n;
+	}
+	constexpr void clear() { written = 0; }
+};
+
+}
+
@@ -1,7 +1,22 @@
 #include <cassert>
-#include <modbus-register.h>
+#include <modbus-actor.h>
+#include <modbus-coroutine.h>
+#include <modbus-poll-scheduler.h>
+#include <modbus-tcp-linux-server.h>
+#include <modbus-gateway.h>
+#include <modbus-mirror.h>
+#include <modbus-loopback.h>
+#include <modbus-rtu-linux.h>
+#include <modbus-multi-server.h>
+#include <modbus-shm-linux.h>
+#include <modbus-persist-linux.h>
+#include <modbus-recorder.h>
+#include <modbus-deadband.h>
+#include "test-layouts.h"
 #include <iostream>
 #include <vector>
+#include <atomic>
+#include <filesystem>
 #include <print>
 #include <ranges>
 
@@ -23,116 +38,146 @@ struct ExcludeLast{};
 template<typename T>
 constexpr auto operator|(const T &v, ExcludeLast) { return v | std::ranges::views::take(v.size() - 1); }
 
-struct bitset_test {
-	constexpr static int OFFSET{20};
-	bool a: 1{};
-	bool b: 1{};
-	bool c: 1{};
-	bool d: 1{};
-	bool e: 1{};
-	bool f: 1{};
-	bool g: 1{};
-	bool h: 1{};
-	bool i: 1{};
-	bool j: 1{};
-	bool k: 1{};
-	bool l: 1{};
-	bool m: 1{};
-	bool n: 1{};
-	bool o: 1{};
-	bool p: 1{};
-	bool q: 1{};
-	bool r: 1{};
-	bool s: 1{};
-	bool t: 1{};
-	bool u: 1{};
-	bool v: 1{};
-	bool w: 1{};
-	bool x: 1{};
-	bool y: 1{};
-	bool z: 1{};
+using e = example_layout;
+using t = test_layout;
+
+// in memory tcp transport, bytes written by the actor are collected in to_server,
+// bytes in to_client are returned on the next read
+struct fake_tcp_io {
+	static constexpr transport_t TRANSPORT_TYPE{transport_t::TCP};
+	std::vector<uint8_t> *to_server{};
+	std::vector<uint8_t> *to_client{};
+	std::vector<uint8_t> receive_buffer{};
+	void init() {}
+	void deinit() {}
+	std::span<uint8_t> read_bytes(std::chrono::milliseconds) {
+		receive_buffer = *to_client;
+		to_client->clear();
+		return receive_buffer;
+	}
+	void write_bytes(std::span<uint8_t> data) { to_server->insert(to_server->end(), data.begin(), data.end()); }
+	bool readable() const { return !to_client->empty(); }
 };
-struct bitset_test_2 {
-	constexpr static int OFFSET{10};
-	bool a: 1{};
-	bool b: 1{};
-	bool c: 1{};
-	bool d: 1{};
-	bool e: 1{};
-	bool f: 1{};
-	bool g: 1{};
-	bool h: 1{};
-	bool i: 1{};
-	bool j: 1{};
-	bool k: 1{};
-	bool l: 1{};
-	bool m: 1{};
-	bool n: 1{};
-	bool o: 1{};
-	bool p: 1{};
-	bool q: 1{};
-	bool r: 1{};
-	bool s: 1{};
-	bool t: 1{};
-	bool u: 1{};
-	bool v: 1{};
-	bool w: 1{};
-	bool x: 1{};
-	bool y: 1{};
-	bool z: 1{};
+
+// tcp transport on one end of a socketpair, counts how often it is checked for data
+struct socket_tcp_io {
+	static constexpr transport_t TRANSPORT_TYPE{transport_t::TCP};
+	int fd{-1};
+	int *readable_calls{};
+	std::array<uint8_t, TCP_ADU_SIZE> receive_buffer{};
+	void init() {}
+	void deinit() {}
+	std::span<uint8_t> read_bytes(std::chrono::milliseconds) {
+		ssize_t n = read(fd, receive_buffer.data(), receive_buffer.size());
+		return {receive_buffer.data(), size_t(std::max<ssize_t>(n, 0))};
+	}
+	void write_bytes(std::span<uint8_t> data) { assert(write(fd, data.data(), data.size()) == ssize_t(data.size())); }
+	bool readable() {
+		++*readable_calls;
+		pollfd p{.fd = fd, .events = POLLIN, .revents = 0};
+		return ::poll(&p, 1, 0) > 0;
+	}
+	int poll_fd() const { return fd; }
 };
 
-#pragma pack(push, 1)
-struct example_layout {
-	struct bits_layout {
-		constexpr static int OFFSET{0};
-		bool enabled: 1{};
-		bool active: 1{};
-		bool visible: 1{};
-		bool trusted: 1{};
-		bool uknown: 1{};
-	} bits_registers;
-	// if eg. no discrete inputs are used, just leave them out else
-	// struct bits_write_layout {
-	// 	constexpr static int OFFSET{256};
-	//	bool setable: 1{};
-	// } bits_write_registers;
-	struct halfs_layout {
-		constexpr static int OFFSET{40000};
-		float a{};
-		float b{};
-		uint16_t another{};
-		mod_string<32> string_field{"Default"}; // careful with default inited strings, have to be byte swapped
-		uint32_t events{};
-	} halfs_registers;
-	struct halfs_write_layout {
-		constexpr static int OFFSET{60000};
-		float a{};
-		float b{};
-		uint16_t others{};
-	} halfs_write_registers;
+// answers all tcp requests in the byte stream, requests for other units are dropped
+template<typename Server>
+std::vector<std::vector<uint8_t>> serve_tcp_requests(Server &server, std::vector<uint8_t> &requests) {
+	std::vector<std::vector<uint8_t>> responses;
+	server.switch_to_request();
+	for (uint8_t b: requests) {
+		std::string_view r = server.process_tcp(b).err;
+		if (r == IN_PROGRESS)
+			continue;
+		if (r == WRONG_ADDR) {
+			server.switch_to_request();
+			continue;
+		}
+		assert(r == OK);
+		auto [res, err] = server.get_frame_response();
+		assert(err == OK);
+		responses.emplace_back(res.begin(), res.end());
+		server.switch_to_request();
+	}
+	requests.clear();
+	return responses;
+}
+
+using test_actor = modbus_actor<test_layout, fake_tcp_io, 4>;
+
+// rtu bus with a single server, frames for other addresses stay unanswered
+struct serving_rtu_io {
+	static constexpr transport_t TRANSPORT_TYPE{transport_t::RTU};
+	modbus_register<test_layout> *server{};
+	int *request_count{};
+	std::vector<uint8_t> to_client{};
+	std::vector<uint8_t> receive_buffer{};
+	void init() {}
+	void deinit() {}
+	std::span<uint8_t> read_bytes(std::chrono::milliseconds) {
+		receive_buffer = std::exchange(to_client, {});
+		return receive_buffer;
+	}
+	void write_bytes(std::span<uint8_t> data) {
+		if (request_count)
+			++*request_count;
+		server->switch_to_request();
+		for (uint8_t b: data) {
+			std::string_view r = server->process_rtu(b).err;
+			if (r == IN_PROGRESS)
+				continue;
+			if (r != OK)
+				return;
+			auto [res, err] = server->get_frame_response();
+			if (err != OK)
+				r_tie{res, err} = server->get_frame_error_response(err);
+			to_client.insert(to_client.end(), res.begin(), res.end());
+		}
+	}
 };
-struct test_layout {
-	bitset_test bits_registers{};
-	bitset_test_2 bits_write_registers{};
-	struct halfs_layout {
-		constexpr static int OFFSET{0};
-		uint16_t r1{};
-		uint16_t r2{};
-		uint16_t r3{};
-		uint16_t r4{};
-	} halfs_registers;
-	struct halfs_write_layout {
-		constexpr static int OFFSET{0};
-		uint16_t r1{};
-		uint16_t r2{};
-		uint16_t r3{};
-		uint16_t r4{};
-	} halfs_write_registers;
+
+// tcp transport directly answered by a server, counts the requests it got
+template<typename Server>
+struct serving_tcp_io_t {
+	static constexpr transport_t TRANSPORT_TYPE{transport_t::TCP};
+	Server *server{};
+	int *request_count{};
+	std::vector<uint8_t> to_client{};
+	std::vector<uint8_t> receive_buffer{};
+	void init() {}
+	void deinit() {}
+	std::span<uint8_t> read_bytes(std::chrono::milliseconds) {
+		receive_buffer = std::exchange(to_client, {});
+		return receive_buffer;
+	}
+	void write_bytes(std::span<uint8_t> data) {
+		std::vector<uint8_t> request{data.begin(), data.end()};
+		for (auto &r: serve_tcp_requests(*server, request))
+			to_client.insert(to_client.end(), r.begin(), r.end());
+		++*request_count;
+	}
 };
-#pragma pack(pop)
-using e = example_layout;
-using t = test_layout;
+using serving_tcp_io = serving_tcp_io_t<modbus_register<test_layout>>;
+
+// reads r1 and depending on its value r2 or r3, the value read last is returned
+task<uint16_t> read_chain(test_actor &actor, uint8_t unit) {
+	result r = co_await actor.read_remote_async(unit, &t::halfs_layout::r1);
+	if (r != OK)
+		co_return 0;
+	if (actor.read(&t::halfs_layout::r1) % 2) {
+		r = co_await actor.read_remote_async(unit, &t::halfs_layout::r2);
+		co_return r == OK ? actor.read(&t::halfs_layout::r2): 0;
+	}
+	r = co_await actor.read_remote_async(unit, &t::halfs_layout::r3);
+	co_return r == OK ? actor.read(&t::halfs_layout::r3): 0;
+}
+task<void> device_conversation(test_actor &actor, uint8_t unit, uint16_t *out) {
+	*out = co_await read_chain(actor, unit);
+}
+template<typename Actor>
+task<void> timed_read(Actor &actor, uint8_t unit, ms timeout, result *out) {
+	*out = co_await actor.read_remote_async(unit, &t::halfs_layout::r1, timeout);
+}
 
 int main() {
 	std::cout << "---------------------------------------------------------------------------------------\n";
@@ -192,7 +237,7 @@ int main() {
 	std::cout << "Client tests\n";
 	std::cout << "---------------------------------------------------------------------------------------\n";
 
-	modbus_register<test_layout>& client_test{modbus_register<test_layout>::Default(0)};
+	modbus_register<test_layout>& client_test{modbus_register<test_layout>::DefaultClient()};
 
 	std::println("Test read bits from bits registers");
 	assert(client_test.start_rtu_frame(1) == OK);
@@ -275,7 +320,7 @@ int main() {
 	std::vector<uint8_t> invalid_read_response = {0x01, 0x03, 0x02, 0x00, 0x06};
 	for (uint8_t b: invalid_read_response)
 		assert(client_test.process_rtu(b).err == IN_PROGRESS);
-	uint16_t cs = checksum::calculate_crc16(client_test.buffer.frame_data.span());
+	uint16_t cs = checksum::calculate_crc16(client_test.buffer().frame_data.span());
 	assert(client_test.process_rtu(l_byte(cs)).err == IN_PROGRESS);
 	assert(client_test.process_rtu(h_byte(cs)).err == INVALID_RESPONSE);
 	std::println("Valid response");
@@ -337,7 +382,7 @@ int main() {
 	assert(client_test.process_rtu(solution1[3]).err == IN_PROGRESS);
 	assert(client_test.process_rtu(solution1[4]).err == IN_PROGRESS);
 	assert(client_test.process_rtu(42).err == IN_PROGRESS);
-	cs = checksum::calculate_crc16(client_test.buffer.frame_data.span());
+	cs = checksum::calculate_crc16(client_test.buffer().frame_data.span());
 	assert(client_test.process_rtu(l_byte(cs)).err == IN_PROGRESS);
 	assert(client_test.process_rtu(h_byte(cs)).err == INVALID_RESPONSE);
 
@@ -477,6 +522,1713 @@ int main() {
 	assert(err == OK);
 	assert(res == tcp_valid_response);
 
+	std::println("transaction id and rtu address 0x3a (':') are no ascii frames");
+	assert(client_test.start_tcp_frame(0x3a00, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_layout::r4);
+	assert(err == OK && res.size() == 12 && res[0] == 0x3a);
+	assert(client_test.start_rtu_frame(0x3a) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_layout::r4);
+	assert(err == OK && res.size() == 8 && res[0] == 0x3a);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Pipelined TCP client test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	using lc_t = modbus_register<test_layout>::last_completed;
+	assert((lc_t{.tcp_tid = 1, .addr = 1} != lc_t{.tcp_tid = 2, .addr = 1}));
+
+	std::vector<uint8_t> to_server, to_client;
+	modbus_actor<test_layout, fake_tcp_io, 4> pipelined{role_t::CLIENT, test_layout{}, fake_tcp_io{&to_server, &to_client}};
+	test_server.write(uint16_t(11), &t::halfs_layout::r1);
+	test_server.write(uint16_t(12), &t::halfs_layout::r2);
+	test_server.write(uint16_t(13), &t::halfs_layout::r3);
+	test_server.write(uint16_t(14), &t::halfs_write_layout::r4);
+
+	request_handle h1 = pipelined.submit_read(1, &t::halfs_layout::r1);
+	request_handle h2 = pipelined.submit_read(1, &t::halfs_layout::r2, &t::halfs_layout::r3);
+	request_handle h3 = pipelined.submit_read(1, &t::halfs_write_layout::r4);
+	request_handle h4 = pipelined.submit_read(1, libmodbus_static::register_t::HALFS, 0, 4);
+	assert(h1.valid() && h2.valid() && h3.valid() && h4.valid());
+	assert(pipelined.submit_read(1, &t::halfs_layout::r1).err == IN_FLIGHT_FULL);
+	assert(pipelined.in_flight_count() == 4);
+	assert(pipelined.take(h1) == IN_PROGRESS);
+
+	std::vector<std::vector<uint8_t>> responses = serve_tcp_requests(test_server, to_server);
+	assert(responses.size() == 4);
+	// deliver the responses out of order and fragmented over two reads
+	for (auto &r: responses | std::views::reverse | std::views::take(3))
+		to_client.insert(to_client.end(), r.begin(), r.end());
+	to_client.insert(to_client.end(), responses[0].begin(), responses[0].begin() + 5);
+	pipelined.poll();
+	assert(pipelined.take(h1) == IN_PROGRESS);
+	assert(pipelined.take(h2) == OK);
+	assert(pipelined.take(h3) == OK);
+	assert(pipelined.take(h4) == OK);
+	assert(pipelined.take(h4) == UNKNOWN_REQUEST);
+	to_client.insert(to_client.end(), responses[0].begin() + 5, responses[0].end());
+	pipelined.poll();
+	assert(pipelined.take(h1) == OK);
+	assert(pipelined.in_flight_count() == 0);
+	assert(pipelined.read(&t::halfs_layout::r1) == 11);
+	assert(pipelined.read(&t::halfs_layout::r2) == 12);
+	assert(pipelined.read(&t::halfs_layout::r3) == 13);
+	assert(pipelined.read(&t::halfs_write_layout::r4) == 14);
+
+	std::println("Response with unknown transaction id is dropped");
+	h1 = pipelined.submit_read(1, &t::halfs_layout::r1, ms(0));
+	responses = serve_tcp_requests(test_server, to_server);
+	responses[0][1] ^= 0xff;
+	to_client = responses[0];
+	pipelined.poll();
+	assert(pipelined.take(h1) == TIMEOUT);
+
+	std::println("Submissions wait while a response is parsed in the frame");
+	h1 = pipelined.submit_read(1, &t::halfs_layout::r1, ms(1000));
+	responses = serve_tcp_requests(test_server, to_server);
+	to_client.assign(responses[0].begin(), responses[0].begin() + 8);
+	pipelined.poll();
+	assert(pipelined.take(h1) == IN_PROGRESS);
+	assert(pipelined.submit_read(1, &t::halfs_layout::r2).err == IN_FLIGHT_FULL);
+	to_client.assign(responses[0].begin() + 8, responses[0].end());
+	pipelined.poll();
+	assert(pipelined.take(h1) == OK && pipelined.read(&t::halfs_layout::r1) == 11);
+
+	std::println("A stream with an invalid mbap length fails the transport");
+	auto failures_before = pipelined.health(1).failures;
+	h1 = pipelined.submit_read(1, &t::halfs_layout::r1, ms(1000));
+	h2 = pipelined.submit_read(1, &t::halfs_layout::r2, ms(1000));
+	responses = serve_tcp_requests(test_server, to_server);
+	// a length of 0 can not be split into adus, the following bytes are misaligned
+	to_client = {0, 99, 0, 0, 0, 0};
+	to_client.insert(to_client.end(), responses[0].begin(), responses[0].end());
+	assert(pipelined.poll() == TRANSPORT_FAILED);
+	assert(pipelined.take(h1) == TRANSPORT_FAILED && pipelined.take(h2) == TRANSPORT_FAILED);
+	assert(pipelined.submit_read(1, &t::halfs_layout::r1).err == TRANSPORT_FAILED);
+	assert(pipelined.health(1).failures == failures_before);
+	pipelined.reset_transport();
+	to_client.clear();
+	h1 = pipelined.submit_read(1, &t::halfs_layout::r1, ms(1000));
+	to_client = serve_tcp_requests(test_server, to_server)[0];
+	assert(pipelined.poll() == OK && pipelined.take(h1) == OK);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Coroutine test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	struct device {
+		std::vector<uint8_t> to_server, to_client;
+		test_actor actor{role_t::CLIENT, test_layout{}, fake_tcp_io{&to_server, &to_client}};
+		uint16_t out{};
+	};
+	std::array<device, 3> devices{};
+	executor<4> exec{};
+	// the network: the test server answers whatever the actors have sent
+	exec.idle_ctx = &devices;
+	exec.idle = [](void *ctx) {
+		for (device &d: *static_cast<std::array<device, 3>*>(ctx)) {
+			for (auto &r: serve_tcp_requests(modbus_register<test_layout>::Default<1>(1), d.to_server))
+				d.to_client.insert(d.to_client.end(), r.begin(), r.end());
+		}
+	};
+	test_server.write(uint16_t(11), &t::halfs_layout::r1);
+	int frames_before = coroutine_frame_pool().used;
+	for (device &d: devices) {
+		assert(exec.attach(d.actor) == OK);
+		assert(exec.spawn(device_conversation(d.actor, 1, &d.out)) == OK);
+	}
+	exec.run();
+	for (device &d: devices)
+		assert(d.out == 12);
+	assert(coroutine_frame_pool().used == frames_before);
+	assert(exec.running == 0);
+
+	std::println("Tasks beyond the ready queue size are rejected");
+	executor<4, 2> small_exec{};
+	small_exec.idle_ctx = &devices;
+	small_exec.idle = exec.idle;
+	for (device &d: devices)
+		assert(small_exec.attach(d.actor) == OK);
+	assert(small_exec.spawn(device_conversation(devices[0].actor, 1, &devices[0].out)) == OK);
+	assert(small_exec.spawn(device_conversation(devices[1].actor, 1, &devices[1].out)) == OK);
+	assert(small_exec.spawn(device_conversation(devices[2].actor, 1, &devices[2].out)) == EXECUTOR_FULL);
+	assert(coroutine_frame_pool().used == frames_before + 2);
+	small_exec.run();
+	assert(small_exec.running == 0 && coroutine_frame_pool().used == frames_before);
+
+	std::println("A waiting executor blocks on the sockets of its actors");
+	std::array<int, 2> sockets{};
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets.data()) == 0);
+	int readable_calls{};
+	modbus_actor<test_layout, socket_tcp_io, 4> socket_actor{role_t::CLIENT, test_layout{}, socket_tcp_io{.fd = sockets[0], .readable_calls = &readable_calls}};
+	executor<4> blocking_exec{};
+	assert(blocking_exec.attach(socket_actor) == OK);
+	// the device answers after 50 ms
+	std::thread slow_device([&] {
+		pollfd p{.fd = sockets[1], .events = POLLIN, .revents = 0};
+		assert(::poll(&p, 1, 1000) == 1);
+		std::vector<uint8_t> request(TCP_ADU_SIZE);
+		request.resize(std::max<ssize_t>(read(sockets[1], request.data(), request.size()), 0));
+		std::this_thread::sleep_for(ms(50));
+		for (auto &r: serve_tcp_requests(test_server, request))
+			assert(write(sockets[1], r.data(), r.size()) == ssize_t(r.size()));
+	});
+	result slow_read{IN_PROGRESS};
+	auto blocking_start = std::chrono::steady_clock::now();
+	assert(blocking_exec.spawn(timed_read(socket_actor, 1, ms(1000), &slow_read)) == OK);
+	blocking_exec.run();
+	slow_device.join();
+	assert(slow_read == OK && socket_actor.read(&t::halfs_layout::r1) == 11);
+	assert(std::chrono::steady_clock::now() - blocking_start >= ms(50));
+	// a spinning executor checks the socket thousands of times
+	assert(readable_calls < 10);
+
+	std::println("The earliest deadline ends the wait");
+	readable_calls = 0;
+	result lost_read{IN_PROGRESS};
+	blocking_start = std::chrono::steady_clock::now();
+	assert(blocking_exec.spawn(timed_read(socket_actor, 1, ms(30), &lost_read)) == OK);
+	blocking_exec.run();
+	assert(lost_read == TIMEOUT && std::chrono::steady_clock::now() - blocking_start >= ms(30));
+	assert(readable_calls < 10);
+	close(sockets[0]);
+	close(sockets[1]);
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "TCP server test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Write multiple registers");
+	client_test.write(uint16_t(0x1234), &t::halfs_write_layout::r1);
+	client_test.write(uint16_t(0x5678), &t::halfs_write_layout::r2);
+	assert(client_test.start_tcp_frame(20, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r1, &t::halfs_write_layout::r2);
+	assert(err == OK);
+	r_tie{res, err} = test_server.process_tcp_adu(res);
+	std::vector<uint8_t> write_registers_echo{0, 20, 0, 0, 0, 6, 1, 16, 0, 0, 0, 2};
+	std::println("Write registers response: {}", res);
+	assert(err == OK);
+	assert(res == write_registers_echo);
+	assert(test_server.read(&t::halfs_write_layout::r1) == 0x1234);
+	assert(test_server.read(&t::halfs_write_layout::r2) == 0x5678);
+
+	std::println("Write single register");
+	client_test.write(uint16_t(0x0102), &t::halfs_write_layout::r3);
+	assert(client_test.start_tcp_frame(21, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r3);
+	assert(err == OK);
+	std::vector<uint8_t> write_register_request{res.begin(), res.end()};
+	r_tie{res, err} = test_server.process_tcp_adu(write_register_request);
+	assert(err == OK);
+	assert(res == write_register_request);
+	assert(test_server.read(&t::halfs_write_layout::r3) == 0x0102);
+
+	std::println("Write single and multiple coils");
+	test_server.storage.bits_write_registers = {};
+	client_test.storage.bits_write_registers = bitset_test_2{.c = true};
+	assert(client_test.start_tcp_frame(22, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(bitset_test_2{.c = true});
+	assert(err == OK);
+	r_tie{res, err} = test_server.process_tcp_adu(res);
+	assert(err == OK);
+	assert(test_server.storage.bits_write_registers.c);
+	client_test.storage.bits_write_registers = bitset_test_2{.b = true, .d = true, .e = true};
+	assert(client_test.start_tcp_frame(23, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(bitset_test_2{.b = true, .e = true});
+	assert(err == OK);
+	r_tie{res, err} = test_server.process_tcp_adu(res);
+	assert(err == OK);
+	assert(test_server.storage.bits_write_registers.b);
+	assert(!test_server.storage.bits_write_registers.c);
+	assert(test_server.storage.bits_write_registers.d);
+	assert(test_server.storage.bits_write_registers.e);
+	assert(!test_server.storage.bits_write_registers.f);
+
+	std::println("Write outside of the layout");
+	std::array<uint8_t, 4> out_of_range{};
+	assert(client_test.start_tcp_frame(24, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(libmodbus_static::register_t::HALFS_WRITE, 3, out_of_range);
+	assert(err == OK);
+	r_tie{res, err} = test_server.process_tcp_adu(res);
+	std::vector<uint8_t> illegal_address_response{0, 24, 0, 0, 0, 3, 1, 0x90, 2};
+	std::println("Exception response: {}", res);
+	assert(err == OK);
+	assert(res == illegal_address_response);
+
+	std::println("Persistent connection with pipelined requests");
+	static tcp_linux_server<modbus_register<test_layout>, 4> tcp_server{.handler = test_server};
+	static latency_stats server_latency{};
+	tcp_server.latency = &server_latency;
+	assert(tcp_server.init(0) == OK);
+	int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in server_addr{};
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(tcp_server.port());
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(connect(client_fd, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) == 0);
+	std::vector<uint8_t> received;
+	auto exchange = [&](std::span<const uint8_t> request, size_t response_size) {
+		received.clear();
+		assert(send(client_fd, request.data(), request.size(), 0) == ssize_t(request.size()));
+		for (int i = 0; i < 100 && received.size() < response_size; ++i) {
+			assert(tcp_server.poll(ms(10)) == OK);
+			std::array<uint8_t, 512> buf;
+			ssize_t n = recv(client_fd, buf.data(), buf.size(), MSG_DONTWAIT);
+			if (n > 0)
+				received.insert(received.end(), buf.begin(), buf.begin() + n);
+		}
+		assert(received.size() == response_size);
+	};
+	test_server.write(uint16_t(11), &t::halfs_layout::r1);
+	test_server.write(uint16_t(12), &t::halfs_layout::r2);
+	std::vector<uint8_t> pipelined_requests;
+	assert(client_test.start_tcp_frame(30, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_layout::r1);
+	pipelined_requests.insert(pipelined_requests.end(), res.begin(), res.end());
+	assert(client_test.start_tcp_frame(31, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_layout::r1, &t::halfs_layout::r2);
+	pipelined_requests.insert(pipelined_requests.end(), res.begin(), res.end());
+	exchange(pipelined_requests, 11 + 13);
+	std::vector<uint8_t> pipelined_responses{0, 30, 0, 0, 0, 5, 1, 3, 2, 0, 11,
+		0, 31, 0, 0, 0, 7, 1, 3, 4, 0, 11, 0, 12};
+	std::println("Pipelined responses: {}", received);
+	assert(received == pipelined_responses);
+	std::println("Same connection serves the next request");
+	exchange(write_register_request, write_register_request.size());
+	assert(received == write_register_request);
+	assert(tcp_server.connection_count() == 1);
+	std::println("Server processing times are recorded per function code");
+	assert(server_latency.find(1, function_code::READ_HOLDING_REGISTERS)->count() == 2);
+	assert(server_latency.find(1, function_code::WRITE_SINGLE_REGISTER)->count() == 1);
+	assert(!server_latency.find(2, function_code::READ_HOLDING_REGISTERS));
+	close(client_fd);
+	for (int i = 0; i < 100 && tcp_server.connection_count(); ++i)
+		tcp_server.poll(ms(10));
+	assert(tcp_server.connection_count() == 0);
+	tcp_server.deinit();
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Poll plan test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Adjacent and nearby fields are merged");
+	auto plan = make_poll_plan<test_layout>(poll_plan_config{}, &t::halfs_layout::r4, &t::halfs_layout::r1,
+		&t::halfs_write_layout::r2, bitset_test{.b = true, .x = true}, bitset_test_2{.c = true});
+	assert(plan.size() == 4);
+	assert((plan[0] == poll_request{libmodbus_static::register_t::BITS, 21, 23}));
+	assert((plan[1] == poll_request{libmodbus_static::register_t::BITS_WRITE, 12, 1}));
+	assert((plan[2] == poll_request{libmodbus_static::register_t::HALFS, 0, 4}));
+	assert((plan[3] == poll_request{libmodbus_static::register_t::HALFS_WRITE, 1, 1}));
+	std::println("Gaps larger than the limit are not merged");
+	auto split_plan = make_poll_plan<test_layout>(poll_plan_config{.max_register_gap = 0, .max_bit_gap = 4},
+		&t::halfs_layout::r4, &t::halfs_layout::r1, &t::halfs_layout::r2, bitset_test{.b = true, .x = true});
+	assert(split_plan.size() == 4);
+	assert((split_plan[2] == poll_request{libmodbus_static::register_t::HALFS, 0, 2}));
+	assert((split_plan[3] == poll_request{libmodbus_static::register_t::HALFS, 3, 1}));
+	std::println("Requests are limited in size");
+	auto limited_plan = make_poll_plan<test_layout>(poll_plan_config{.max_registers = 3}, &t::halfs_layout::r1, &t::halfs_layout::r4);
+	assert(limited_plan.size() == 2);
+	assert((limited_plan[0] == poll_request{libmodbus_static::register_t::HALFS, 0, 1}));
+	assert((limited_plan[1] == poll_request{libmodbus_static::register_t::HALFS, 3, 1}));
+
+	std::println("Plan is read by the actor");
+	int request_count{};
+	modbus_actor<test_layout, serving_tcp_io, 2> plan_client{role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &request_count}};
+	test_server.write(uint16_t(21), &t::halfs_layout::r1);
+	test_server.write(uint16_t(24), &t::halfs_layout::r4);
+	test_server.write(uint16_t(32), &t::halfs_write_layout::r2);
+	test_server.storage.bits_registers.x = true;
+	assert(plan_client.read_remote(1, plan) == OK);
+	assert(request_count == plan.size());
+	assert(plan_client.read(&t::halfs_layout::r1) == 21);
+	assert(plan_client.read(&t::halfs_layout::r4) == 24);
+	assert(plan_client.read(&t::halfs_write_layout::r2) == 32);
+	assert(plan_client.storage.bits_registers.x);
+	assert(plan_client.in_flight_count() == 0);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Poll scheduler test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Earliest deadline is dispatched first");
+	auto fast_plan = make_poll_plan<test_layout>(poll_plan_config{}, &t::halfs_layout::r1);
+	auto slow_plan = make_poll_plan<test_layout>(poll_plan_config{}, &t::halfs_layout::r2, &t::halfs_write_layout::r1);
+	auto once_plan = make_poll_plan<test_layout>(poll_plan_config{.max_registers = 1}, &t::halfs_layout::r3, &t::halfs_layout::r4);
+	request_count = 0;
+	modbus_actor<test_layout, serving_tcp_io, 1> sched_client{role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &request_count}};
+	poll_scheduler<decltype(sched_client), 4> sched{sched_client};
+	int once_group{}, fast_group{}, slow_group{};
+	assert(sched.add_group(1, once_plan, ms(0), ms(0), &once_group) == OK);
+	assert(sched.add_group(1, fast_plan, ms(10), ms(0), &fast_group) == OK);
+	assert(sched.add_group(1, slow_plan, ms(50), ms(0), &slow_group) == OK);
+	assert(sched.poll() == OK);
+	assert(sched.groups[fast_group].stats.cycles == 1);
+	assert(sched.groups[slow_group].stats.cycles == 0);
+	assert(sched.groups[once_group].stats.cycles == 0);
+
+	std::println("Groups are read with their period");
+	auto sched_start = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - sched_start < ms(105))
+		assert(sched.poll(ms(5)) == OK);
+	const poll_group_stats &fast_stats = sched.groups[fast_group].stats;
+	const poll_group_stats &slow_stats = sched.groups[slow_group].stats;
+	std::println("fast cycles {}, skipped {}, late {}, jitter max {}us", fast_stats.cycles, fast_stats.skipped, fast_stats.late, fast_stats.jitter_max.count());
+	assert(sched.groups[once_group].stats.cycles == 1);
+	assert(!sched.groups[once_group].active);
+	assert(fast_stats.cycles >= 8 && fast_stats.cycles <= 12);
+	assert(slow_stats.cycles >= 2 && slow_stats.cycles <= 3);
+	assert(fast_stats.errors == 0 && slow_stats.errors == 0);
+	assert(request_count == int(fast_stats.cycles + 2 * slow_stats.cycles + 2));
+	assert(sched_client.read(&t::halfs_layout::r4) == 24);
+
+	std::println("Failed requests are counted");
+	sched.remove_group(fast_group);
+	sched.remove_group(slow_group);
+	while (sched.busy())
+		sched.poll(ms(1));
+	auto bad_plan = make_poll_plan<test_layout>(poll_plan_config{}, &t::halfs_layout::r1);
+	int bad_group{};
+	sched_client.timeouts = timeout_config{.initial = ms(5), .min = ms(1)};
+	assert(sched.add_group(2, bad_plan, ms(0), ms(5), &bad_group) == OK);
+	while (sched.busy())
+		sched.poll(ms(1));
+	assert(sched.groups[bad_group].stats.errors == 1);
+	assert(sched.groups[bad_group].stats.last_result == TIMEOUT);
+	assert(sched.add_group(1, bad_plan, ms(0)) == SCHEDULER_FULL);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Gateway test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	struct gateway_responses {
+		std::vector<uint8_t> adu;
+		uint64_t connection{};
+	} gateway_out;
+	static modbus_gateway<serving_rtu_io, 4> gateway{.io = serving_rtu_io{&test_server}};
+	gateway.route(1, 2);
+	gateway.on_response_ctx = &gateway_out;
+	gateway.on_response = [](void *ctx, uint64_t connection, std::span<const uint8_t> adu) {
+		auto &out = *static_cast<gateway_responses*>(ctx);
+		out.adu.assign(adu.begin(), adu.end());
+		out.connection = connection;
+	};
+
+	std::println("Read request is forwarded to the rtu bus");
+	assert(client_test.start_tcp_frame(40, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_layout::r1, &t::halfs_layout::r2);
+	std::vector<uint8_t> gateway_request{res.begin(), res.end()};
+	r_tie{res, err} = gateway.process_tcp_adu(gateway_request, 7);
+	assert(err == OK && res.empty());
+	assert(gateway.queued() == 1);
+	gateway.poll();
+	gateway.poll();
+	assert(gateway.queued() == 0);
+	r_tie{res, err} = test_server.process_tcp_adu(gateway_request);
+	std::println("Gateway response: {}", gateway_out.adu);
+	assert(gateway_out.connection == 7);
+	assert(res == gateway_out.adu);
+
+	std::println("Exception of the device is forwarded");
+	assert(client_test.start_tcp_frame(41, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(libmodbus_static::register_t::HALFS_WRITE, 3, out_of_range);
+	r_tie{res, err} = gateway.process_tcp_adu(res, 7);
+	assert(err == OK);
+	gateway.poll();
+	gateway.poll();
+	std::vector<uint8_t> forwarded_exception{0, 41, 0, 0, 0, 3, 1, 0x90, 2};
+	assert(gateway_out.adu == forwarded_exception);
+
+	std::println("Unknown unit is not routed");
+	gateway_request[6] = 5;
+	r_tie{res, err} = gateway.process_tcp_adu(gateway_request, 7);
+	std::vector<uint8_t> path_unavailable{0, 40, 0, 0, 0, 3, 5, 0x83, 0x0a};
+	assert(err == NO_ROUTE);
+	assert(res == path_unavailable);
+
+	std::println("Device which does not answer times out, full queue is busy");
+	gateway.timeout = ms(5);
+	gateway.max_per_unit = 1;
+	gateway_request[6] = 2;
+	assert(gateway.process_tcp_adu(gateway_request, 8).err == OK);
+	r_tie{res, err} = gateway.process_tcp_adu(gateway_request, 8);
+	std::vector<uint8_t> device_busy{0, 40, 0, 0, 0, 3, 2, 0x83, 0x06};
+	assert(err == GATEWAY_BUSY);
+	assert(res == device_busy);
+	while (gateway.queued())
+		gateway.poll(ms(1));
+	std::vector<uint8_t> failed_to_respond{0, 40, 0, 0, 0, 3, 2, 0x83, 0x0b};
+	assert(gateway_out.connection == 8);
+	assert(gateway_out.adu == failed_to_respond);
+	assert(gateway.process_tcp_adu(std::span(gateway_request).first(10), 8).err == INVALID_ADU);
+
+	std::println("Gateway behind the tcp server");
+	static tcp_linux_server<decltype(gateway), 4> gateway_server{.handler = gateway};
+	gateway.on_response_ctx = &gateway_server;
+	gateway.on_response = [](void *s, uint64_t c, std::span<const uint8_t> adu) {
+		assert(static_cast<decltype(gateway_server)*>(s)->send(c, adu) == OK);
+	};
+	assert(gateway_server.init(0) == OK);
+	client_fd = socket(AF_INET, SOCK_STREAM, 0);
+	server_addr.sin_port = htons(gateway_server.port());
+	assert(connect(client_fd, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) == 0);
+	gateway_request[6] = 1;
+	assert(send(client_fd, gateway_request.data(), gateway_request.size(), 0) == ssize_t(gateway_request.size()));
+	received.clear();
+	for (int i = 0; i < 100 && received.size() < 13; ++i) {
+		gateway_server.poll(ms(10));
+		gateway.poll();
+		std::array<uint8_t, 512> buf;
+		ssize_t n = recv(client_fd, buf.data(), buf.size(), MSG_DONTWAIT);
+		if (n > 0)
+			received.insert(received.end(), buf.begin(), buf.begin() + n);
+	}
+	r_tie{res, err} = test_server.process_tcp_adu(gateway_request);
+	assert(res == received);
+	close(client_fd);
+	gateway_server.deinit();
+	assert(gateway_server.send(gateway_server.id(0), received) == CONNECTION_CLOSED);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Mirror test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	int device_requests{};
+	static modbus_actor<test_layout, serving_rtu_io> mirror_device{role_t::CLIENT, test_layout{}, serving_rtu_io{&test_server, &device_requests}};
+	static modbus_mirror<decltype(mirror_device)> mirror{.actor = mirror_device, .unit = 1};
+	gateway_responses mirror_out;
+	mirror.on_response_ctx = &mirror_out;
+	mirror.on_response = [](void *ctx, uint64_t connection, std::span<const uint8_t> adu) {
+		auto &out = *static_cast<gateway_responses*>(ctx);
+		out.adu.assign(adu.begin(), adu.end());
+		out.connection = connection;
+	};
+	assert(mirror.add_block(libmodbus_static::register_t::HALFS, 0, 4, ms(50)) == OK);
+	assert(mirror.add_block(libmodbus_static::register_t::HALFS, 2, 4, ms(50)) == REGISTER_NOT_FULLY_COVERED);
+	auto mirror_until_answered = [&]() {
+		mirror_out = {};
+		auto start = std::chrono::steady_clock::now();
+		while (mirror_out.adu.empty() && std::chrono::steady_clock::now() - start < ms(500))
+			mirror.poll(ms(1));
+		assert(!mirror_out.adu.empty());
+	};
+
+	std::println("Stale block is refreshed on demand");
+	test_server.write(uint16_t(51), &t::halfs_layout::r1);
+	test_server.write(uint16_t(52), &t::halfs_layout::r2);
+	assert(client_test.start_tcp_frame(50, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_layout::r1, &t::halfs_layout::r2);
+	std::vector<uint8_t> mirror_read{res.begin(), res.end()};
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_read, 3);
+	assert(err == OK && res.empty());
+	mirror_until_answered();
+	r_tie{res, err} = test_server.process_tcp_adu(mirror_read);
+	assert(mirror_out.connection == 3);
+	assert(res == mirror_out.adu);
+	assert(device_requests == 1);
+
+	std::println("Fresh block is answered from the image");
+	test_server.write(uint16_t(61), &t::halfs_layout::r1);
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_read, 3);
+	assert(err == OK);
+	assert(res == mirror_out.adu);
+	assert(device_requests == 1);
+
+	std::println("Writes and uncovered reads are forwarded");
+	client_test.write(uint16_t(0x0a0b), &t::halfs_write_layout::r3);
+	assert(client_test.start_tcp_frame(51, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r3);
+	std::vector<uint8_t> mirror_write{res.begin(), res.end()};
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_write, 4);
+	assert(err == OK && res.empty());
+	mirror_until_answered();
+	assert(mirror_out.adu == mirror_write);
+	assert(test_server.read(&t::halfs_write_layout::r3) == 0x0a0b);
+	assert(client_test.start_tcp_frame(52, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_write_layout::r3);
+	std::vector<uint8_t> mirror_uncovered{res.begin(), res.end()};
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_uncovered, 4);
+	assert(res.empty());
+	mirror_until_answered();
+	r_tie{res, err} = test_server.process_tcp_adu(mirror_uncovered);
+	assert(res == mirror_out.adu);
+	assert(device_requests == 3);
+
+	std::println("Device which does not answer");
+	std::this_thread::sleep_for(ms(50));
+	mirror.timeout = ms(5);
+	test_server.addr = 2;
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_read, 3);
+	assert(res.empty());
+	mirror_until_answered();
+	test_server.addr = 1;
+	std::vector<uint8_t> mirror_failed{0, 50, 0, 0, 0, 3, 1, 0x83, 0x0b};
+	assert(mirror_out.adu == mirror_failed);
+
+	std::println("Unconfirmed writes do not change the image");
+	test_server.addr = 2;
+	client_test.write(uint16_t(0x0c0d), &t::halfs_write_layout::r3);
+	assert(client_test.start_tcp_frame(53, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r3);
+	std::vector<uint8_t> mirror_lost_write{res.begin(), res.end()};
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_lost_write, 4);
+	assert(err == OK && res.empty());
+	assert(mirror.image.read(&t::halfs_write_layout::r3) == 0x0a0b);
+	mirror_until_answered();
+	test_server.addr = 1;
+	std::vector<uint8_t> mirror_write_failed{0, 53, 0, 0, 0, 3, 1, 0x86, 0x0b};
+	assert(mirror_out.adu == mirror_write_failed);
+	assert(mirror.image.read(&t::halfs_write_layout::r3) == 0x0a0b);
+	assert(test_server.read(&t::halfs_write_layout::r3) == 0x0a0b);
+
+	std::println("Device exceptions are passed on");
+	mirror.timeout = ADAPTIVE_TIMEOUT;
+	client_test.write(uint16_t(0x0c0d), &t::halfs_write_layout::r3);
+	assert(client_test.start_tcp_frame(55, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r3);
+	std::vector<uint8_t> mirror_rejected_write{res.begin(), res.end()};
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_rejected_write, 4);
+	assert(err == OK && res.empty());
+	// the device answered with ILLEGAL_DATA_VALUE instead
+	std::vector<uint8_t> device_exception{1, 0x86, 3, 0, 0};
+	uint16_t exception_crc = checksum::calculate_crc16(std::span<uint8_t>{device_exception.data(), 3});
+	device_exception[3] = l_byte(exception_crc);
+	device_exception[4] = h_byte(exception_crc);
+	mirror_device.io.to_client = device_exception;
+	mirror_until_answered();
+	std::vector<uint8_t> mirror_illegal_value{0, 55, 0, 0, 0, 3, 1, 0x86, 3};
+	assert(mirror_out.adu == mirror_illegal_value);
+	assert(mirror.image.read(&t::halfs_write_layout::r3) == 0x0a0b);
+	assert(result_exception(exception_result(exception_code::ILLEGAL_DATA_VALUE)) == exception_code::ILLEGAL_DATA_VALUE);
+	assert(result_exception(TIMEOUT) == exception_code::NONE);
+
+	std::println("Refreshes do not overwrite a queued write");
+	assert(mirror.add_block(libmodbus_static::register_t::HALFS_WRITE, 2, 1, ms(0)) == OK);
+	assert(client_test.start_tcp_frame(56, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_write_layout::r3);
+	std::vector<uint8_t> mirror_refreshed{res.begin(), res.end()};
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_refreshed, 3);
+	assert(res.empty() && mirror_device.in_flight_count() == 1);
+	client_test.write(uint16_t(0x0102), &t::halfs_write_layout::r3);
+	assert(client_test.start_tcp_frame(57, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r3);
+	std::vector<uint8_t> mirror_queued_write{res.begin(), res.end()};
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_queued_write, 4);
+	assert(res.empty() && mirror._pending_count == 2);
+	for (auto start = std::chrono::steady_clock::now(); mirror._pending_count && std::chrono::steady_clock::now() - start < ms(500);)
+		mirror.poll(ms(1));
+	assert(mirror._pending_count == 0);
+	assert(mirror_out.adu == mirror_queued_write);
+	assert(test_server.read(&t::halfs_write_layout::r3) == 0x0102);
+	assert(mirror.image.read(&t::halfs_write_layout::r3) == 0x0102);
+
+	std::println("Broadcast writes are forwarded without waiting");
+	int requests_before_broadcast = device_requests;
+	client_test.write(uint16_t(0x0e0f), &t::halfs_write_layout::r3);
+	assert(client_test.start_tcp_frame(54, BROADCAST_ADDR) == OK);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r3);
+	std::vector<uint8_t> mirror_broadcast{res.begin(), res.end()};
+	auto mirror_broadcast_start = std::chrono::steady_clock::now();
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_broadcast, 4);
+	assert(err == OK && res.empty());
+	assert(std::chrono::steady_clock::now() - mirror_broadcast_start < mirror_device.turnaround_delay);
+	assert(device_requests == requests_before_broadcast + 1);
+	assert(test_server.read(&t::halfs_write_layout::r3) == 0x0e0f);
+	mirror.poll();
+	assert(mirror._pending_count == 0);
+
+	std::println("Requests after a broadcast wait for the turnaround in poll");
+	r_tie{res, err} = mirror.process_tcp_adu(mirror_uncovered, 4);
+	assert(res.empty() && device_requests == requests_before_broadcast + 1);
+	mirror_until_answered();
+	assert(std::chrono::steady_clock::now() - mirror_broadcast_start >= mirror_device.turnaround_delay);
+	assert(device_requests == requests_before_broadcast + 2);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Adaptive timeout test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Round trip time of a healthy unit");
+	request_count = 0;
+	modbus_actor<test_layout, serving_tcp_io, 4> rtt_client{role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &request_count}};
+	rtt_client.timeouts = timeout_config{.initial = ms(5), .min = ms(2), .breaker_threshold = 2, .breaker_cooldown = ms(20)};
+	assert(rtt_client.timeout_for(1) == ms(5));
+	for (int i = 0; i < 4; ++i)
+		assert(rtt_client.read_remote(1, &t::halfs_layout::r1) == OK);
+	assert(rtt_client.health(1).has_rtt);
+	assert(rtt_client.timeout_for(1) == ms(2));
+
+	std::println("Dead unit opens the circuit breaker");
+	assert(rtt_client.read_remote(3, &t::halfs_layout::r1) == TIMEOUT);
+	assert(rtt_client.timeout_for(3) == ms(10));
+	assert(rtt_client.read_remote(3, &t::halfs_layout::r1) == TIMEOUT);
+	assert(rtt_client.health(3).breaker == unit_health::state::OPEN);
+	int requests_before = request_count;
+	assert(rtt_client.read_remote(3, &t::halfs_layout::r1) == CIRCUIT_OPEN);
+	assert(request_count == requests_before);
+	assert(rtt_client.read_remote(1, &t::halfs_layout::r1) == OK);
+
+	std::println("Single probe after the cool down");
+	std::this_thread::sleep_for(ms(20));
+	test_server.addr = 3;
+	request_handle probe = rtt_client.submit_read(3, &t::halfs_layout::r1);
+	assert(probe.valid());
+	assert(rtt_client.submit_read(3, &t::halfs_layout::r2).err == CIRCUIT_OPEN);
+	assert(rtt_client.wait(probe) == OK);
+	test_server.addr = 1;
+	assert(rtt_client.health(3).breaker == unit_health::state::CLOSED);
+	assert(rtt_client.health(3).failures == 0);
+
+	std::println("Open breakers keep their slot when more units are queried");
+	assert(rtt_client.read_remote(9, &t::halfs_layout::r1) == TIMEOUT);
+	assert(rtt_client.read_remote(9, &t::halfs_layout::r1) == TIMEOUT);
+	assert(rtt_client.health(9).breaker == unit_health::state::OPEN);
+	for (uint8_t unit: {1, 3, 4, 5, 6}) {
+		test_server.addr = unit;
+		assert(rtt_client.read_remote(unit, &t::halfs_layout::r1) == OK);
+	}
+	test_server.addr = 1;
+	assert(rtt_client.health(9).breaker == unit_health::state::OPEN);
+	assert(rtt_client.read_remote(9, &t::halfs_layout::r1) == CIRCUIT_OPEN);
+	assert(!rtt_client.health(1).has_rtt && rtt_client.health(6).has_rtt);
+
+	std::println("A health table keeps all units");
+	static unit_health_table all_units{};
+	rtt_client.health_table = &all_units;
+	for (uint8_t unit: {1, 3, 4, 5, 6, 7}) {
+		test_server.addr = unit;
+		assert(rtt_client.read_remote(unit, &t::halfs_layout::r1) == OK);
+	}
+	test_server.addr = 1;
+	assert(std::ranges::all_of(std::array{1, 3, 4, 5, 6, 7}, [&](int unit){ return rtt_client.health(unit).has_rtt; }));
+	assert(all_units.units[7].has_rtt && !all_units.units[9].has_rtt);
+	rtt_client.health_table = nullptr;
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Broadcast test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	int broadcast_requests{};
+	modbus_actor<test_layout, serving_rtu_io> broadcaster{role_t::CLIENT, test_layout{}, serving_rtu_io{&test_server, &broadcast_requests}};
+	broadcaster.turnaround_delay = ms(5);
+	broadcaster.write(uint16_t(0x1234), &t::halfs_write_layout::r1);
+	broadcaster.write(uint16_t(0x5678), &t::halfs_write_layout::r2);
+
+	std::println("Broadcast write is applied and not answered");
+	auto broadcast_start = std::chrono::steady_clock::now();
+	assert(broadcaster.broadcast_write(&t::halfs_write_layout::r1, &t::halfs_write_layout::r2) == OK);
+	assert(std::chrono::steady_clock::now() - broadcast_start >= ms(5));
+	assert(broadcast_requests == 1);
+	assert(broadcaster.io.to_client.empty());
+	assert(test_server.read(&t::halfs_write_layout::r1) == 0x1234);
+	assert(test_server.read(&t::halfs_write_layout::r2) == 0x5678);
+	assert(broadcaster.in_flight_count() == 0);
+
+	std::println("Single register and coil broadcasts");
+	broadcaster.write(uint16_t(0x0042), &t::halfs_write_layout::r4);
+	assert(broadcaster.broadcast_write(&t::halfs_write_layout::r4) == OK);
+	assert(test_server.read(&t::halfs_write_layout::r4) == 0x0042);
+	test_server.storage.bits_write_registers.b = false;
+	broadcaster.storage.bits_write_registers.b = true;
+	assert(broadcaster.broadcast_write(bitset_test_2{.b = true}) == OK);
+	assert(test_server.storage.bits_write_registers.b);
+	assert(broadcaster.io.to_client.empty());
+
+	std::println("Broadcast reads and invalid broadcasts are dropped silently");
+	auto with_crc = [](std::vector<uint8_t> frame) {
+		uint16_t crc = checksum::calculate_crc16(frame);
+		frame.insert(frame.end(), {l_byte(crc), h_byte(crc)});
+		return frame;
+	};
+	serving_rtu_io rtu_unit_0{&test_server};
+	std::vector<uint8_t> broadcast_read = with_crc({0, 3, 0, 0, 0, 1});
+	std::vector<uint8_t> broadcast_out_of_range = with_crc({0, 6, 0, 40, 0, 1});
+	rtu_unit_0.write_bytes(broadcast_read);
+	rtu_unit_0.write_bytes(broadcast_out_of_range);
+	assert(rtu_unit_0.to_client.empty());
+	// the same read to unit 1 is answered
+	std::vector<uint8_t> unit_1_read = with_crc({1, 3, 0, 0, 0, 1});
+	rtu_unit_0.write_bytes(unit_1_read);
+	assert(rtu_unit_0.to_client.size() == 7);
+
+	std::println("Unit 0 is an ordinary unit on tcp");
+	std::vector<uint8_t> tcp_unit_0_read{0, 60, 0, 0, 0, 6, 0, 3, 0, 0, 0, 1};
+	auto [unit_0_res, unit_0_err] = test_server.process_tcp_adu(tcp_unit_0_read);
+	assert(unit_0_err == OK && unit_0_res.size() == 11 && unit_0_res[6] == 0 && unit_0_res[7] == 3);
+	std::vector<uint8_t> tcp_unit_0_out_of_range{0, 61, 0, 0, 0, 6, 0, 6, 0, 40, 0, 1};
+	r_tie{unit_0_res, unit_0_err} = test_server.process_tcp_adu(tcp_unit_0_out_of_range);
+	assert(unit_0_res.size() == 9 && unit_0_res[7] == 0x86);
+
+	std::println("Tcp broadcasts do not wait for a bus");
+	int tcp_broadcast_requests{};
+	modbus_actor<test_layout, serving_tcp_io, 4> tcp_broadcaster{role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &tcp_broadcast_requests}};
+	auto tcp_broadcast_start = std::chrono::steady_clock::now();
+	assert(tcp_broadcaster.broadcast_write(&t::halfs_write_layout::r1) == OK);
+	assert(std::chrono::steady_clock::now() - tcp_broadcast_start < ms(50) && tcp_broadcast_requests == 1);
+
+	std::println("Servers can not broadcast");
+	modbus_actor<test_layout, serving_rtu_io> not_a_client{uint8_t(2), test_layout{}, serving_rtu_io{&test_server}};
+	assert(not_a_client.broadcast_write(&t::halfs_write_layout::r1) == CLIENT_CANT_QUERY);
+
+	std::println("Address 0 does not create a broadcast accepting server");
+	modbus_actor<test_layout, serving_rtu_io> not_a_server{BROADCAST_ADDR, test_layout{}, serving_rtu_io{&test_server}};
+	assert(not_a_server.role == role_t::CLIENT);
+	assert(not_a_server.poll_update_state(ms(0)) == SERVER_CANT_RESPOND);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Latency histogram test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	using ns = std::chrono::nanoseconds;
+	std::println("Buckets are contiguous");
+	for (int i = 1; i < latency_histogram::BUCKETS; ++i)
+		assert(latency_histogram::bucket_low(i) == latency_histogram::bucket_high(i - 1) + 1);
+	for (uint64_t v: {uint64_t(0), uint64_t(31), uint64_t(32), uint64_t(1000), uint64_t(123456789)}) {
+		int i = latency_histogram::bucket_index(v);
+		assert(latency_histogram::bucket_low(i) <= v && v <= latency_histogram::bucket_high(i));
+	}
+
+	std::println("Percentiles within the bucket precision");
+	static latency_histogram histogram{};
+	for (int v = 1; v <= 10000; ++v)
+		histogram.record(ns(v * 1000));
+	assert(histogram.count() == 10000);
+	assert(histogram.min() == ns(1000) && histogram.max() == ns(10000000));
+	assert(histogram.mean() == ns(5000500));
+	auto near = [](ns value, ns expected) { return value >= expected && value <= expected + expected / 16; };
+	assert(near(histogram.percentile(50), ns(5000000)));
+	assert(near(histogram.percentile(99), ns(9900000)));
+	assert(near(histogram.percentile(99.9), ns(9990000)));
+	assert(histogram.percentile(100) == ns(10000000));
+
+	std::println("Merge and reset");
+	static latency_histogram other{};
+	other.record(ns(20000000));
+	histogram.merge(other);
+	assert(histogram.count() == 10001);
+	assert(histogram.max() == ns(20000000));
+	histogram.reset();
+	assert(histogram.count() == 0 && histogram.percentile(50) == ns(0));
+
+	std::println("Actor records round trip times per unit and function code");
+	static latency_stats client_latency{};
+	rtt_client.latency = &client_latency;
+	for (int i = 0; i < 3; ++i)
+		assert(rtt_client.read_remote(1, &t::halfs_layout::r1) == OK);
+	assert(rtt_client.write_remote(1, &t::halfs_write_layout::r1) == OK);
+	assert(rtt_client.read_remote(4, &t::halfs_layout::r1) == TIMEOUT);
+	const latency_histogram *reads = client_latency.find(1, function_code::READ_HOLDING_REGISTERS);
+	assert(reads && reads->count() == 3 && reads->max() > ns(0));
+	assert(client_latency.find(1, function_code::WRITE_SINGLE_REGISTER)->count() == 1);
+	assert(!client_latency.find(4, function_code::READ_HOLDING_REGISTERS));
+	assert(client_latency.total().count() == 4);
+
+	std::println("Snapshot and merge of stats");
+	static latency_stats window{};
+	client_latency.snapshot(window);
+	client_latency.reset();
+	assert(client_latency.total().count() == 0);
+	static latency_stats combined{};
+	combined.merge(window);
+	combined.merge(window);
+	assert(combined.find(1, function_code::READ_HOLDING_REGISTERS)->count() == 6);
+	assert(combined.total().count() == 8);
+
+	std::println("Unit/function code pairs above MAX_KEYS go to the overflow histogram");
+	combined.reset();
+	for (int unit = 0; unit <= latency_stats::MAX_KEYS; ++unit)
+		combined.record(unit, function_code::READ_COILS, ns(100));
+	assert(combined.used().size() == latency_stats::MAX_KEYS);
+	assert(combined.overflow.count() == 1);
+	assert(combined.total().count() == latency_stats::MAX_KEYS + 1);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Trace test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	static_assert(std::is_empty_v<no_trace>);
+	static_assert(IsTracePolicy<ring_trace<8>>);
+
+	std::println("Received frames and exceptions are traced");
+	static modbus_register<test_layout, 256, ring_trace<8>> traced_server{.addr = 1};
+	assert(client_test.start_tcp_frame(70, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_layout::r1);
+	std::vector<uint8_t> traced_read{res.begin(), res.end()};
+	r_tie{res, err} = traced_server.process_tcp_adu(traced_read);
+	assert(err == OK);
+	assert(traced_server.trace.size() == 2);
+	assert(traced_server.trace[0].event == trace_event::FRAME_START && traced_server.trace[0].unit == 1);
+	assert(traced_server.trace[1].event == trace_event::FRAME_COMPLETE);
+	assert(traced_server.trace[1].fc == function_code::READ_HOLDING_REGISTERS);
+	assert(traced_server.trace[1].size == traced_read.size());
+	assert(client_test.start_tcp_frame(71, 1) == OK);
+	r_tie{res, err} = client_test.get_frame_write(libmodbus_static::register_t::HALFS_WRITE, 3, out_of_range);
+	r_tie{res, err} = traced_server.process_tcp_adu(res);
+	assert(traced_server.trace.size() == 5);
+	assert(traced_server.trace[4].event == trace_event::EXCEPTION_SENT);
+	assert(traced_server.trace[4].fc == function_code::WRITE_MULTIPLE_REGISTERS);
+	assert(traced_server.trace[4].ec == exception_code::ILLEGAL_DATA_ADDRESS);
+
+	std::println("Rtu frames with invalid crc are traced");
+	assert(client_test.start_rtu_frame(1) == OK);
+	r_tie{res, err} = client_test.get_frame_read(&t::halfs_layout::r2);
+	std::vector<uint8_t> corrupted{res.begin(), res.end()};
+	corrupted.back() ^= 0xff;
+	traced_server.switch_to_request();
+	for (uint8_t b: corrupted)
+		err = traced_server.process_rtu(b).err;
+	assert(err == INVALID_CRC);
+	assert(traced_server.trace[traced_server.trace.size() - 1].event == trace_event::CRC_FAILURE);
+	assert(traced_server.trace[traced_server.trace.size() - 1].fc == function_code::READ_HOLDING_REGISTERS);
+
+	std::println("Ring keeps the newest records in order");
+	assert(traced_server.trace.written == 7);
+	r_tie{res, err} = traced_server.process_tcp_adu(traced_read);
+	assert(traced_server.trace.size() == 8);
+	std::array<trace_record, 8> trace_dump{};
+	assert(traced_server.trace.copy_to(trace_dump) == 8);
+	assert(trace_dump[0].event == trace_event::FRAME_COMPLETE && trace_dump[5].event == trace_event::CRC_FAILURE);
+	assert(trace_dump[6].event == trace_event::FRAME_START && trace_dump[7].event == trace_event::FRAME_COMPLETE);
+	assert(std::ranges::is_sorted(trace_dump, {}, &trace_record::time_us));
+	std::array<trace_record, 2> newest{};
+	assert(traced_server.trace.copy_to(newest) == 2);
+	assert(newest[0] == trace_dump[6] && newest[1] == trace_dump[7]);
+
+	std::println("Actor timeouts are traced");
+	modbus_actor<test_layout, serving_tcp_io, 4, ring_trace<8>> traced_client{role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &request_count}};
+	assert(traced_client.read_remote(4, &t::halfs_layout::r1, ms(1)) == TIMEOUT);
+	assert(traced_client.trace.size() == 1);
+	assert(traced_client.trace[0].event == trace_event::TIMEOUT && traced_client.trace[0].unit == 4);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Loopback test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	using loop_tcp = loopback_io<transport_t::TCP>;
+	using loop_rtu = loopback_io<transport_t::RTU>;
+	static modbus_register<test_layout> loop_device{.addr = 1};
+	loop_device.write(uint16_t(77), &t::halfs_layout::r1);
+	loop_device.write(uint16_t(78), &t::halfs_layout::r2);
+
+	std::println("Tcp client and server in one thread");
+	static loopback_link tcp_link{};
+	static loopback_server<modbus_register<test_layout>, loop_tcp> tcp_end{loop_device, loop_tcp{.link = &tcp_link, .side = 1}};
+	modbus_actor<test_layout, loop_tcp> loop_tcp_client{role_t::CLIENT, test_layout{},
+		loop_tcp{.link = &tcp_link, .side = 0, .on_idle = decltype(tcp_end)::pump, .on_idle_ctx = &tcp_end}};
+	assert(loop_tcp_client.read_remote(1, &t::halfs_layout::r1, &t::halfs_layout::r2, ms(100)) == OK);
+	assert(loop_tcp_client.read(&t::halfs_layout::r1) == 77 && loop_tcp_client.read(&t::halfs_layout::r2) == 78);
+
+	std::println("Fragmented delivery");
+	tcp_link.configure({.max_fragment = 1});
+	assert(loop_tcp_client.read_remote(1, &t::halfs_layout::r2, ms(100)) == OK);
+	loop_tcp_client.write(uint16_t(5), &t::halfs_write_layout::r3);
+	assert(loop_tcp_client.write_remote(1, &t::halfs_write_layout::r3, ms(100)) == OK);
+	assert(loop_device.read(&t::halfs_write_layout::r3) == 5);
+
+	std::println("Latency is added in both directions");
+	tcp_link.configure({.latency = std::chrono::microseconds(3000), .jitter = std::chrono::microseconds(1000)});
+	auto loop_start = std::chrono::steady_clock::now();
+	assert(loop_tcp_client.read_remote(1, &t::halfs_layout::r1, ms(100)) == OK);
+	assert(std::chrono::steady_clock::now() - loop_start >= ms(6));
+
+	std::println("Rtu character timing of the baud rate");
+	static loopback_link rtu_link{};
+	rtu_link.configure({.baud = 19200});
+	static loopback_server<modbus_register<test_layout>, loop_rtu> rtu_end{loop_device, loop_rtu{.link = &rtu_link, .side = 1}};
+	modbus_actor<test_layout, loop_rtu> loop_rtu_client{role_t::CLIENT, test_layout{},
+		loop_rtu{.link = &rtu_link, .side = 0, .on_idle = decltype(rtu_end)::pump, .on_idle_ctx = &rtu_end}};
+	loop_start = std::chrono::steady_clock::now();
+	assert(loop_rtu_client.read_remote(1, &t::halfs_layout::r1, ms(100)) == OK);
+	// 8 request + 7 response bytes with 11 bits each
+	auto loop_elapsed = std::chrono::steady_clock::now() - loop_start;
+	std::println("Rtu round trip {}us", std::chrono::duration_cast<std::chrono::microseconds>(loop_elapsed).count());
+	assert(loop_elapsed >= std::chrono::microseconds(15 * 11 * 1000000 / 19200));
+	assert(loop_rtu_client.read(&t::halfs_layout::r1) == 77);
+
+	std::println("Bit flips are detected by the crc");
+	rtu_link.configure(0, {.baud = 19200, .flip_rate = 1});
+	assert(loop_rtu_client.read_remote(1, &t::halfs_layout::r1, ms(20)) == TIMEOUT);
+	assert(rtu_link.stats(0).flipped == 8);
+
+	std::println("Server recovers from dropped bytes after 3.5 characters of silence");
+	rtu_link.configure(0, {.baud = 19200, .drop_rate = 0.5, .seed = 7});
+	assert(loop_rtu_client.read_remote(1, &t::halfs_layout::r1, ms(20)) == TIMEOUT);
+	assert(rtu_link.stats(0).dropped > 0);
+	rtu_link.configure(0, {.baud = 19200});
+	assert(loop_rtu_client.read_remote(1, &t::halfs_layout::r2, ms(100)) == OK);
+	assert(loop_rtu_client.read(&t::halfs_layout::r2) == 78);
+
+	std::println("Server in its own thread");
+	tcp_link.configure({.baud = 115200});
+	std::atomic<bool> serving{true};
+	std::thread server_thread([&] {
+		while (serving)
+			tcp_end.poll();
+	});
+	modbus_actor<test_layout, loop_tcp> threaded_client{role_t::CLIENT, test_layout{}, loop_tcp{.link = &tcp_link, .side = 0}};
+	for (int i = 0; i < 10; ++i)
+		assert(threaded_client.read_remote(1, &t::halfs_layout::r1, &t::halfs_layout::r2, ms(100)) == OK);
+	serving = false;
+	server_thread.join();
+	assert(threaded_client.read(&t::halfs_layout::r2) == 78);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Serial RTU test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("End of frame silence from the baud rate");
+	static_assert(rtu_frame_silence(9600) == std::chrono::nanoseconds(11 * 3500000000ull / 9600));
+	static_assert(rtu_frame_silence(19200, 10) == std::chrono::nanoseconds(10 * 3500000000ull / 19200));
+	static_assert(rtu_frame_silence(115200) == std::chrono::microseconds(1750));
+	static_assert(rtu_linux_io{.parity = 'N', .stop_bits = 2}.bits_per_char() == 11);
+
+	std::println("Client and server over a pseudo terminal");
+	pty_pair pty{};
+	assert(pty.open() == OK);
+	std::println("pty slave {}", pty.slave_name.data());
+	using serial_actor = modbus_actor<test_layout, rtu_linux_io>;
+	serial_actor serial_server{1, test_layout{}, rtu_linux_io{.baud = 115200, .parity = 'N', .stop_bits = 2, .fd = pty.master}};
+	serial_actor serial_client{role_t::CLIENT, test_layout{}, rtu_linux_io{.device = pty.slave_name.data(), .baud = 115200,
+		.parity = 'N', .stop_bits = 2}};
+	assert(serial_server.io.get_status() == OK && serial_client.io.get_status() == OK);
+	serial_server.write(uint16_t(91), &t::halfs_layout::r1);
+	serial_server.write(uint16_t(92), &t::halfs_layout::r2);
+	std::atomic<bool> serial_serving{true};
+	std::thread serial_thread([&] {
+		while (serial_serving)
+			serial_server.poll_update_state(ms(5));
+	});
+	assert(serial_client.read_remote(1, &t::halfs_layout::r1, &t::halfs_layout::r2, ms(200)) == OK);
+	assert(serial_client.read(&t::halfs_layout::r1) == 91 && serial_client.read(&t::halfs_layout::r2) == 92);
+	serial_client.write(uint16_t(93), &t::halfs_write_layout::r3);
+	assert(serial_client.write_remote(1, &t::halfs_write_layout::r3, ms(200)) == OK);
+
+	std::println("Responses are processed without waiting for the end of frame silence");
+	auto best = std::chrono::nanoseconds::max();
+	for (int i = 0; i < 20; ++i) {
+		auto serial_start = std::chrono::steady_clock::now();
+		assert(serial_client.read_remote(1, &t::halfs_layout::r1, ms(200)) == OK);
+		best = std::min(best, std::chrono::steady_clock::now() - serial_start);
+	}
+	std::println("Best serial round trip {}us", std::chrono::duration_cast<std::chrono::microseconds>(best).count());
+	assert(best < std::chrono::microseconds(1750));
+
+	std::println("Server drops a partial frame after 3.5 characters of silence");
+	std::array<uint8_t, 3> partial_frame{1, 3, 0};
+	serial_client.io.write_bytes(partial_frame);
+	std::this_thread::sleep_for(ms(5));
+	assert(serial_client.read_remote(1, &t::halfs_layout::r2, ms(200)) == OK);
+	assert(serial_client.read(&t::halfs_layout::r2) == 92);
+
+	serial_serving = false;
+	serial_thread.join();
+	assert(serial_server.read(&t::halfs_write_layout::r3) == 93);
+
+	std::println("A timeout blocks in the transport instead of spinning");
+	auto thread_cpu = [] {
+		timespec ts{};
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+	};
+	auto cpu_start = thread_cpu();
+	assert(serial_client.read_remote(1, &t::halfs_layout::r1, ms(300)) == TIMEOUT);
+	auto cpu_used = std::chrono::duration_cast<std::chrono::microseconds>(thread_cpu() - cpu_start);
+	std::println("Cpu time during a 300ms timeout {}us", cpu_used.count());
+	assert(cpu_used < ms(30));
+
+	std::println("Only observed silence is a frame gap");
+	std::array<uint8_t, 2> first_bytes{1, 3}, second_bytes{0, 0};
+	// drops the request of the timeout above, the last call waits on a silent line
+	while (serial_server.io.read_bytes(ms(5)).size());
+	serial_client.io.write_bytes(first_bytes);
+	assert(serial_server.io.read_bytes(ms(100)).size() && serial_server.io.frame_gap());
+	serial_client.io.write_bytes(second_bytes);
+	std::this_thread::sleep_for(ms(5));
+	assert(serial_server.io.read_bytes(ms(0)).size() && !serial_server.io.frame_gap());
+
+	std::println("A closed port does not block");
+	serial_client.io.deinit();
+	auto hangup_start = std::chrono::steady_clock::now();
+	assert(serial_server.io.read_bytes(ms(300)).empty());
+	assert(std::chrono::steady_clock::now() - hangup_start < ms(100));
+	pty.close();
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Multi unit server test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Units with different layouts share one frame");
+	static modbus_multi_server<> plant{};
+	static std::array<unit_register<test_layout>, 200> plant_meters{};
+	static unit_register<example_layout> plant_inverter{};
+	for (int i: std::ranges::iota_view{0, 200}) {
+		assert(plant.add_unit(i + 1, plant_meters[i]) == OK);
+		plant_meters[i].write(uint16_t(i + 1), &t::halfs_layout::r1);
+	}
+	assert(plant.add_unit(247, plant_inverter) == OK);
+	plant_inverter.write(2.5f, &example_layout::halfs_layout::a);
+	assert(plant.add_unit(5, plant_inverter) == UNIT_IN_USE);
+	assert(plant.add_unit(BROADCAST_ADDR, plant_inverter) == INVALID_UNIT);
+	assert(plant.unit_count == 201);
+	static_assert(sizeof(unit_register<test_layout>) < sizeof(modbus_register<test_layout>) / 2);
+
+	std::println("Tcp requests are dispatched by unit id");
+	static modbus_register<test_layout> plant_client{.role = role_t::CLIENT};
+	assert(plant_client.start_tcp_frame(7, 42) == OK);
+	r_tie{res, err} = plant_client.get_frame_read(&t::halfs_layout::r1);
+	std::vector<uint8_t> plant_request{res.begin(), res.end()};
+	r_tie{res, err} = plant.process_tcp_adu(plant_request);
+	std::println("unit 42 response: {}, {}", err, res);
+	assert(err == OK && res.size() == 11 && res[6] == 42 && res[9] == 0 && res[10] == 42);
+	plant_request[6] = 230;
+	r_tie{res, err} = plant.process_tcp_adu(plant_request);
+	assert(err == OK && res.empty());
+	// the inverter layout has no discrete inputs
+	assert(plant_client.start_tcp_frame(8, 247) == OK);
+	r_tie{res, err} = plant_client.get_frame_read(bitset_test_2{.a = true});
+	plant_request.assign(res.begin(), res.end());
+	r_tie{res, err} = plant.process_tcp_adu(plant_request);
+	assert(err == OK && res.size() == 9 && res[6] == 247 && res[7] == 0x82 && res[8] == uint8_t(exception_code::ILLEGAL_FUNCTION));
+
+	std::println("Rtu bus simulation over a loopback link");
+	static loopback_link plant_link{};
+	plant_link.configure({.baud = 115200});
+	static loopback_server<modbus_multi_server<>, loop_rtu> plant_end{plant, loop_rtu{.link = &plant_link, .side = 1}};
+	loop_rtu plant_io{.link = &plant_link, .side = 0, .on_idle = decltype(plant_end)::pump, .on_idle_ctx = &plant_end};
+	modbus_actor<test_layout, loop_rtu> bus_client{role_t::CLIENT, test_layout{}, plant_io};
+	for (uint8_t unit: {1, 57, 200}) {
+		assert(bus_client.read_remote(unit, &t::halfs_layout::r1, ms(100)) == OK);
+		assert(bus_client.read(&t::halfs_layout::r1) == unit);
+	}
+	bus_client.write(uint16_t(33), &t::halfs_write_layout::r2);
+	assert(bus_client.write_remote(120, &t::halfs_write_layout::r2, ms(100)) == OK);
+	assert(plant_meters[119].read(&t::halfs_write_layout::r2) == 33 && plant_meters[118].read(&t::halfs_write_layout::r2) == 0);
+	assert(bus_client.read_remote(230, &t::halfs_layout::r1, ms(20)) == TIMEOUT);
+	modbus_actor<example_layout, loop_rtu> inverter_client{role_t::CLIENT, example_layout{}, plant_io};
+	assert(inverter_client.read_remote(247, &example_layout::halfs_layout::a, ms(100)) == OK);
+	assert(inverter_client.read(&example_layout::halfs_layout::a) == 2.5f);
+
+	std::println("Broadcasts are written to every unit");
+	bus_client.turnaround_delay = ms(0);
+	bus_client.write(uint16_t(44), &t::halfs_write_layout::r3);
+	assert(bus_client.broadcast_write(&t::halfs_write_layout::r3) == OK);
+	assert(bus_client.read_remote(1, &t::halfs_layout::r2, ms(100)) == OK);
+	assert(std::ranges::all_of(plant_meters, [](auto &m){ return m.read(&t::halfs_write_layout::r3) == 44; }));
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Frame layout test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Frames are trivially copyable with a few bytes of bookkeeping");
+	static_assert(std::is_trivially_copyable_v<modbus_frame<TCP_ADU_SIZE>>);
+	static_assert(std::is_trivially_copyable_v<modbus_frame<RTU_FRAME_SIZE>>);
+	static_assert(sizeof(modbus_frame<TCP_ADU_SIZE>) - TCP_ADU_SIZE <= 12);
+	static_assert(sizeof(modbus_frame<128>) - 128 <= 12);
+	std::println("frame sizes: tcp {}, rtu {}", sizeof(modbus_frame<TCP_ADU_SIZE>), sizeof(modbus_frame<RTU_FRAME_SIZE>));
+
+	std::println("A register copied during parsing completes the frame");
+	test_server.write(uint16_t(0x1805), &t::halfs_layout::r4);
+	test_server.switch_to_request();
+	for (uint8_t b: tcp_valid_read | std::views::take(7))
+		assert(test_server.process_tcp(b).err == IN_PROGRESS);
+	static modbus_register<test_layout> copied_server{};
+	copied_server = test_server;
+	test_server.switch_to_request();
+	for (uint8_t b: tcp_valid_read | std::views::drop(7) | std::views::take(4))
+		assert(copied_server.process_tcp(b).err == IN_PROGRESS);
+	assert(copied_server.process_tcp(tcp_valid_read.back()).err == OK);
+	r_tie{res, err} = copied_server.get_frame_response();
+	assert(err == OK && res == tcp_valid_response);
+
+	std::println("Full size tcp adu");
+	modbus_frame<TCP_ADU_SIZE> big_frame{};
+	big_frame.set_type({.RESPONSE = true});
+	assert(big_frame.write_mbap({.transaction_id = 1, .length = 253}) == OK);
+	assert(big_frame.write_addr(1) == OK);
+	assert(big_frame.write_fc(function_code::READ_HOLDING_REGISTERS) == OK);
+	assert(big_frame.write_length(250) == OK);
+	for (int i: std::ranges::iota_view{0, 250})
+		assert(big_frame.write_data(uint8_t(i)) == OK);
+	assert(big_frame.cur_state == modbus_frame<TCP_ADU_SIZE>::state::FINAL);
+	assert(big_frame.frame_data.size() == 259 && big_frame.data()[249] == 249);
+	auto big_copy = big_frame;
+	assert(big_copy.tcp_header() && *big_copy.byte_count() == 250 && big_copy.data() == big_copy.frame_data.begin() + 9);
+
+	std::println("Default registers answer the largest tcp read");
+	std::vector<uint8_t> largest_read{0, 1, 0, 0, 0, 6, 1, 3, 0, 100, 0, 125};
+	static modbus_register<large_layout> default_large{.addr = 1};
+	r_tie{res, err} = default_large.process_tcp_adu(largest_read);
+	assert(err == OK && res.size() == 259 && res[7] == 3);
+	static modbus_multi_server<> large_plant{};
+	static unit_register<large_layout> large_unit{};
+	assert(large_plant.add_unit(1, large_unit) == OK);
+	r_tie{res, err} = large_plant.process_tcp_adu(largest_read);
+	assert(err == OK && res.size() == 259 && res[7] == 3);
+	static_assert(sizeof(shm_register<large_layout>::frame_storage) == sizeof(owned_frame<TCP_ADU_SIZE>));
+	static_assert(sizeof(persistent_register<large_layout>::frame_storage) == sizeof(owned_frame<TCP_ADU_SIZE>));
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Frame pool test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Frames are borrowed last released first");
+	static modbus_frame_pool<TCP_ADU_SIZE, 2> small_pool{};
+	auto *f1 = small_pool.acquire();
+	auto *f2 = small_pool.acquire();
+	assert(f1 && f2 && f1 != f2 && !small_pool.acquire());
+	small_pool.release(f1);
+	assert(small_pool.acquire() == f1 && small_pool.peak == 2);
+	small_pool.release(f2);
+	small_pool.release(f1);
+	assert(small_pool.available() == 2);
+
+	std::println("Concurrent borrowers never share a frame");
+	static modbus_frame_pool<RTU_FRAME_SIZE, 4> shared_pool{};
+	std::array<std::atomic<int>, 4> owners{};
+	std::atomic<bool> shared_twice{};
+	std::vector<std::thread> borrowers;
+	for (int i: std::ranges::iota_view{0, 6}) {
+		borrowers.emplace_back([&, i] {
+			for (int n = 0; n < 20000; ++n) {
+				auto *f = shared_pool.acquire();
+				if (!f)
+					continue;
+				auto &o = owners[f - shared_pool.frames.data()];
+				if (o.exchange(i + 1) != 0)
+					shared_twice = true;
+				f->frame_data.push(uint8_t(i));
+				if (o.exchange(0) != i + 1)
+					shared_twice = true;
+				f->clear();
+				shared_pool.release(f);
+			}
+		});
+	}
+	for (auto &b: borrowers)
+		b.join();
+	assert(!shared_twice && shared_pool.available() == 4);
+
+	std::println("Fleet of tcp actors with two frames");
+	using pooled_actor = modbus_actor<test_layout, serving_tcp_io, 1, no_trace, pooled_frame<decltype(small_pool)>>;
+	static_assert(sizeof(pooled_actor) + sizeof(modbus_frame<TCP_ADU_SIZE>) - 32 <= sizeof(modbus_actor<test_layout, serving_tcp_io, 1>));
+	// without stream buffer and health of all units the frame is the bulk of a small actor
+	static_assert(sizeof(pooled_actor) * 3 < sizeof(modbus_actor<test_layout, serving_tcp_io, 1>) * 2);
+	std::println("actor size: owned frame {}, pooled frame {}", sizeof(modbus_actor<test_layout, serving_tcp_io, 1>), sizeof(pooled_actor));
+	int fleet_requests{};
+	test_server.write(uint16_t(77), &t::halfs_layout::r2);
+	std::vector<std::unique_ptr<pooled_actor>> fleet;
+	for (int i = 0; i < 50; ++i) {
+		fleet.push_back(std::make_unique<pooled_actor>(role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &fleet_requests}));
+		fleet.back()->frame_storage.pool = &small_pool;
+	}
+	std::vector<request_handle> fleet_handles;
+	for (auto &a: fleet)
+		fleet_handles.push_back(a->submit_read(1, &t::halfs_layout::r2, ms(100)));
+	// tcp actors hold no frame while waiting for their response
+	assert(small_pool.available() == 2);
+	for (int i = 0; i < 50; ++i) {
+		assert(fleet[i]->wait(fleet_handles[i]) == OK);
+		assert(fleet[i]->read(&t::halfs_layout::r2) == 77);
+	}
+	assert(fleet_requests == 50 && small_pool.available() == 2);
+
+	std::println("Rtu actors hold a frame until the response");
+	static modbus_frame_pool<RTU_FRAME_SIZE, 1> rtu_pool{};
+	using pooled_rtu_actor = modbus_actor<test_layout, serving_rtu_io, 1, no_trace, pooled_frame<decltype(rtu_pool)>>;
+	pooled_rtu_actor meter_a{role_t::CLIENT, test_layout{}, serving_rtu_io{&test_server}};
+	pooled_rtu_actor meter_b{role_t::CLIENT, test_layout{}, serving_rtu_io{&test_server}};
+	meter_a.frame_storage.pool = meter_b.frame_storage.pool = &rtu_pool;
+	request_handle ha = meter_a.submit_read(1, &t::halfs_layout::r2, ms(100));
+	assert(ha.valid() && meter_b.submit_read(1, &t::halfs_layout::r2).err == FRAME_POOL_EMPTY);
+	assert(meter_a.wait(ha) == OK && rtu_pool.available() == 1);
+	assert(meter_b.read_remote(1, &t::halfs_layout::r2, ms(100)) == OK);
+	assert(meter_b.read(&t::halfs_layout::r2) == 77);
+	// an unanswered request gives its frame back on timeout
+	assert(meter_a.read_remote(9, &t::halfs_layout::r2, ms(5)) == TIMEOUT && rtu_pool.available() == 1);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Shared memory test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Register image in a named segment");
+	static_assert(layout_hash<test_layout>() != layout_hash<example_layout>());
+	// only the sync (and its alignment padding) is added to the register
+	static_assert(sizeof(shm_register<test_layout>) < sizeof(modbus_register<test_layout>) + sizeof(shm_seqlock) + alignof(shm_seqlock));
+	static shm_image<shm_register<test_layout>> image{};
+	assert(image.create("/libmodbus-static-test") == OK);
+	image.reg->addr = 1;
+	image.reg->write(uint16_t(5), &t::halfs_layout::r1);
+	static shm_view<test_layout> view{};
+	assert(view.open("/libmodbus-static-test") == OK);
+	assert(view.read(&t::halfs_layout::r1) == 5);
+	uint32_t shm_generation = view.generation();
+	assert(shm_generation % 2 == 0 && shm_generation > 0);
+
+	std::println("Write requests are visible to readers");
+	assert(client_test.start_tcp_frame(3, 1) == OK);
+	client_test.write(uint16_t(0x1234), &t::halfs_write_layout::r2);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r2);
+	std::vector<uint8_t> shm_request{res.begin(), res.end()};
+	r_tie{res, err} = image.reg->process_tcp_adu(shm_request);
+	assert(err == OK && res.size());
+	assert(view.read(&t::halfs_write_layout::r2) == 0x1234 && view.generation() > shm_generation);
+	assert(view.snapshot().halfs_write_registers.r2 == image.reg->storage.halfs_write_registers.r2);
+
+	std::println("Reads and rejected writes keep the generation");
+	shm_generation = view.generation();
+	r_tie{res, err} = image.reg->process_tcp_adu(tcp_valid_read);
+	assert(err == OK && res[7] == 3);
+	std::vector<uint8_t> shm_rejected_write{0, 4, 0, 0, 0, 6, 1, 6, 0x7f, 0, 0, 1};
+	r_tie{res, err} = image.reg->process_tcp_adu(shm_rejected_write);
+	assert(res[7] == 0x86);
+	assert(view.generation() == shm_generation);
+
+	std::println("Other layouts are rejected");
+	shm_view<example_layout> wrong_view{};
+	assert(wrong_view.open("/libmodbus-static-test") == SHM_LAYOUT_MISMATCH);
+	assert(shm_view<test_layout>{}.open("/libmodbus-static-missing") == SHM_OPEN_FAILED);
+
+	std::println("Readers never see a partial write section");
+	std::atomic<bool> shm_writing{true};
+	std::atomic<int> torn_reads{};
+	std::thread shm_reader([&] {
+		shm_view<test_layout> reader{};
+		assert(reader.open("/libmodbus-static-test") == OK);
+		while (shm_writing) {
+			test_layout s = reader.snapshot();
+			if (s.halfs_registers.r1 != s.halfs_registers.r2 || s.halfs_registers.r1 != s.halfs_registers.r3)
+				++torn_reads;
+		}
+	});
+	for (int i = 0; i < 200000; ++i) {
+		storage_write_section section{image.reg->storage_sync};
+		image.reg->write(uint16_t(i), &t::halfs_layout::r1);
+		image.reg->write(uint16_t(i), &t::halfs_layout::r2);
+		image.reg->write(uint16_t(i), &t::halfs_layout::r3);
+	}
+	shm_writing = false;
+	shm_reader.join();
+	assert(torn_reads == 0 && view.generation() % 2 == 0);
+
+	std::println("Anonymous memfd image of an actor");
+	static shm_image<modbus_actor<test_layout, serving_tcp_io, 4, no_trace, owned_frame<TCP_ADU_SIZE>, shm_seqlock>> actor_image{};
+	int shm_requests{};
+	test_server.write(uint16_t(4321), &t::halfs_layout::r4);
+	assert(actor_image.create(nullptr, role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &shm_requests}) == OK);
+	assert(actor_image.reg->read_remote(1, &t::halfs_layout::r4, ms(100)) == OK);
+	shm_view<test_layout> fd_view{};
+	assert(fd_view.open_fd(actor_image.fd) == OK);
+	assert(fd_view.read(&t::halfs_layout::r4) == 4321);
+	actor_image.close();
+	image.close();
+	assert(shm_view<test_layout>{}.open("/libmodbus-static-test") == SHM_OPEN_FAILED);
+	// an open view keeps its mapping after the image is gone
+	assert(view.read(&t::halfs_write_layout::r2) == 0x1234);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Persistence test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Write requests are stored in the file");
+	const char *persist_path = "/tmp/libmodbus-static-persist-test.bin";
+	unlink(persist_path);
+	static persistent_register<test_layout> persisted{.addr = 1};
+	persisted.storage_sync.sync_interval = std::chrono::hours(1);
+	assert(persisted.storage_sync.open(persist_path, persisted.storage) == OK);
+	assert(!persisted.storage_sync.restored);
+	assert(client_test.start_tcp_frame(4, 1) == OK);
+	client_test.write(uint16_t(0x4321), &t::halfs_write_layout::r2);
+	client_test.write(uint16_t(0x0815), &t::halfs_write_layout::r3);
+	r_tie{res, err} = client_test.get_frame_write(&t::halfs_write_layout::r2, &t::halfs_write_layout::r3);
+	std::vector<uint8_t> persist_request{res.begin(), res.end()};
+	r_tie{res, err} = persisted.process_tcp_adu(persist_request);
+	assert(err == OK && res.size());
+	assert(client_test.start_tcp_frame(5, 1) == OK);
+	client_test.storage.bits_write_registers.c = true;
+	r_tie{res, err} = client_test.get_frame_write(bitset_test_2{.c = true});
+	persist_request.assign(res.begin(), res.end());
+	r_tie{res, err} = persisted.process_tcp_adu(persist_request);
+	assert(err == OK && res.size());
+	// changes are batched until the sync interval passed
+	assert(persisted.storage_sync.dirty && persisted.storage_sync.syncs == 0);
+
+	std::println("Reads and other blocks do not dirty the file");
+	assert(persisted.storage_sync.flush() == OK && persisted.storage_sync.syncs == 1);
+	r_tie{res, err} = persisted.process_tcp_adu(tcp_valid_read);
+	assert(err == OK && res[7] == 3);
+	persisted.write(uint16_t(7), &t::halfs_layout::r1);
+	assert(!persisted.storage_sync.dirty);
+
+	std::println("The last changes are synced once the interval passed");
+	persisted.storage_sync.sync_interval = ms(50);
+	persisted.write(uint16_t(9), &t::halfs_write_layout::r4);
+	assert(persisted.storage_sync.dirty);
+	persisted.storage_sync.sync_if_due();
+	assert(persisted.storage_sync.dirty);
+	std::this_thread::sleep_for(ms(60));
+	persisted.storage_sync.sync_if_due();
+	assert(!persisted.storage_sync.dirty && persisted.storage_sync.syncs == 2);
+	persisted.storage_sync.close();
+
+	std::println("Write blocks are restored on startup");
+	static persistent_register<test_layout> restarted{.addr = 1};
+	assert(restarted.storage_sync.open(persist_path, restarted.storage) == OK);
+	assert(restarted.storage_sync.restored);
+	assert(restarted.read(&t::halfs_write_layout::r2) == 0x4321 && restarted.read(&t::halfs_write_layout::r3) == 0x0815);
+	assert(restarted.storage.bits_write_registers.c == true);
+	// only the write blocks are persisted
+	assert(restarted.read(&t::halfs_layout::r1) == 0);
+
+	std::println("Asynchronous syncs are rate limited");
+	restarted.storage_sync.sync_interval = ms(0);
+	restarted.write(uint16_t(1), &t::halfs_write_layout::r4);
+	assert(restarted.storage_sync.syncs == 1 && !restarted.storage_sync.dirty);
+	restarted.storage_sync.close();
+
+	std::println("Files of other layouts are not restored");
+	static persistent_register<example_layout> other_layout{.addr = 1};
+	assert(other_layout.storage_sync.open(persist_path, other_layout.storage) == OK);
+	assert(!other_layout.storage_sync.restored);
+	other_layout.storage_sync.close();
+	static persistent_register<test_layout> after_mismatch{.addr = 1};
+	assert(after_mismatch.storage_sync.open(persist_path, after_mismatch.storage) == OK);
+	assert(!after_mismatch.storage_sync.restored && after_mismatch.read(&t::halfs_write_layout::r2) == 0);
+	after_mismatch.storage_sync.close();
+	unlink(persist_path);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Recorder test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Read responses are recorded");
+	const char *record_path = "/tmp/libmodbus-static-recorder-test.bin";
+	static poll_recorder recorder{};
+	assert(recorder.open<test_layout>(record_path) == OK);
+	int recorded_requests{};
+	modbus_actor<test_layout, serving_tcp_io, 4> recorded{role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &recorded_requests}};
+	recorded.recorder = &recorder;
+	for (uint16_t i: {uint16_t(100), uint16_t(200), uint16_t(300)}) {
+		test_server.write(i, &t::halfs_layout::r2);
+		test_server.write(uint16_t(i + 1), &t::halfs_layout::r3);
+		assert(recorded.read_remote(1, &t::halfs_layout::r1, &t::halfs_layout::r4, ms(100)) == OK);
+	}
+	// writes and reads of other blocks are no part of the r2 column
+	assert(recorded.write_remote(1, &t::halfs_write_layout::r1, ms(100)) == OK);
+	assert(recorded.read_remote(1, &t::halfs_write_layout::r2, ms(100)) == OK);
+	test_server.storage.bits_registers.c = true;
+	assert(recorded.read_remote(1, bitset_test{.a = true, .c = true}, ms(100)) == OK);
+	assert(recorder.records == 5 && recorder.buffered() > 0);
+	recorder.close();
+
+	std::println("Typed columns are decoded offline");
+	recording_reader<test_layout> reader{};
+	assert(reader.open(record_path) == OK);
+	auto r2_column = reader.column(&t::halfs_layout::r2);
+	auto r3_column = reader.column(&t::halfs_layout::r3);
+	assert(r2_column.size() == 3 && r3_column.size() == 3 && !reader.truncated);
+	for (int i: std::ranges::iota_view{0, 3}) {
+		assert(r2_column[i].value == 100 * (i + 1) && r3_column[i].value == 100 * (i + 1) + 1);
+		assert(r2_column[i].unit == 1);
+		assert(i == 0 || r2_column[i].time >= r2_column[i - 1].time);
+	}
+	int record_count{};
+	bool coil_c{};
+	reader.for_each([&](const auto &r, const test_layout &image) {
+		++record_count;
+		if (r.fc == function_code::READ_COILS)
+			coil_c = image.bits_registers.c;
+	});
+	assert(record_count == 5 && coil_c);
+	assert(recording_reader<example_layout>{}.open(record_path) == RECORDING_LAYOUT_MISMATCH);
+
+	std::println("A torn last record is ignored");
+	std::filesystem::resize_file(record_path, std::filesystem::file_size(record_path) - 3);
+	assert(reader.open(record_path) == OK);
+	record_count = 0;
+	reader.for_each([&](const auto&, const test_layout&) { ++record_count; });
+	assert(record_count == 4 && reader.truncated);
+	std::filesystem::remove(record_path);
+
+	std::println("A full ring drops records");
+	static poll_recorder unflushed{};
+	unflushed.inline_flush = false;
+	std::array<uint8_t, 8> block{};
+	while (unflushed.record(1, function_code::READ_HOLDING_REGISTERS, 0, 4, block))
+		;
+	assert(unflushed.dropped == 1 && unflushed.records == poll_recorder::RING_SIZE / (sizeof(record_header) + block.size()));
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "History test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Read responses covering the field are appended");
+	using history_actor = modbus_actor<test_layout, serving_tcp_io, 4>;
+	static field_history<test_layout, &t::halfs_layout::r2, 256, 16> r2_history{.unit = 1};
+	int history_requests{};
+	history_actor historic{role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &history_requests}};
+	historic.on_read = [](void *ctx, const history_actor::last_completed &request) {
+		r2_history.update(request, static_cast<history_actor*>(ctx)->storage);
+	};
+	historic.on_read_ctx = &historic;
+	for (uint16_t i: {uint16_t(10), uint16_t(30), uint16_t(20)}) {
+		test_server.write(i, &t::halfs_layout::r2);
+		assert(historic.read_remote(1, &t::halfs_layout::r1, &t::halfs_layout::r4, ms(100)) == OK);
+	}
+	// reads without r2 are not part of the history
+	assert(historic.read_remote(1, &t::halfs_layout::r3, ms(100)) == OK);
+	assert(historic.read_remote(1, &t::halfs_write_layout::r2, ms(100)) == OK);
+	assert(r2_history.size() == 3 && r2_history.last() == 20);
+	auto recent = r2_history.window(std::chrono::hours(1));
+	assert(recent.count == 3 && recent.min == 10 && recent.max == 30 && recent.avg == 20);
+
+	std::println("Window queries combine block aggregates");
+	using history_clock = std::chrono::steady_clock;
+	static field_history<test_layout, &t::halfs_layout::r1, 256, 16> ramp{};
+	auto t0 = history_clock::now();
+	// 1000 samples one second apart, only the last 256 are kept
+	for (int i: std::ranges::iota_view{0, 1000})
+		ramp.append(uint16_t(i), t0 + std::chrono::seconds(i));
+	auto now = t0 + std::chrono::seconds(999);
+	assert(ramp.size() == 256 && ramp.window(std::chrono::hours(1), now).count == 256);
+	for (int secs: {0, 1, 15, 16, 17, 100, 200, 255}) {
+		auto w = ramp.window(std::chrono::seconds(secs), now);
+		double expected_avg = (999 + (999 - secs)) / 2.;
+		assert(w.count == uint32_t(secs + 1) && w.min == 999 - secs && w.max == 999 && w.avg == expected_avg);
+	}
+	assert(ramp.window(std::chrono::seconds(10), now + std::chrono::hours(1)).count == 0);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Deadband test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Only changes exceeding the deadband are published");
+	static change_detector<test_layout> detector{.unit = 1};
+	assert(detector.add(&t::halfs_layout::r2, deadband::absolute(5)) == OK);
+	assert(detector.add(&t::halfs_layout::r3, deadband::percent(10)) == OK);
+	assert(detector.add(&t::halfs_layout::r4) == OK);
+	assert(detector.add_bits(bitset_test{.c = true, .e = true}) == OK);
+	int detector_requests{};
+	history_actor detected{role_t::CLIENT, test_layout{}, serving_tcp_io{&test_server, &detector_requests}};
+	detected.on_read = [](void *ctx, const history_actor::last_completed &request) {
+		detector.update(request, static_cast<history_actor*>(ctx)->storage);
+	};
+	detected.on_read_ctx = &detected;
+	auto poll_halfs = [&](uint16_t r2, uint16_t r3, uint16_t r4) {
+		test_server.write(r2, &t::halfs_layout::r2);
+		test_server.write(r3, &t::halfs_layout::r3);
+		test_server.write(r4, &t::halfs_layout::r4);
+		detector.clear();
+		assert(detected.read_remote(1, &t::halfs_layout::r1, &t::halfs_layout::r4, ms(100)) == OK);
+		return detector.change_set();
+	};
+	auto first = poll_halfs(10, 100, 1);
+	assert(first.size() == 3 && first[0].addr == 1 && first[1].addr == 2 && first[2].addr == 3);
+	assert(first[0].block == libmodbus_static::register_t::HALFS && first[0].rule == 0 && first[0].count == 1);
+	assert(poll_halfs(10, 100, 1).empty());
+	// r2 within 5, r3 within 10%
+	assert(poll_halfs(14, 109, 1).empty());
+	// the drift adds up against the published value
+	auto drift = poll_halfs(16, 111, 1);
+	assert(drift.size() == 2 && drift[0].addr == 1 && drift[1].addr == 2);
+	assert(detector.published.halfs_registers.r2 == to_hb_first(uint16_t(16)));
+	auto exact = poll_halfs(16, 111, 2);
+	assert(exact.size() == 1 && exact[0].rule == 2);
+
+	std::println("Watched bits are compared exactly");
+	test_server.storage.bits_registers = bitset_test{.c = true, .d = true};
+	detector.clear();
+	assert(detected.read_remote(1, bitset_test{.a = true, .z = true}, ms(100)) == OK);
+	auto bits = detector.change_set();
+	assert(bits.size() == 1 && bits[0].addr == bitset_test::OFFSET + 2 && bits[0].rule == -1);
+	detector.clear();
+	assert(detected.read_remote(1, bitset_test{.a = true, .z = true}, ms(100)) == OK);
+	assert(detector.change_set().empty());
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Chunked transfer test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Oversized register ranges are split into maximum size requests");
+	using large_server = modbus_register<large_layout>;
+	using l = large_layout;
+	static large_server big_server{.addr = 1};
+	int chunk_requests{};
+	modbus_actor<large_layout, serving_tcp_io_t<large_server>, 4> chunked{role_t::CLIENT, large_layout{}, {&big_server, &chunk_requests}};
+	for (uint16_t i: std::ranges::iota_view{0, 298})
+		big_server.storage.halfs_registers.values[i] = i;
+	big_server.write(uint16_t(0xaaaa), &l::halfs_layout::first);
+	big_server.write(uint16_t(0xbbbb), &l::halfs_layout::last);
+	assert(chunked.read_remote(1, &l::halfs_layout::first, &l::halfs_layout::last, ms(100)) == OK);
+	// 300 registers: 125 + 125 + 50
+	assert(chunk_requests == 3);
+	assert(chunked.read(&l::halfs_layout::first) == 0xaaaa && chunked.read(&l::halfs_layout::last) == 0xbbbb);
+	assert(chunked.storage.halfs_registers.values == big_server.storage.halfs_registers.values);
+
+	chunk_requests = 0;
+	for (uint16_t i: std::ranges::iota_view{0, 298})
+		chunked.storage.halfs_write_registers.values[i] = 1000 + i;
+	chunked.write(uint16_t(0xcccc), &l::halfs_write_layout::last);
+	assert(chunked.write_remote(1, &l::halfs_write_layout::first, &l::halfs_write_layout::last, ms(100)) == OK);
+	// 300 registers: 123 + 123 + 54
+	assert(chunk_requests == 3);
+	assert(big_server.storage.halfs_write_registers.values == chunked.storage.halfs_write_registers.values);
+	assert(big_server.read(&l::halfs_write_layout::last) == 0xcccc);
+
+	std::println("Oversized bit ranges are split as well");
+	for (int i: std::ranges::iota_view{0, 260})
+		big_server.storage.bits_registers.bits[i] = uint8_t(i * 7);
+	l::bits_layout all_coils{};
+	all_coils.bits.front() = 0x01;
+	all_coils.bits.back() = 0x80;
+	chunk_requests = 0;
+	assert(chunked.read_remote(1, all_coils, ms(100)) == OK);
+	// 2080 bits: 2000 + 80
+	assert(chunk_requests == 2 && chunked.storage.bits_registers.bits == big_server.storage.bits_registers.bits);
+	for (int i: std::ranges::iota_view{0, 260})
+		chunked.storage.bits_write_registers.bits[i] = uint8_t(i * 3 + 1);
+	l::bits_write_layout all_inputs{};
+	all_inputs.bits.front() = 0x01;
+	all_inputs.bits.back() = 0x80;
+	chunk_requests = 0;
+	assert(chunked.write_remote(1, all_inputs, ms(100)) == OK);
+	// 2080 bits: 1968 + 112
+	assert(chunk_requests == 2 && chunked.storage.bits_write_registers.bits == big_server.storage.bits_write_registers.bits);
+
+	std::println("Fields split by the chunks reach history, change detection and recordings");
+	using split_actor = modbus_actor<split_layout, serving_tcp_io_t<modbus_register<split_layout>>, 4>;
+	static modbus_register<split_layout> split_server{.addr = 1};
+	split_actor split_client{role_t::CLIENT, split_layout{}, {&split_server, &chunk_requests}};
+	static field_history<split_layout, &split_layout::halfs_layout::split, 64> split_history{.unit = 1};
+	static change_detector<split_layout> split_changes{.unit = 1};
+	assert(split_changes.add(&split_layout::halfs_layout::split) == OK);
+	split_client.on_read_ctx = &split_client;
+	split_client.on_read = [](void *ctx, const split_actor::last_completed &request) {
+		split_history.update(request, static_cast<split_actor*>(ctx)->storage);
+		split_changes.update(request, static_cast<split_actor*>(ctx)->storage);
+	};
+	const char *split_record_path = "/tmp/libmodbus-static-split-recorder-test.bin";
+	static poll_recorder split_recorder{};
+	assert(split_recorder.open<split_layout>(split_record_path) == OK);
+	split_client.recorder = &split_recorder;
+	// only the first half of the field changes, it is in the first chunk
+	split_server.write(uint32_t(0x00070000), &split_layout::halfs_layout::split);
+	chunk_requests = 0;
+	assert(split_client.read_remote(1, &split_layout::halfs_layout::head, &split_layout::halfs_layout::tail, ms(100)) == OK);
+	assert(chunk_requests == 2);
+	assert(split_history.size() == 1 && split_history.last() == 0x00070000);
+	assert(split_changes.change_set().size() == 1 && split_changes.change_set()[0].addr == 124);
+	split_changes.clear();
+	assert(split_client.read_remote(1, &split_layout::halfs_layout::head, &split_layout::halfs_layout::tail, ms(100)) == OK);
+	assert(split_history.size() == 2 && split_changes.change_set().empty());
+	split_recorder.close();
+	recording_reader<split_layout> split_reader{};
+	assert(split_reader.open(split_record_path) == OK);
+	auto split_column = split_reader.column(&split_layout::halfs_layout::split);
+	assert(split_column.size() == 2 && split_column[0].value == 0x00070000 && split_column[1].value == 0x00070000);
+	unlink(split_record_path);
+
+	std::println("Done.\n");
+
+	std::cout << "---------------------------------------------------------------------------------------\n";
+	std::cout << "Scatter gather response test\n";
+	std::cout << "---------------------------------------------------------------------------------------\n";
+
+	std::println("Read responses point into the storage");
+	auto to_request = [](std::span<const uint8_t> frame) { return std::vector<uint8_t>{frame.begin(), frame.end()}; };
+	assert(client_test.start_tcp_frame(50, 1) == OK);
+	auto iov_read = to_request(client_test.get_frame_read(&t::halfs_layout::r1, &t::halfs_layout::r4).res);
+	response_iov iov = test_server.process_tcp_adu_iov(iov_read);
+	assert(iov.err == OK && iov.header.size() == 9 && iov.payload.size() == 8);
+	assert(iov.payload.data() == reinterpret_cast<const uint8_t*>(&test_server.storage.halfs_registers));
+	std::vector<uint8_t> gathered{iov.header.begin(), iov.header.end()};
+	gathered.insert(gathered.end(), iov.payload.begin(), iov.payload.end());
+	r_tie{res, err} = test_server.process_tcp_adu(iov_read);
+	assert(err == OK && std::ranges::equal(gathered, res));
+	std::println("Other responses are returned completely in the header");
+	iov = test_server.process_tcp_adu_iov(write_register_request);
+	assert(iov.err == OK && iov.payload.empty() && std::ranges::equal(iov.header, write_register_request));
+	assert(client_test.start_tcp_frame(51, 1) == OK);
+	iov = test_server.process_tcp_adu_iov(to_request(client_test.get_frame_read(libmodbus_static::register_t::HALFS, 3, 2).res));
+	assert(iov.payload.empty() && iov.header.size() == 9 && iov.header[7] == 0x83 && iov.header[8] == 2);
+	std::println("Only the header has to fit into the frame");
+	static modbus_register<large_layout, RTU_FRAME_SIZE> small_frame_server{.addr = 1};
+	iov = small_frame_server.process_tcp_adu_iov(std::vector<uint8_t>{0, 1, 0, 0, 0, 6, 1, 3, 0, 100, 0, 125});
+	assert(iov.err == OK && iov.header.size() == 9 && iov.payload.size() == 250);
+	iov = small_frame_server.process_tcp_adu_iov(std::vector<uint8_t>{0, 1, 0, 0, 0, 6, 1, 3, 0, 100, 0, 126});
+	assert(iov.payload.empty() && iov.header[7] == 0x83 && iov.header[8] == 3);
+
+	std::println("The server sends large responses without copying them");
+	static tcp_linux_server<large_server, 4> big_tcp_server{.handler = big_server};
+	assert(big_tcp_server.init(0) == OK);
+	int big_fd = socket(AF_INET, SOCK_STREAM, 0);
+	server_addr.sin_port = htons(big_tcp_server.port());
+	assert(connect(big_fd, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) == 0);
+	static large_server big_client{.role = role_t::CLIENT};
+	std::vector<uint8_t> big_requests;
+	for (uint16_t tid: {uint16_t(60), uint16_t(61)}) {
+		assert(big_client.start_tcp_frame(tid, 1) == OK);
+		auto frame = big_client.get_frame_read(libmodbus_static::register_t::HALFS, 100 + (tid - 60) * 125, 125).res;
+		big_requests.insert(big_requests.end(), frame.begin(), frame.end());
+	}
+	assert(send(big_fd, big_requests.data(), big_requests.size(), 0) == ssize_t(big_requests.size()));
+	std::vector<uint8_t> big_received;
+	for (int i = 0; i < 100 && big_received.size() < 2 * 259; ++i) {
+		assert(big_tcp_server.poll(ms(10)) == OK);
+		std::array<uint8_t, 1024> buf;
+		ssize_t n = recv(big_fd, buf.data(), buf.size(), MSG_DONTWAIT);
+		if (n > 0)
+			big_received.insert(big_received.end(), buf.begin(), buf.begin() + n);
+	}
+	assert(big_received.size() == 2 * 259);
+	const uint8_t *big_storage = reinterpret_cast<const uint8_t*>(&big_server.storage.halfs_registers);
+	for (int i: {0, 1}) {
+		std::span<const uint8_t> response{big_received.data() + i * 259, 259};
+		assert(response[1] == 60 + i && response[5] == 253 && response[7] == 3 && response[8] == 250);
+		assert(std::ranges::equal(response.subspan(9), std::span{big_storage + i * 250, 250}));
+	}
+	close(big_fd);
+	big_tcp_server.deinit();
+
 	std::println("Done.\n");
 
 	std::println("");
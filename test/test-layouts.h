@@ -0,0 +1,147 @@
+#pragma once
+
+#include <modbus-register.h>
+
+// register layouts shared by the unit tests and the benchmarks
+
+struct bitset_test {
+	constexpr static int OFFSET{20};
+	bool a: 1{};
+	bool b: 1{};
+	bool c: 1{};
+	bool d: 1{};
+	bool e: 1{};
+	bool f: 1{};
+	bool g: 1{};
+	bool h: 1{};
+	bool i: 1{};
+	bool j: 1{};
+	bool k: 1{};
+	bool l: 1{};
+	bool m: 1{};
+	bool n: 1{};
+	bool o: 1{};
+	bool p: 1{};
+	bool q: 1{};
+	bool r: 1{};
+	bool s: 1{};
+	bool t: 1{};
+	bool u: 1{};
+	bool v: 1{};
+	bool w: 1{};
+	bool x: 1{};
+	bool y: 1{};
+	bool z: 1{};
+};
+struct bitset_test_2 {
+	constexpr static int OFFSET{10};
+	bool a: 1{};
+	bool b: 1{};
+	bool c: 1{};
+	bool d: 1{};
+	bool e: 1{};
+	bool f: 1{};
+	bool g: 1{};
+	bool h: 1{};
+	bool i: 1{};
+	bool j: 1{};
+	bool k: 1{};
+	bool l: 1{};
+	bool m: 1{};
+	bool n: 1{};
+	bool o: 1{};
+	bool p: 1{};
+	bool q: 1{};
+	bool r: 1{};
+	bool s: 1{};
+	bool t: 1{};
+	bool u: 1{};
+	bool v: 1{};
+	bool w: 1{};
+	bool x: 1{};
+	bool y: 1{};
+	bool z: 1{};
+};
+
+#pragma pack(push, 1)
+struct example_layout {
+	struct bits_layout {
+		constexpr static int OFFSET{0};
+		bool enabled: 1{};
+		bool active: 1{};
+		bool visible: 1{};
+		bool trusted: 1{};
+		bool uknown: 1{};
+	} bits_registers;
+	// if eg. no discrete inputs are used, just leave them out else
+	// struct bits_write_layout {
+	// 	constexpr static int OFFSET{256};
+	//	bool setable: 1{};
+	// } bits_write_registers;
+	struct halfs_layout {
+		constexpr static int OFFSET{40000};
+		float a{};
+		float b{};
+		uint16_t another{};
+		libmodbus_static::mod_string<32> string_field{"Default"}; // careful with default inited strings, have to be byte swapped
+		uint32_t events{};
+	} halfs_registers;
+	struct halfs_write_layout {
+		constexpr static int OFFSET{60000};
+		float a{};
+		float b{};
+		uint16_t others{};
+	} halfs_write_registers;
+};
+struct test_layout {
+	bitset_test bits_registers{};
+	bitset_test_2 bits_write_registers{};
+	struct halfs_layout {
+		constexpr static int OFFSET{0};
+		uint16_t r1{};
+		uint16_t r2{};
+		uint16_t r3{};
+		uint16_t r4{};
+	} halfs_registers;
+	struct halfs_write_layout {
+		constexpr static int OFFSET{0};
+		uint16_t r1{};
+		uint16_t r2{};
+		uint16_t r3{};
+		uint16_t r4{};
+	} halfs_write_registers;
+};
+// every block is larger than a single request
+struct large_layout {
+	struct bits_layout {
+		constexpr static int OFFSET{0};
+		std::array<uint8_t, 260> bits{};
+	} bits_registers;
+	struct bits_write_layout {
+		constexpr static int OFFSET{4000};
+		std::array<uint8_t, 260> bits{};
+	} bits_write_registers;
+	struct halfs_layout {
+		constexpr static int OFFSET{100};
+		uint16_t first{};
+		std::array<uint16_t, 298> values{};
+		uint16_t last{};
+	} halfs_registers;
+	struct halfs_write_layout {
+		constexpr static int OFFSET{1000};
+		uint16_t first{};
+		std::array<uint16_t, 298> values{};
+		uint16_t last{};
+	} halfs_write_registers;
+};
+
+// a field across the first chunk boundary of an oversized read
+struct split_layout {
+	struct halfs_layout {
+		constexpr static int OFFSET{0};
+		std::array<uint16_t, 124> head{};
+		uint32_t split{};
+		std::array<uint16_t, 10> tail{};
+	} halfs_registers;
+};
+#pragma pack(pop)